@@ -1,8 +1,216 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "tlb_sim.h"
 
+static double per_kilo(unsigned long long n, unsigned long long insns)
+{
+	return insns != 0 ? 1000.0 * (double)n / (double)insns : 0.0;
+}
+
+/* Print one line of the time series per window of instructions */
+static void print_window(const struct SIM_RESULT *w, void *arg __attribute__((unused)))
+{
+	fprintf(stdout, "%-10s\t%20llu\t%20.4lf\t%20.4lf\t%20.4lf\t%20llu\n", "Window", w->insns,
+		per_kilo(w->ntlb.miss, w->insns), per_kilo(w->pwc.miss, w->insns), per_kilo(w->accs, w->insns), w->accs);
+}
+
+/* Print the counters of one window of records, which has no instructions to divide by */
+static void print_window_records(const struct SIM_RESULT *w, void *arg __attribute__((unused)))
+{
+	fprintf(stdout, "%-10s\t%20llu\t%20llu\t%20llu\t%20llu\n", "Window", w->records, w->ntlb.miss, w->pwc.miss, w->accs);
+}
+
+/* Write the counters of one window to the time series file, as CSV */
+static void write_window(const struct SIM_RESULT *w, void *arg)
+{
+	fprintf((FILE*)arg, "%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", w->trace != NULL ? w->trace : "all", w->records, w->insns, w->tlb.hit, w->tlb.miss,
+		w->ntlb.hit, w->ntlb.miss, w->pwc.hit, w->pwc.miss, w->accs);
+}
+
+static const char *file_headers[] = {
+	"trace,records,insns,tlb_hit,tlb_miss,ntlb_hit,ntlb_miss,pwc_hit,pwc_miss,mem_accs\n",
+	"# asid pc walks ntlb_miss pwc_miss mem_accs\n"};
+
+/* Flush the series and the profile, and return their sizes for a checkpoint */
+static void save_files(unsigned long long sizes[SIM_CKPT_FILES], void *arg)
+{
+	FILE **files = (FILE**)arg;
+	int i;
+
+	for(i = 0; i < 2; i++){
+		if(files[i] == NULL)	continue;
+		fflush(files[i]);
+		sizes[i] = ftello(files[i]);
+	}
+}
+
+/* Truncate the series and the profile to the sizes of the checkpoint resumed, and start them again if they are empty */
+static void restore_files(const unsigned long long sizes[SIM_CKPT_FILES], void *arg)
+{
+	FILE **files = (FILE**)arg;
+	int i;
+
+	for(i = 0; i < 2; i++){
+		if(files[i] == NULL)	continue;
+		fflush(files[i]);
+		if(ftruncate(fileno(files[i]), sizes[i]) != 0 || fseeko(files[i], sizes[i], SEEK_SET) != 0)
+			fprintf(stderr, "can't truncate %s\n", i == 0 ? "the series" : "the profile");
+		if(sizes[i] == 0)	fputs(file_headers[i], files[i]);
+	}
+}
+
+/* Write the cost of one PC to the profile, see tlb_sym */
+static void print_pc(const struct SIM_PC_COST *c, void *arg)
+{
+	fprintf((FILE*)arg, "%u 0x%08x %llu %llu %llu %llu\n", c->asid, c->pc, c->walks, c->ntlb_miss, c->pwc_miss, c->accs);
+}
+
+/* Print the cost of one memory region */
+static void print_region(const struct SIM_REGION_COST *c, void *arg __attribute__((unused)))
+{
+	fprintf(stdout, "%-10s\t%20llu\t%20llu\t%20llu\t%20llu\t%s\n", "Region", c->walks, c->ntlb_miss, c->pwc_miss, c->accs, c->name);
+}
+
+/* Print one of the pages causing the most misses */
+static void print_hot(const struct SIM_HOT_PAGE *h, void *arg __attribute__((unused)))
+{
+	static const char *kinds[] = {"Page", "PT", "EPT"};
+
+	fprintf(stdout, "%-10s\t%20s\t          0x%08x\t%20llu\t%20llu\n", "Hot", kinds[h->kind], h->page, h->misses, h->error);
+}
+
+/* Parse a stage-2 layout: short or lpae, followed by options such as levels=3,bits=2.9.9,granule=12,entry=3,base=0x100000 */
+static int parse_stage2(const char *spec, struct SIM_STAGE2 *s2)
+{
+	static const struct SIM_STAGE2 lpae = {3, {2, 9, 9}, 12, 3, 0, 0, 0, 0};
+	static const struct SIM_STAGE2 arm = {2, {12, 8}, 12, 2, 0, 0, 0, 0};
+	char buf[256], *opt, *value, *save, *b;
+	int k;
+
+	snprintf(buf, sizeof(buf), "%s", spec);
+	*s2 = arm;
+
+	for(opt = strtok_r(buf, ",", &save); opt != NULL; opt = strtok_r(NULL, ",", &save)){
+		if((value = strchr(opt, '=')) != NULL)	*value++ = '\0';
+
+		if(strcmp(opt, "lpae") == 0)	*s2 = lpae;
+		else if(strcmp(opt, "short") == 0)	*s2 = arm;
+		else if(value == NULL)	return -1;
+		else if(strcmp(opt, "levels") == 0)	s2->levels = atoi(value);
+		else if(strcmp(opt, "granule") == 0)	s2->granule_bits = atoi(value);
+		else if(strcmp(opt, "entry") == 0)	s2->entry_bits = atoi(value);
+		else if(strcmp(opt, "base") == 0)	s2->base = strtoul(value, NULL, 0);
+		else if(strcmp(opt, "block") == 0)	s2->block_level = atoi(value);
+		else if(strcmp(opt, "bstart") == 0)	s2->block_start = strtoul(value, NULL, 0);
+		else if(strcmp(opt, "bend") == 0)	s2->block_end = strtoul(value, NULL, 0);
+		else if(strcmp(opt, "bits") == 0){
+			memset(s2->bits, 0, sizeof(s2->bits));
+			for(k = 0, b = value; k < SIM_S2_MAX_LEVELS && *b != '\0'; k++){
+				s2->bits[k] = strtol(b, &b, 10);
+				if(*b == '.')	b++;
+			}
+		}
+		else		return -1;
+	}
+
+	return 0;
+}
+
+/* Print the per-step and per-level breakdown and the per-walk histograms of a result. */
+static void print_breakdown(const struct SIM_RESULT *r)
+{
+	static const char *steps[] = {"PTL1", "PTL2", "EPTL1", "EPTL2", "EPTL3", "EPTL4", "GPA"};
+	static const char *levels[] = {"Section", "Fault", "Walk"};
+	int s;
+
+	fprintf(stdout, "%-10s\t%20s\t%20s\t%20s\t%20s\t%20s\n", "Step", "NTLB Hit", "NTLB Miss", "PWC Hit", "PWC Miss", "Mem Access");
+	for(s = 0; s < SIM_STEPS; s++){
+		if((s == SIM_STEP_EPTL3 || s == SIM_STEP_EPTL4) && r->step[s].pwc.hit + r->step[s].pwc.miss + r->step[s].accs == 0)	continue;
+		fprintf(stdout, "%-10s\t%20llu\t%20llu\t%20llu\t%20llu\t%20llu\n", steps[s], r->step[s].ntlb.hit, r->step[s].ntlb.miss,
+			r->step[s].pwc.hit, r->step[s].pwc.miss, r->step[s].accs);
+	}
+
+	fprintf(stdout, "%-10s\t%20s\t%20s\t%20s\t%20s\t%20s\t%20s\n", "Level", "Walks", "NTLB Hit", "NTLB Miss", "PWC Hit", "PWC Miss", "Mem Access");
+	for(s = 0; s < SIM_LEVELS; s++){
+		fprintf(stdout, "%-10s\t%20llu\t%20llu\t%20llu\t%20llu\t%20llu\t%20llu\n", levels[s], r->level[s].walks, r->level[s].ntlb.hit,
+			r->level[s].ntlb.miss, r->level[s].pwc.hit, r->level[s].pwc.miss, r->level[s].accs);
+	}
+
+	fprintf(stdout, "%-10s\t%20s\t%20s\n", "Per Walk", "Refs", "Mem Access");
+	for(s = 0; s < SIM_HIST_BINS; s++){
+		if(r->refs_hist[s] + r->accs_hist[s] == 0)	continue;
+		fprintf(stdout, "%-8d%s\t%20llu\t%20llu\n", s, s == SIM_HIST_BINS - 1 ? "+ " : "  ", r->refs_hist[s], r->accs_hist[s]);
+	}
+}
+
+/* Print the totals, breakdowns and rates of a result. \a policy is the main TLB policy, negative if there is none. */
+static void print_result(const struct SIM_RESULT *r, int policy)
+{
+	if(policy >= 0){
+		fprintf(stdout, "%-10s\t%20llu\t%20llu\t%20.4lf\n", "TLB", r->tlb.hit, r->tlb.miss,
+			100.0 * ((double)r->tlb.hit) / ((double)(r->tlb.hit + r->tlb.miss)));
+	}
+
+	fprintf(stdout, "%-10s\t%20llu\t%20llu\t%20.4lf\n", "NTLB", r->ntlb.hit, r->ntlb.miss,
+		100.0 * ((double)r->ntlb.hit) / ((double)(r->ntlb.hit + r->ntlb.miss)));
+
+	fprintf(stdout, "%-10s\t%20llu\t%20llu\t%20.4lf\t%20llu\n", "PWC", r->pwc.hit, r->pwc.miss,
+		100.0 * ((double)r->pwc.hit) / ((double)(r->pwc.hit + r->pwc.miss)),
+		r->accs);
+
+	if(r->priv[1].ntlb.miss + r->priv[1].pwc.miss + r->priv[1].tlb.miss + r->priv[1].accs != 0){
+		static const char *levels[] = {"User", "Kernel"};
+		int p;
+
+		fprintf(stdout, "%-10s\t%20s\t%20s\t%20s\t%20s\n", "Priv", "TLB Miss", "NTLB Miss", "PWC Miss", "Mem Access");
+		for(p = 0; p < 2; p++){
+			fprintf(stdout, "%-10s\t%20llu\t%20llu\t%20llu\t%20llu\n", levels[p], r->priv[p].tlb.miss,
+				r->priv[p].ntlb.miss, r->priv[p].pwc.miss, r->priv[p].accs);
+		}
+	}
+
+	print_breakdown(r);
+
+	if(r->insns != 0){
+		fprintf(stdout, "%-10s\t%20llu\n", "Insns", r->insns);
+		fprintf(stdout, "%-10s\t%20.4lf\n", "NTLB MPKI", per_kilo(r->ntlb.miss, r->insns));
+		fprintf(stdout, "%-10s\t%20.4lf\n", "PWC MPKI", per_kilo(r->pwc.miss, r->insns));
+		if(policy >= 0)	fprintf(stdout, "%-10s\t%20.4lf\n", "TLB MPKI", per_kilo(r->tlb.miss, r->insns));
+		fprintf(stdout, "%-10s\t%20.6lf\n", "Acc/Insn", (double)r->accs / (double)r->insns);
+	}
+}
+
+/* Print the counters of each consolidated VM, with the others and alone, and the interference: the extra memory accesses. */
+static void print_vms(struct SIM_VM_RESULT **vms)
+{
+	struct SIM_VM_RESULT all;
+	int i;
+
+	memset(&all, 0, sizeof(all));
+	fprintf(stdout, "%-10s\t%20s\t%20s\t%20s\t%20s\t%20s\t%20s\t%20s\t%20s\t%20s\t%s\n", "VM", "Quanta", "Evicted", "NTLB Miss", "Solo NTLB Miss",
+		"PWC Miss", "Solo PWC Miss", "Mem Access", "Solo Mem Access", "Interference(%)", "Trace");
+	for(i = 0; vms[i] != NULL; i++){
+		fprintf(stdout, "%-10d\t%20llu\t%20llu\t%20llu\t%20llu\t%20llu\t%20llu\t%20llu\t%20llu\t%20.4lf\t%s\n", i, vms[i]->quanta, vms[i]->evicted,
+			vms[i]->shared.ntlb.miss, vms[i]->solo.ntlb.miss, vms[i]->shared.pwc.miss, vms[i]->solo.pwc.miss, vms[i]->shared.accs, vms[i]->solo.accs,
+			vms[i]->solo.accs != 0 ? 100.0 * ((double)vms[i]->shared.accs - (double)vms[i]->solo.accs) / (double)vms[i]->solo.accs : 0.0, vms[i]->trace);
+
+		all.quanta += vms[i]->quanta;
+		all.evicted += vms[i]->evicted;
+		all.shared.ntlb.miss += vms[i]->shared.ntlb.miss;
+		all.solo.ntlb.miss += vms[i]->solo.ntlb.miss;
+		all.shared.pwc.miss += vms[i]->shared.pwc.miss;
+		all.solo.pwc.miss += vms[i]->solo.pwc.miss;
+		all.shared.accs += vms[i]->shared.accs;
+		all.solo.accs += vms[i]->solo.accs;
+	}
+	fprintf(stdout, "%-10s\t%20llu\t%20llu\t%20llu\t%20llu\t%20llu\t%20llu\t%20llu\t%20llu\t%20.4lf\n", "Total", all.quanta, all.evicted,
+		all.shared.ntlb.miss, all.solo.ntlb.miss, all.shared.pwc.miss, all.solo.pwc.miss, all.shared.accs, all.solo.accs,
+		all.solo.accs != 0 ? 100.0 * ((double)all.shared.accs - (double)all.solo.accs) / (double)all.solo.accs : 0.0);
+}
+
 int main(int argc, char* argv[])
 {
 	int tlb_size, ntlb_size, pwc_size;
@@ -10,9 +218,51 @@ int main(int argc, char* argv[])
 	int i;
 	int cmd;
 	struct SIM_RESULT **results;
+	static const char *policies[] = {"lru", "fifo", "random"};
+	int policy = -1;		// traces of main TLB misses
+	unsigned long long window = 0, window_records = 0, ckpt_records = 0, quantum;
+	enum TLBSIM_SWITCH vm_policy = TS_TAGGED;
+	const char *profile = NULL, *series = NULL, *ckpt = NULL, *warm = NULL;
+	struct SIM_STAGE2 s2;
+	struct SIM_VM_RESULT **vms;
+	struct SIM_RESULT total;
+	FILE *fprof = NULL, *fseries = NULL;
+	FILE *files[2] = {NULL, NULL};		// kept in step with the checkpoints
+	int opt, bad = 0, by_region = 0, hot = 0, consolidate = 0;
+	char *end;
+
+	while((opt = getopt(argc, argv, "w:n:o:p:rt:c:e:W:s:m:")) != -1){
+		if(opt == 'w')	window = strtoull(optarg, NULL, 10);
+		else if(opt == 'n')	window_records = strtoull(optarg, NULL, 10);
+		else if(opt == 'o')	series = optarg;
+		else if(opt == 'p')	profile = optarg;
+		else if(opt == 'r')	by_region = 1;
+		else if(opt == 't')	hot = atoi(optarg);
+		else if(opt == 'c')	ckpt = optarg;
+		else if(opt == 'e')	ckpt_records = strtoull(optarg, NULL, 10);
+		else if(opt == 'W')	warm = optarg;
+		else if(opt == 's'){
+			if(parse_stage2(optarg, &s2) != 0 || tlbsim_set_stage2(&s2) != 0)	bad = 1;
+		}
+		else if(opt == 'm'){		// quantum[,tagged|flush]
+			quantum = strtoull(optarg, &end, 10);
+			if(strcmp(end, ",flush") == 0)	vm_policy = TS_FLUSH;
+			else if(*end != '\0' && strcmp(end, ",tagged") != 0)	bad = 1;
+			if(tlbsim_set_vms(quantum, vm_policy) != 0)	bad = 1;
+			consolidate = 1;
+		}
+		else		bad = 1;
+	}
+	argc -= optind - 1;		// positional arguments start at argv[1]
+	argv += optind - 1;
+
+	if(window != 0 && window_records != 0)	bad = 1;
+	if(series != NULL && window == 0 && window_records == 0)	bad = 1;
+	if(ckpt == NULL && ckpt_records != 0)	bad = 1;
+	if(consolidate && (ckpt != NULL || warm != NULL || profile != NULL || by_region))	bad = 1;
 
-	if(argc != 6){
-		fprintf(stderr, "Usage: %s tlb_size tlb_way ntlb_size pwc_size cmd_idx={NTLB, PWC_EPT, PWC_NOEPT, FULL}\n", argv[0]);
+	if(bad || argc < 6 || argc > 8){
+		fprintf(stderr, "Usage: tlb_sim [-w window_insns | -n window_records] [-o series.csv] [-p profile] [-r] [-t hot_pages] [-c ckpt_dir [-e ckpt_records]] [-W warm_ckpt] [-s short|lpae[,levels=n,bits=a.b.c,granule=12,entry=2|3,base=addr,block=level,bstart=addr,bend=addr]] [-m quantum[,tagged|flush]] tlb_size tlb_way ntlb_size pwc_size cmd_idx={NTLB, PWC_EPT, PWC_NOEPT, FULL} [private_caches={0, 1}] [main_tlb={miss, lru, fifo, random}]\n");
 		return 1;
 	}
 
@@ -22,22 +272,88 @@ int main(int argc, char* argv[])
 	pwc_size = atoi(argv[4]);
 	cmd = atoi(argv[5]);
 
+	if(argc >= 7)	tlbsim_set_private_caches(atoi(argv[6]));
+	if(argc == 8){
+		for(i = 0; i < 3; i++)
+			if(strcmp(argv[7], policies[i]) == 0)	policy = i;
+		if(policy < 0 && strcmp(argv[7], "miss") != 0){
+			fprintf(stderr, "unknown main TLB policy %s\n", argv[7]);
+			return 1;
+		}
+	}
+
+	// page-mode traces are filtered through a main TLB of tlb_size entries and tlb_way ways
+	if(policy >= 0 && tlbsim_set_main_tlb(tlb_size, tlb_way, policy) != 0)	return 1;
+
+	if(series != NULL){
+		// with checkpoints, the file is truncated to the windows reported before the checkpoint resumed
+		if((fseries = fopen(series, ckpt != NULL ? "a" : "w")) == NULL){
+			fprintf(stderr, "can't open %s\n", series);
+			return 1;
+		}
+		if(ckpt == NULL)	fputs(file_headers[0], fseries);
+		files[0] = fseries;
+		if(window != 0)	tlbsim_set_window(window, write_window, fseries);
+		else		tlbsim_set_window_records(window_records, write_window, fseries);
+	}else if(window != 0 || window_records != 0){
+		if(window != 0){
+			fprintf(stdout, "%-10s\t%20s\t%20s\t%20s\t%20s\t%20s\n", "Window", "Insns", "NTLB MPKI", "PWC MPKI", "Acc/KI", "Mem Access");
+			tlbsim_set_window(window, print_window, NULL);
+		}else{
+			fprintf(stdout, "%-10s\t%20s\t%20s\t%20s\t%20s\n", "Window", "Records", "NTLB Miss", "PWC Miss", "Mem Access");
+			tlbsim_set_window_records(window_records, print_window_records, NULL);
+		}
+	}
+
+	if(profile != NULL){
+		if((fprof = fopen(profile, ckpt != NULL ? "a" : "w")) == NULL){
+			fprintf(stderr, "can't open %s\n", profile);
+			return 1;
+		}
+		if(ckpt == NULL)	fputs(file_headers[1], fprof);
+		files[1] = fprof;
+		tlbsim_set_profile(print_pc, fprof);
+	}
+
+	if(by_region){
+		fprintf(stdout, "%-10s\t%20s\t%20s\t%20s\t%20s\t%s\n", "Region", "Walks", "NTLB Miss", "PWC Miss", "Mem Access", "Name");
+		tlbsim_set_regions(print_region, NULL);
+	}
+
+	if(hot != 0){
+		if(tlbsim_set_hot_pages(hot, print_hot, NULL) != 0)	return 1;
+		fprintf(stdout, "%-10s\t%20s\t%20s\t%20s\t%20s\n", "Hot", "Kind", "Page", "Misses", "Error");
+	}
+
+	if(tlbsim_set_checkpoint(ckpt, ckpt_records) != 0 || tlbsim_set_warm_start(warm) != 0)	return 1;
+	if(ckpt != NULL && (fseries != NULL || fprof != NULL))	tlbsim_set_checkpoint_files(save_files, restore_files, files);
+
+	if(consolidate){		// one VM per trace
+		if((vms = tlbsim_sim_vms(tlb_size, ntlb_size, pwc_size, tlb_way, cmd, "./TRACES", &total)) == NULL)	return 1;
+
+		fprintf(stdout, "%-10s\t%20s\t%20s\t%20s\t%20s\n", "Cache", "Hit", "Miss", "Hit Ratio", "Mem Access");
+		print_result(&total, policy);
+		print_vms(vms);
+		for(i = 0; vms[i] != NULL; i++)
+			free(vms[i]);
+		free(vms);
+		if(fprof != NULL)	fclose(fprof);
+		if(fseries != NULL)	fclose(fseries);
+		return 0;
+	}
+
 	results = tlbsim_sim(tlb_size, ntlb_size, pwc_size, tlb_way, cmd, "./TRACES");
 
 	fprintf(stdout, "%-10s\t%20s\t%20s\t%20s\t%20s\n", "Cache", "Hit", "Miss", "Hit Ratio", "Mem Access");
 
 	for(i=0;results[i] != NULL;i++){
-		fprintf(stdout, "%-10s\t%20llu\t%20llu\t%20.4lf\n", "NTLB", results[i]->ntlb.hit, results[i]->ntlb.miss,
-			100.0 * ((double)results[i]->ntlb.hit) / ((double)(results[i]->ntlb.hit + results[i]->ntlb.miss)));
-
-		fprintf(stdout, "%-10s\t%20llu\t%20llu\t%20.4lf\t%20llu\n", "PWC", results[i]->pwc.hit, results[i]->pwc.miss,
-			100.0 * ((double)results[i]->pwc.hit) / ((double)(results[i]->pwc.hit + results[i]->pwc.miss)),
-			results[i]->accs);
-
+		print_result(results[i], policy);
 		free(results[i]);
 	}
 
 	free(results);
+	if(fprof != NULL)	fclose(fprof);
+	if(fseries != NULL)	fclose(fseries);
 
 	return 0;
 }
@@ -96,6 +96,7 @@ OPT_PARAM( netdelay, "<delay>", "network latency emulation" )
 OPT_FLAG ( netfast, "disable network shaping" )
 
 OPT_PARAM( trace, "<name>", "enable code profiling (F9 to start)" )
+OPT_PARAM( tlbtrace, "<options>", "configure the TLB tracer (F10 to start)" )
 OPT_FLAG ( show_kernel, "display kernel messages" )
 OPT_FLAG ( shell, "enable root shell on current terminal" )
 OPT_FLAG ( no_jni, "disable JNI checks in the Dalvik runtime" )
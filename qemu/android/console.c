@@ -39,6 +39,7 @@
 #include "tcpdump.h"
 #include "net.h"
 #include "monitor.h"
+#include "tlb_trace.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -2602,6 +2603,115 @@ static const CommandDefRec sensor_commands[] =
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
+/********************************************************************************************/
+/********************************************************************************************/
+/*****                                                                                 ******/
+/*****                        T L B   T R A C E R   C O M M A N D S                    ******/
+/*****                                                                                 ******/
+/********************************************************************************************/
+/********************************************************************************************/
+
+static int
+do_tlbtrace_start( ControlClient  client, char*  args )
+{
+    if (tlbtrace_enabled()) {
+        control_write( client, "KO: tracer is already running\r\n" );
+        return -1;
+    }
+    tlbtrace_set_state(1);
+    return 0;
+}
+
+static int
+do_tlbtrace_stop( ControlClient  client, char*  args )
+{
+    if (!tlbtrace_enabled()) {
+        control_write( client, "KO: tracer is not running\r\n" );
+        return -1;
+    }
+    tlbtrace_set_state(0);
+    return 0;
+}
+
+static int
+do_tlbtrace_dump( ControlClient  client, char*  args )
+{
+    if (tlbtrace_trigger() != 0) {
+        control_write( client, "KO: tracer is not running in flight-recorder mode\r\n" );
+        return -1;
+    }
+    return 0;
+}
+
+static int
+do_tlbtrace_config( ControlClient  client, char*  args )
+{
+    if (args == NULL) {
+        control_write( client, "KO: argument missing, try 'tlbtrace config <options>'\r\n" );
+        return -1;
+    }
+    if (tlbtrace_set_options(args) != 0) {
+        control_write( client, "KO: bad options, or tracer is running\r\n" );
+        return -1;
+    }
+    return 0;
+}
+
+static int
+do_tlbtrace_info( ControlClient  client, char*  args )
+{
+    struct TLBTRACE_STATS  st;
+    double                 elapsed, overhead;
+
+    tlbtrace_get_stats(&st);
+    elapsed  = st.elapsed_ns / 1e9;
+    overhead = st.overhead_ns / 1e9;
+
+    control_write( client, "state:    %s\r\n", st.running ? "running" : "stopped" );
+    control_write( client, "hits:     %llu\r\n", st.hit );
+    control_write( client, "misses:   %llu (%.3f%%)\r\n", st.miss,
+                   st.hit + st.miss ? 100.0 * st.miss / (st.hit + st.miss) : 0.0 );
+    control_write( client, "insns:    %llu\r\n", st.insns );
+    control_write( client, "filtered: %llu\r\n", st.filtered );
+    control_write( client, "records:  %llu\r\n", st.records );
+    control_write( client, "bytes:    %llu\r\n", st.bytes );
+    control_write( client, "elapsed:  %.3f s\r\n", elapsed );
+    control_write( client, "overhead: %.3f s (%.2f%%)\r\n", overhead,
+                   elapsed > 0 ? 100.0 * overhead / elapsed : 0.0 );
+    return 0;
+}
+
+static const CommandDefRec  tlbtrace_commands[] =
+{
+    { "start", "start the TLB tracer",
+    "'tlbtrace start' starts tracing to a new trace file\r\n",
+    NULL, do_tlbtrace_start, NULL },
+
+    { "stop", "stop the TLB tracer",
+    "'tlbtrace stop' stops tracing and closes the trace file\r\n",
+    NULL, do_tlbtrace_stop, NULL },
+
+    { "dump", "dump the TLB tracer flight recorder",
+    "'tlbtrace dump' writes the records kept in flight-recorder mode to a new trace segment\r\n",
+    NULL, do_tlbtrace_dump, NULL },
+
+    { "config", "configure the TLB tracer",
+    "'tlbtrace config <options>' sets comma-separated options while the tracer is stopped:\r\n"
+    "    size=<entries>,ways=<ways>,dir=<directory>,buffer=<bytes>,segment=<bytes>,\r\n"
+    "    tlbs=<entries>.<ways>[+<entries>.<ways>...],mode=miss|pages,tag_pc=0|1,maps=0|1,\r\n"
+    "    ring=<records>,ring_time=<seconds>,insns=<instructions>,priv=user|kernel|all,\r\n"
+    "    asid=<asid>,va=<start>-<end>,pc=<start>-<end>,proc=<name>,filter=none,\r\n"
+    "    stop=<references>,stop_bytes=<bytes>,stop_time=<seconds>,stop_insns=<instructions>\r\n",
+    NULL, do_tlbtrace_config, NULL },
+
+    { "info", "show TLB tracer counters",
+    "'tlbtrace info' shows the live counters of the current (or the last) tracing session\r\n",
+    NULL, do_tlbtrace_info, NULL },
+
+    { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+
 /********************************************************************************************/
 /********************************************************************************************/
 /*****                                                                                 ******/
@@ -2983,6 +3093,10 @@ static const CommandDefRec   main_commands[] =
       "allows you to request the emulator sensors\r\n", NULL,
       NULL, sensor_commands },
 
+    { "tlbtrace", "TLB tracer commands",
+      "allows you to start/stop the TLB tracer and to show its counters\r\n", NULL,
+      NULL, tlbtrace_commands },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
@@ -920,6 +920,23 @@ help_trace(stralloc_t*  out)
     );
 }
 
+static void
+help_tlbtrace(stralloc_t*  out)
+{
+    PRINTF(
+    "  use '-tlbtrace <options>' to configure the TLB tracer. tracing will not be\n"
+    "  enabled unless you press F10, use 'tlbtrace start' in the console, or the\n"
+    "  executed code turns it on programmatically.\n\n"
+
+    "  <options> is a comma-separated list of name=value pairs, for example:\n\n"
+
+    "    -tlbtrace size=128,ways=4,dir=/tmp,segment=1G\n\n"
+
+    "  the options are the ones of 'tlbtrace config', see tlb_trace.h for the full\n"
+    "  list. if one of them is invalid, none of them is applied.\n\n"
+    );
+}
+
 #ifdef CONFIG_MEMCHECK
 static void
 help_memcheck(stralloc_t*  out)
@@ -1022,6 +1022,11 @@ int main(int argc, char **argv)
         args[n++] = "off";
     }
 
+    if (opts->tlbtrace) {
+        args[n++] = "-tlbtrace";
+        args[n++] = opts->tlbtrace;
+    }
+
     /* Pass boot properties to the core. */
     if (opts->prop != NULL) {
         ParamList*  pl = opts->prop;
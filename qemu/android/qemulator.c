@@ -418,7 +418,7 @@ handle_key_command( void*  opaque, SkinKeyCommand  command, int  down )
     case SKIN_KEY_COMMAND_TOGGLE_TLB_TRACING:
         {
 			extern void tlbtrace_toggle(void);
-			tlbtrace_toggle();
+			tlbtrace_toggle();		// stopping dumps the flight recorder, if enabled
         }
         break;
 
@@ -700,6 +700,157 @@ bool DwarfCUImpl<Dwarf_CUHdr, Dwarf_Off>::get_pc_address_file_info(
   return false;
 }
 
+template <typename Dwarf_CUHdr, typename Dwarf_Off>
+bool DwarfCUImpl<Dwarf_CUHdr, Dwarf_Off>::collect_line_rows(
+    Elf_Word cu_index) {
+  /* CU without STMTL header simply has no rows. */
+  if (!init_stmtl()) {
+    return true;
+  }
+  /* Sequences starting at zero address describe code that has been discarded
+   * by the linker, and would overlap real code in the table. */
+  bool seq_begin = true;
+  bool seq_skip = false;
+  DwarfStateMachine state(stmtl_header_.default_is_stmt != 0);
+
+  /* Start the "Line Number Program", appending a row each time the program
+   * emits one (see DWARF spec, 6.2.5). */
+  const Elf_Byte* go = stmtl_header_.start;
+  while (go < stmtl_header_.end) {
+    const Elf_Byte op = *go;
+    go++;
+    bool emit_row = false;
+
+    if (op == 0) {
+      /* This is an extended opcode. */
+      Dwarf_Value op_size;
+      go = reinterpret_cast<const Elf_Byte*>
+             (reinterpret_cast<const Dwarf_Leb128*>(go)->process_unsigned(&op_size));
+      const Elf_Byte* ex_op_ptr = go;
+      switch (*ex_op_ptr) {
+        case DW_LNE_end_sequence:
+          if (!seq_begin && !seq_skip &&
+              !elf_file()->add_line_row(ELF_LINE_ROW_END, state.address_, 0, 0)) {
+            return false;
+          }
+          state.reset(stmtl_header_.default_is_stmt != 0);
+          seq_begin = true;
+          break;
+
+        case DW_LNE_set_address:
+          if (is_CU_address_64()) {
+            state.address_ =
+              elf_file()->pull_val(reinterpret_cast<const Elf_Xword*>(ex_op_ptr + 1));
+          } else {
+            state.address_ =
+              elf_file()->pull_val(reinterpret_cast<const Elf_Word*>(ex_op_ptr + 1));
+          }
+          break;
+
+        default:
+          /* Files defined in the program, and discriminators don't matter
+           * for the table. */
+          break;
+      }
+      go += op_size.u32;
+    } else if (op < stmtl_header_.opcode_base) {
+      /* This is a standard opcode. */
+      Dwarf_Value val;
+      switch (op) {
+        case DW_LNS_copy:
+          emit_row = true;
+          break;
+
+        case DW_LNS_advance_pc:
+          go = reinterpret_cast<const Elf_Byte*>
+              (reinterpret_cast<const Dwarf_Leb128*>(go)->process_unsigned(&val));
+          state.address_ += val.u64 * stmtl_header_.min_instruction_len;
+          break;
+
+        case DW_LNS_advance_line:
+          go = reinterpret_cast<const Elf_Byte*>
+              (reinterpret_cast<const Dwarf_Leb128*>(go)->process_signed(&val));
+          state.line_ += val.s32;
+          break;
+
+        case DW_LNS_set_file:
+          go = reinterpret_cast<const Elf_Byte*>
+              (reinterpret_cast<const Dwarf_Leb128*>(go)->process_unsigned(&val));
+          state.file_ = val.u32;
+          break;
+
+        case DW_LNS_const_add_pc: {
+          Elf_Word adjusted =
+              static_cast<Elf_Word>(255) - stmtl_header_.opcode_base;
+          state.address_ += (adjusted / stmtl_header_.line_range) *
+                            stmtl_header_.min_instruction_len;
+          break;
+        }
+
+        case DW_LNS_fixed_advance_pc:
+          state.address_ +=
+              elf_file()->pull_val(reinterpret_cast<const Elf_Half*>(go));
+          go += sizeof(Elf_Half);
+          break;
+
+        case DW_LNS_negate_stmt:
+        case DW_LNS_set_basic_block:
+        case DW_LNS_set_prologue_end:
+        case DW_LNS_set_epilogue_begin:
+          /* No parameters, and nothing to do for the table. */
+          break;
+
+        default:
+          /* DW_LNS_set_column, DW_LNS_set_isa, and unknown opcodes. Just
+           * skip their parameters. */
+          for (Elf_Byte uleb = 0;
+               uleb < stmtl_header_.standard_opcode_lengths[op - 1]; uleb++) {
+            go = reinterpret_cast<const Elf_Byte*>
+              (reinterpret_cast<const Dwarf_Leb128*>(go)->process_unsigned(&val));
+          }
+          break;
+      }
+    } else {
+      /* This is a special opcode. */
+      const Elf_Word adjusted = op - stmtl_header_.opcode_base;
+      state.address_ += (adjusted / stmtl_header_.line_range) *
+                        stmtl_header_.min_instruction_len;
+      state.line_ += stmtl_header_.line_base +
+                     (adjusted % stmtl_header_.line_range);
+      emit_row = true;
+    }
+
+    if (emit_row) {
+      if (seq_begin) {
+        seq_begin = false;
+        seq_skip = state.address_ == 0;
+      }
+      if (!seq_skip &&
+          !elf_file()->add_line_row(cu_index, state.address_, state.file_,
+                                    state.line_)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+template <typename Dwarf_CUHdr, typename Dwarf_Off>
+bool DwarfCUImpl<Dwarf_CUHdr, Dwarf_Off>::get_line_row_info(
+    Elf_Word file,
+    Elf_Word line,
+    Dwarf_AddressInfo* info) {
+  /* Rows loaded from the index cache come without the STMTL header. */
+  if (!init_stmtl()) {
+    return false;
+  }
+  DwarfStateMachine state(stmtl_header_.default_is_stmt != 0);
+  state.file_ = file;
+  state.line_ = line;
+  return set_source_info(&state, info);
+}
+
 template <typename Dwarf_CUHdr, typename Dwarf_Off>
 const Dwarf_STMTL_FileDesc* DwarfCUImpl<Dwarf_CUHdr, Dwarf_Off>::get_stmt_file_info(
     Elf_Word index) {
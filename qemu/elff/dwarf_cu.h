@@ -267,6 +267,29 @@ friend class ElfFile;
   virtual bool get_pc_address_file_info(Elf_Xword address,
                                         Dwarf_AddressInfo* info) = 0;
 
+  /* Runs the "Line Number Program" of this compilation unit, adding the rows
+   * it produces to the line number table of the ELF file's address index
+   * (see ElfFile::add_line_row()).
+   * Param:
+   *  cu_index - Index of this CU in the address index.
+   * Return:
+   *  true on success, or false on failure.
+   */
+  virtual bool collect_line_rows(Elf_Word cu_index) = 0;
+
+  /* Gets source file information for a row of the line number table,
+   * collected with collect_line_rows().
+   * Param:
+   *  file - 1-based index of the row's file descriptor.
+   *  line - Row's line number.
+   *  info - Upon success contains source file information for the row.
+   * Return:
+   *  true on success, or false on failure.
+   */
+  virtual bool get_line_row_info(Elf_Word file,
+                                 Elf_Word line,
+                                 Dwarf_AddressInfo* info) = 0;
+
   /* Gets file descriptor in the mapped .debug_line section of ELF file for a
    * given index in the file descriptor list.
    * Param:
@@ -352,6 +375,19 @@ class DwarfCUImpl : public DwarfCU {
    */
   bool get_pc_address_file_info(Elf_Xword address, Dwarf_AddressInfo* info);
 
+  /* Collects rows of the line number table.
+   * This is an implementation of DwarfCU's abstract metod.
+   * See DwarfCU::collect_line_rows().
+   */
+  bool collect_line_rows(Elf_Word cu_index);
+
+  /* Gets source file information for a row of the line number table.
+   * This is an implementation of DwarfCU's abstract metod.
+   * See DwarfCU::get_line_row_info().
+   */
+  bool get_line_row_info(Elf_Word file, Elf_Word line,
+                         Dwarf_AddressInfo* info);
+
   /* Gets file descriptor in the mapped .debug_line section of ELF file for a
    * given index in the file descriptor list.
    * This is an implementation of DwarfCU's abstract metod.
@@ -15,6 +15,7 @@
  */
 
 #include "string.h"
+#include "stdio.h"
 #include "elf_file.h"
 #include "elf_alloc.h"
 #include "dwarf_cu.h"
@@ -35,6 +36,122 @@ static const Dwarf_Tag parse_rt_tags[] = {
 };
 static const DwarfParseContext parse_rt_context = { parse_rt_tags };
 
+/* Header of the address index cache file. The header is followed by the
+ * line number table of the index. */
+typedef struct ElfIndexCacheHdr {
+  /* Magic, and format version. */
+  char      magic[8];
+
+  /* Size, and modification time of the ELF file the cache was built for. */
+  Elf_Xword elf_size;
+  Elf_Xword elf_mtime;
+
+  /* Number of compilation units, and rows in the line number table. */
+  Elf_Word  cu_count;
+  Elf_Word  row_count;
+} ElfIndexCacheHdr;
+
+static const char index_cache_magic[8] = "ELFFIX1";
+
+/* Appends an entry to an array that grows twice when it's full.
+ * Return:
+ *  true on success, or false on memory error.
+ */
+template <typename T>
+static bool append_entry(T** entries, Elf_Word* count, Elf_Word* size,
+                         const T* entry) {
+  if (*count == *size) {
+    const Elf_Word new_size = *size != 0 ? *size * 2 : 256;
+    T* grown = new T[new_size];
+    assert(grown != NULL);
+    if (grown == NULL) {
+      _set_errno(ENOMEM);
+      return false;
+    }
+    if (*count != 0) {
+      memcpy(grown, *entries, sizeof(T) * *count);
+    }
+    delete[] *entries;
+    *entries = grown;
+    *size = new_size;
+  }
+  (*entries)[(*count)++] = *entry;
+  return true;
+}
+
+/* Gets index of the last entry of a sorted index table whose address is not
+ * above the given one, or -1 if all of them are above. */
+template <typename T>
+static int find_entry(const T* entries, Elf_Word count, Elf_Xword address) {
+  int low = 0;
+  int high = count;
+  while (low < high) {
+    const int mid = (low + high) / 2;
+    if (entries[mid].address <= address) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low - 1;
+}
+
+/* Same as find_entry(), but starts from the entry found for a lower address,
+ * so that a batch of sorted addresses is resolved in one pass. */
+template <typename T>
+static int advance_entry(const T* entries, Elf_Word count, int index,
+                         Elf_Xword address) {
+  while (index + 1 < static_cast<int>(count) &&
+         entries[index + 1].address <= address) {
+    index++;
+  }
+  return index;
+}
+
+/* Appends a span to the address index, merging it with the previous one, if
+ * they are adjacent, and belong to the same DIE. */
+static bool append_span(Elf_AddrSpan** spans, Elf_Word* count, Elf_Word* size,
+                        Elf_Xword address, Elf_Xword end, DIEObject* die) {
+  if (*count != 0 && (*spans)[*count - 1].end == address &&
+      (*spans)[*count - 1].die == die) {
+    (*spans)[*count - 1].end = end;
+    return true;
+  }
+  const Elf_AddrSpan span = { address, end, die };
+  return append_entry(spans, count, size, &span);
+}
+
+/* Orders DIE ranges by address, and enclosing ranges before enclosed ones. */
+static int compare_ranges(const void* p1, const void* p2) {
+  const Elf_AddrSpan* r1 = reinterpret_cast<const Elf_AddrSpan*>(p1);
+  const Elf_AddrSpan* r2 = reinterpret_cast<const Elf_AddrSpan*>(p2);
+  if (r1->address != r2->address) {
+    return r1->address < r2->address ? -1 : 1;
+  }
+  const Elf_Word level1 = r1->die->get_level();
+  const Elf_Word level2 = r2->die->get_level();
+  if (level1 != level2) {
+    return level1 < level2 ? -1 : 1;
+  }
+  if (r1->end != r2->end) {
+    return r1->end > r2->end ? -1 : 1;
+  }
+  return 0;
+}
+
+/* Orders line rows by address. A row ending a sequence goes before the row
+ * of another sequence starting at the same address. */
+static int compare_line_rows(const void* p1, const void* p2) {
+  const Elf_LineRow* r1 = reinterpret_cast<const Elf_LineRow*>(p1);
+  const Elf_LineRow* r2 = reinterpret_cast<const Elf_LineRow*>(p2);
+  if (r1->address != r2->address) {
+    return r1->address < r2->address ? -1 : 1;
+  }
+  const bool end1 = r1->cu == ELF_LINE_ROW_END;
+  const bool end2 = r2->cu == ELF_LINE_ROW_END;
+  return end1 == end2 ? 0 : (end1 ? -1 : 1);
+}
+
 //=============================================================================
 // Base ElfFile implementation
 //=============================================================================
@@ -49,7 +166,16 @@ ElfFile::ElfFile()
       sec_entry_size_(0),
       last_cu_(NULL),
       cu_count_(0),
-      is_exec_(0) {
+      is_exec_(0),
+      index_built_(false),
+      index_cache_(false),
+      index_cus_(NULL),
+      addr_spans_(NULL),
+      addr_span_count_(0),
+      addr_span_size_(0),
+      line_rows_(NULL),
+      line_row_count_(0),
+      line_row_size_(0) {
 }
 
 ElfFile::~ElfFile() {
@@ -60,6 +186,10 @@ ElfFile::~ElfFile() {
     cu_to_del = next_cu_to_del;
   }
 
+  delete[] index_cus_;
+  delete[] addr_spans_;
+  delete[] line_rows_;
+
   if (mapfile_is_valid(elf_handle_)) {
     mapfile_close(elf_handle_);
   }
@@ -181,140 +311,426 @@ bool ElfFile::get_pc_address_info(Elf_Xword address,
     return false;
   }
 
+  if (!build_address_index()) {
+    return false;
+  }
+
+  return set_pc_address_info(address,
+                             find_entry(addr_spans_, addr_span_count_, address),
+                             find_entry(line_rows_, line_row_count_, address),
+                             address_info);
+}
+
+int ElfFile::get_pc_address_info_batch(const Elf_Xword* addresses,
+                                       int count,
+                                       Elf_AddressInfo* address_infos) {
+  assert(addresses != NULL && address_infos != NULL);
+  if (addresses == NULL || address_infos == NULL) {
+    _set_errno(EINVAL);
+    return -1;
+  }
+
+  if (!build_address_index()) {
+    return -1;
+  }
+
+  /* Merge the addresses with the spans, and the rows of the index. */
+  int resolved = 0;
+  int span = -1;
+  int row = -1;
+  for (int n = 0; n < count; n++) {
+    const Elf_Xword address = addresses[n];
+    if (n != 0 && address < addresses[n - 1]) {
+      /* Out of order. Start over from the beginning of the tables. */
+      span = row = -1;
+    }
+    span = advance_entry(addr_spans_, addr_span_count_, span, address);
+    row = advance_entry(line_rows_, line_row_count_, row, address);
+    if (set_pc_address_info(address, span, row, &address_infos[n])) {
+      resolved++;
+    } else {
+      address_infos[n].routine_name = NULL;
+      address_infos[n].inline_stack = NULL;
+    }
+  }
+
+  return resolved;
+}
+
+bool ElfFile::add_line_row(Elf_Word cu, Elf_Xword address, Elf_Word file,
+                           Elf_Word line) {
+  /* Of the rows with the same address, the last one describes it. */
+  if (line_row_count_ != 0 && cu != ELF_LINE_ROW_END) {
+    Elf_LineRow* last = &line_rows_[line_row_count_ - 1];
+    if (last->cu == cu && last->address == address) {
+      last->file = file;
+      last->line = line;
+      return true;
+    }
+  }
+  const Elf_LineRow row = { address, cu, file, line };
+  return append_entry(&line_rows_, &line_row_count_, &line_row_size_, &row);
+}
+
+bool ElfFile::build_address_index() {
+  if (index_built_) {
+    return true;
+  }
+
   /* Collect routine information for all CUs in this file. */
   if (parse_compilation_units(&parse_rt_context) == -1) {
     return false;
   }
 
-  /* Iterate through the collected CUs looking for the one that
-   * contains the given address. */
-  address_info->inline_stack = NULL;
-  DwarfCU* cu = last_cu();
-  while (cu != NULL) {
-    /* Find a leaf DIE object in the current CU that contains the address. */
-    Dwarf_AddressInfo info;
-    info.die_obj = cu->get_leaf_die_for_address(address);
-    if (info.die_obj != NULL) {
-      /* Convert the address to a location inside source file. */
-      if (cu->get_pc_address_file_info(address, &info)) {
-          /* Copy location information to the returning structure. */
-          address_info->file_name = info.file_name;
-          address_info->dir_name = info.dir_name;
-          address_info->line_number = info.line_number;
-      } else {
-          address_info->file_name = NULL;
-          address_info->dir_name = NULL;
-          address_info->line_number = 0;
+  /* Drop leftovers of a failed attempt. */
+  delete[] index_cus_;
+  delete[] addr_spans_;
+  delete[] line_rows_;
+  addr_spans_ = NULL;
+  line_rows_ = NULL;
+  addr_span_count_ = addr_span_size_ = 0;
+  line_row_count_ = line_row_size_ = 0;
+
+  /* CUs are listed in reverse order. */
+  index_cus_ = new DwarfCU*[cu_count_ + 1];
+  assert(index_cus_ != NULL);
+  if (index_cus_ == NULL) {
+    _set_errno(ENOMEM);
+    return false;
+  }
+  int cu_index = cu_count_;
+  for (DwarfCU* cu = last_cu(); cu != NULL; cu = cu->prev_cu()) {
+    index_cus_[--cu_index] = cu;
+  }
+
+  /* Collect address ranges of the routines, and flatten them. */
+  for (cu_index = 0; cu_index < cu_count_; cu_index++) {
+    if (!index_die(index_cus_[cu_index]->cu_die())) {
+      return false;
+    }
+  }
+  if (!flatten_addr_spans()) {
+    return false;
+  }
+
+  /* Collect the line number table, unless it's cached. */
+  char* cache_path = NULL;
+  struct stat elf_stat;
+  if (index_cache_ && stat(elf_file_path_, &elf_stat) == 0) {
+    cache_path = new char[strlen(elf_file_path_) + sizeof(".elffidx")];
+    if (cache_path != NULL) {
+      strcpy(cache_path, elf_file_path_);
+      strcat(cache_path, ".elffidx");
+    }
+  }
+  if (cache_path == NULL || !load_index_cache(cache_path, &elf_stat)) {
+    for (cu_index = 0; cu_index < cu_count_; cu_index++) {
+      if (!index_cus_[cu_index]->collect_line_rows(cu_index)) {
+        delete[] cache_path;
+        return false;
       }
+    }
+    qsort(line_rows_, line_row_count_, sizeof(Elf_LineRow), compare_line_rows);
+    if (cache_path != NULL) {
+      save_index_cache(cache_path, &elf_stat);
+    }
+  }
+  delete[] cache_path;
 
-      /* Lets see if the DIE represents a routine (rather than
-       * a lexical block, for instance). */
-      Dwarf_Tag tag = info.die_obj->get_tag();
-      while (!dwarf_tag_is_routine(tag)) {
-        /* This is not a routine DIE. Lets loop trhough the parents of that
-         * DIE looking for the first routine DIE. */
-        info.die_obj = info.die_obj->parent_die();
-        if (info.die_obj == NULL) {
-          /* Reached compilation unit DIE. Can't go any further. */
-          address_info->routine_name = "<unknown>";
-          return true;
+  index_built_ = true;
+  return true;
+}
+
+bool ElfFile::index_die(DIEObject* die) {
+  const bool added = die->parent_cu()->is_CU_address_64() ?
+                         index_die_ranges<Elf_Xword>(die) :
+                         index_die_ranges<Elf_Word>(die);
+  if (!added) {
+    return false;
+  }
+
+  /* Children are indexed even if the DIE has no ranges: CU DIE ranges may
+   * be empty, even though its children occupy some address space. */
+  for (DIEObject* child = die->last_child(); child != NULL;
+       child = child->prev_sibling()) {
+    if (!index_die(child)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template<typename AddrType>
+bool ElfFile::index_die_ranges(DIEObject* die) {
+  /* See DIEObject::contains_address() for the ways DIE ranges are defined. */
+  DIEAttrib die_ranges;
+  if (die->get_attrib(DW_AT_ranges, &die_ranges)) {
+    AddrType low;
+    AddrType high;
+    Elf_Word range_off = die_ranges.value()->u32;
+    while (get_range(range_off, &low, &high) && (low != 0 || high != 0)) {
+      if (low < high) {
+        const Elf_AddrSpan range = { low, high, die };
+        if (!append_entry(&addr_spans_, &addr_span_count_, &addr_span_size_,
+                          &range)) {
+          return false;
         }
-        tag = info.die_obj->get_tag();
       }
+      range_off += sizeof(AddrType) * 2;
+    }
+    return true;
+  }
 
-      /* Save name of the routine that contains the address. */
-      address_info->routine_name = info.die_obj->get_name();
-      if (address_info->routine_name == NULL) {
-        /* In some cases (minimum debugging info in the file) routine
-         * name may be not avaible. We, however, are obliged by API
-         * considerations to return something in this field. */
-          address_info->routine_name = "<unknown>";
-      }
+  DIEAttrib low_pc;
+  DIEAttrib high_pc;
+  if (die->get_attrib(DW_AT_low_pc, &low_pc) &&
+      die->get_attrib(DW_AT_high_pc, &high_pc) &&
+      low_pc.value()->u64 < high_pc.value()->u64) {
+    const Elf_AddrSpan range =
+        { low_pc.value()->u64, high_pc.value()->u64, die };
+    return append_entry(&addr_spans_, &addr_span_count_, &addr_span_size_,
+                        &range);
+  }
+  return true;
+}
 
-      /* Lets see if address belongs to an inlined routine. */
-      if (tag != DW_TAG_inlined_subroutine) {
-        address_info->inline_stack = NULL;
-        return true;
-      }
+bool ElfFile::flatten_addr_spans() {
+  qsort(addr_spans_, addr_span_count_, sizeof(Elf_AddrSpan), compare_ranges);
 
-      /*
-       * Address belongs to an inlined routine. Create inline stack.
-       */
+  Elf_AddrSpan* ranges = addr_spans_;
+  const Elf_Word count = addr_span_count_;
+  addr_spans_ = NULL;
+  addr_span_count_ = addr_span_size_ = 0;
 
-      /* Allocate inline stack array big enough to fit all parent entries. */
-      address_info->inline_stack =
-        new Elf_InlineInfo[info.die_obj->get_level() + 1];
-      assert(address_info->inline_stack != NULL);
-      if (address_info->inline_stack == NULL) {
-        _set_errno(ENOMEM);
-        return false;
+  /* Stack of the ranges enclosing the current address. */
+  Elf_Word* open = new Elf_Word[count + 1];
+  assert(open != NULL);
+  if (open == NULL) {
+    delete[] ranges;
+    _set_errno(ENOMEM);
+    return false;
+  }
+  Elf_Word depth = 0;
+
+  /* Sweep through the ranges, assigning addresses up to the start of the
+   * next range to the innermost range that is still open. */
+  bool ok = true;
+  Elf_Xword pos = 0;
+  for (Elf_Word n = 0; ok && n <= count; n++) {
+    while (ok && depth != 0 &&
+           (n == count || ranges[open[depth - 1]].end <= ranges[n].address)) {
+      const Elf_AddrSpan* closed = &ranges[open[--depth]];
+      if (pos < closed->end) {
+        ok = append_span(&addr_spans_, &addr_span_count_, &addr_span_size_,
+                         pos, closed->end, closed->die);
+        pos = closed->end;
       }
-      memset(address_info->inline_stack, 0,
-             sizeof(Elf_InlineInfo) * (info.die_obj->get_level() + 1));
-
-      /* Reverse DIEs filling in inline stack entries for inline
-       * routine tags. */
-      int inl_index = 0;
-      do {
-        /* Save source file information. */
-        DIEAttrib file_desc;
-        if (info.die_obj->get_attrib(DW_AT_call_file, &file_desc)) {
-          const Dwarf_STMTL_FileDesc* desc =
-              cu->get_stmt_file_info(file_desc.value()->u32);
-          if (desc != NULL) {
-            address_info->inline_stack[inl_index].inlined_in_file =
-                desc->file_name;
-            address_info->inline_stack[inl_index].inlined_in_file_dir =
-                cu->get_stmt_dir_name(desc->get_dir_index());
-          }
-        }
-        if (address_info->inline_stack[inl_index].inlined_in_file == NULL) {
-          address_info->inline_stack[inl_index].inlined_in_file = "<unknown>";
-          address_info->inline_stack[inl_index].inlined_in_file_dir = NULL;
-        }
+    }
+    if (!ok || n == count) {
+      break;
+    }
+    if (depth != 0 && pos < ranges[n].address) {
+      const Elf_AddrSpan* enclosing = &ranges[open[depth - 1]];
+      ok = append_span(&addr_spans_, &addr_span_count_, &addr_span_size_,
+                       pos, ranges[n].address, enclosing->die);
+    }
+    if (pos < ranges[n].address) {
+      pos = ranges[n].address;
+    }
+    open[depth++] = n;
+  }
 
-        /* Save source line information. */
-        if (info.die_obj->get_attrib(DW_AT_call_line, &file_desc)) {
-          address_info->inline_stack[inl_index].inlined_at_line = file_desc.value()->u32;
-        }
+  delete[] open;
+  delete[] ranges;
+  return ok;
+}
 
-        /* Advance DIE to the parent routine, and save its name. */
-        info.die_obj = info.die_obj->parent_die();
-        assert(info.die_obj != NULL);
-        if (info.die_obj != NULL) {
-          tag = info.die_obj->get_tag();
-          while (!dwarf_tag_is_routine(tag)) {
-            info.die_obj = info.die_obj->parent_die();
-            if (info.die_obj == NULL) {
-              break;
-            }
-            tag = info.die_obj->get_tag();
-          }
-          if (info.die_obj != NULL) {
-            address_info->inline_stack[inl_index].routine_name =
-                info.die_obj->get_name();
-          }
-        }
-        if (address_info->inline_stack[inl_index].routine_name == NULL) {
-          address_info->inline_stack[inl_index].routine_name = "<unknown>";
-        }
+bool ElfFile::load_index_cache(const char* path, const struct stat* elf_stat) {
+  FILE* fin = fopen(path, "rb");
+  if (fin == NULL) {
+    return false;
+  }
+
+  ElfIndexCacheHdr hdr;
+  bool ok = fread(&hdr, sizeof(hdr), 1, fin) == 1 &&
+            memcmp(hdr.magic, index_cache_magic, sizeof(hdr.magic)) == 0 &&
+            hdr.elf_size == static_cast<Elf_Xword>(elf_stat->st_size) &&
+            hdr.elf_mtime == static_cast<Elf_Xword>(elf_stat->st_mtime) &&
+            hdr.cu_count == static_cast<Elf_Word>(cu_count_);
+  if (ok && hdr.row_count != 0) {
+    line_rows_ = new Elf_LineRow[hdr.row_count];
+    ok = line_rows_ != NULL &&
+         fread(line_rows_, sizeof(Elf_LineRow), hdr.row_count, fin) ==
+             hdr.row_count;
+    for (Elf_Word n = 0; ok && n < hdr.row_count; n++) {
+      ok = line_rows_[n].cu < hdr.cu_count ||
+           line_rows_[n].cu == ELF_LINE_ROW_END;
+    }
+    line_row_count_ = line_row_size_ = hdr.row_count;
+  }
+  fclose(fin);
 
-        /* Continue with the parent DIE. */
-        inl_index++;
-      } while (info.die_obj != NULL && tag == DW_TAG_inlined_subroutine);
+  if (!ok) {
+    delete[] line_rows_;
+    line_rows_ = NULL;
+    line_row_count_ = line_row_size_ = 0;
+  }
+  return ok;
+}
 
+void ElfFile::save_index_cache(const char* path,
+                               const struct stat* elf_stat) const {
+  /* Cache is optional: failing to save it (f.i. in a read-only directory)
+   * is not an error. */
+  FILE* fout = fopen(path, "wb");
+  if (fout == NULL) {
+    return;
+  }
+
+  ElfIndexCacheHdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, index_cache_magic, sizeof(hdr.magic));
+  hdr.elf_size = elf_stat->st_size;
+  hdr.elf_mtime = elf_stat->st_mtime;
+  hdr.cu_count = cu_count_;
+  hdr.row_count = line_row_count_;
+  const bool ok = fwrite(&hdr, sizeof(hdr), 1, fout) == 1 &&
+                  fwrite(line_rows_, sizeof(Elf_LineRow), line_row_count_,
+                         fout) == line_row_count_;
+  if (fclose(fout) != 0 || !ok) {
+    remove(path);
+  }
+}
+
+bool ElfFile::set_pc_address_info(Elf_Xword address, int span, int row,
+                                  Elf_AddressInfo* address_info) {
+  address_info->inline_stack = NULL;
+  if (span < 0 || address >= addr_spans_[span].end) {
+    return false;
+  }
+
+  Dwarf_AddressInfo info;
+  info.die_obj = addr_spans_[span].die;
+  DwarfCU* cu = info.die_obj->parent_cu();
+
+  /* Convert the address to a location inside source file. */
+  const Elf_LineRow* line_row = row >= 0 ? &line_rows_[row] : NULL;
+  if (line_row != NULL && line_row->cu != ELF_LINE_ROW_END &&
+      index_cus_[line_row->cu]->get_line_row_info(line_row->file,
+                                                  line_row->line, &info)) {
+      /* Copy location information to the returning structure. */
+      address_info->file_name = info.file_name;
+      address_info->dir_name = info.dir_name;
+      address_info->line_number = info.line_number;
+  } else {
+      address_info->file_name = NULL;
+      address_info->dir_name = NULL;
+      address_info->line_number = 0;
+  }
+
+  /* Lets see if the DIE represents a routine (rather than
+   * a lexical block, for instance). */
+  Dwarf_Tag tag = info.die_obj->get_tag();
+  while (!dwarf_tag_is_routine(tag)) {
+    /* This is not a routine DIE. Lets loop trhough the parents of that
+     * DIE looking for the first routine DIE. */
+    info.die_obj = info.die_obj->parent_die();
+    if (info.die_obj == NULL) {
+      /* Reached compilation unit DIE. Can't go any further. */
+      address_info->routine_name = "<unknown>";
       return true;
     }
-    cu = cu->prev_cu();
+    tag = info.die_obj->get_tag();
   }
 
-  return false;
+  /* Save name of the routine that contains the address. */
+  address_info->routine_name = info.die_obj->get_name();
+  if (address_info->routine_name == NULL) {
+    /* In some cases (minimum debugging info in the file) routine
+     * name may be not avaible. We, however, are obliged by API
+     * considerations to return something in this field. */
+      address_info->routine_name = "<unknown>";
+  }
+
+  /* Lets see if address belongs to an inlined routine. */
+  if (tag != DW_TAG_inlined_subroutine) {
+    address_info->inline_stack = NULL;
+    return true;
+  }
+
+  /*
+   * Address belongs to an inlined routine. Create inline stack.
+   */
+
+  /* Allocate inline stack array big enough to fit all parent entries. */
+  address_info->inline_stack =
+    new Elf_InlineInfo[info.die_obj->get_level() + 1];
+  assert(address_info->inline_stack != NULL);
+  if (address_info->inline_stack == NULL) {
+    _set_errno(ENOMEM);
+    return false;
+  }
+  memset(address_info->inline_stack, 0,
+         sizeof(Elf_InlineInfo) * (info.die_obj->get_level() + 1));
+
+  /* Reverse DIEs filling in inline stack entries for inline
+   * routine tags. */
+  int inl_index = 0;
+  do {
+    /* Save source file information. */
+    DIEAttrib file_desc;
+    if (info.die_obj->get_attrib(DW_AT_call_file, &file_desc)) {
+      const Dwarf_STMTL_FileDesc* desc =
+          cu->get_stmt_file_info(file_desc.value()->u32);
+      if (desc != NULL) {
+        address_info->inline_stack[inl_index].inlined_in_file =
+            desc->file_name;
+        address_info->inline_stack[inl_index].inlined_in_file_dir =
+            cu->get_stmt_dir_name(desc->get_dir_index());
+      }
+    }
+    if (address_info->inline_stack[inl_index].inlined_in_file == NULL) {
+      address_info->inline_stack[inl_index].inlined_in_file = "<unknown>";
+      address_info->inline_stack[inl_index].inlined_in_file_dir = NULL;
+    }
+
+    /* Save source line information. */
+    if (info.die_obj->get_attrib(DW_AT_call_line, &file_desc)) {
+      address_info->inline_stack[inl_index].inlined_at_line = file_desc.value()->u32;
+    }
+
+    /* Advance DIE to the parent routine, and save its name. */
+    info.die_obj = info.die_obj->parent_die();
+    assert(info.die_obj != NULL);
+    if (info.die_obj != NULL) {
+      tag = info.die_obj->get_tag();
+      while (!dwarf_tag_is_routine(tag)) {
+        info.die_obj = info.die_obj->parent_die();
+        if (info.die_obj == NULL) {
+          break;
+        }
+        tag = info.die_obj->get_tag();
+      }
+      if (info.die_obj != NULL) {
+        address_info->inline_stack[inl_index].routine_name =
+            info.die_obj->get_name();
+      }
+    }
+    if (address_info->inline_stack[inl_index].routine_name == NULL) {
+      address_info->inline_stack[inl_index].routine_name = "<unknown>";
+    }
+
+    /* Continue with the parent DIE. */
+    inl_index++;
+  } while (info.die_obj != NULL && tag == DW_TAG_inlined_subroutine);
+
+  return true;
 }
 
 void ElfFile::free_pc_address_info(Elf_AddressInfo* address_info) const {
   assert(address_info != NULL);
   if (address_info != NULL && address_info->inline_stack != NULL) {
-    delete address_info->inline_stack;
+    delete[] address_info->inline_stack;
     address_info->inline_stack = NULL;
   }
 }
@@ -22,6 +22,41 @@
 #include "elff_api.h"
 #include "android/utils/mapfile.h"
 
+/* Entry of the address index: a span of addresses, all of which have the same
+ * innermost routine (or compilation unit) DIE. Spans in the index are sorted
+ * by address, and don't overlap. */
+typedef struct Elf_AddrSpan {
+  /* First address of the span. */
+  Elf_Xword         address;
+
+  /* Address next to the last address of the span. */
+  Elf_Xword         end;
+
+  /* Innermost DIE containing the span. */
+  DIEObject*        die;
+} Elf_AddrSpan;
+
+/* Value of Elf_LineRow::cu for a row that ends a sequence of rows. */
+#define ELF_LINE_ROW_END  0xFFFFFFFF
+
+/* Row of the line number table collected from the "Line Number Programs" of
+ * all the compilation units. A row describes all addresses from its address
+ * up to the address of the next row in the table. */
+typedef struct Elf_LineRow {
+  /* First address described by the row. */
+  Elf_Xword         address;
+
+  /* Index of the compilation unit in the index's CU table, or
+   * ELF_LINE_ROW_END if the row ends a sequence. */
+  Elf_Word          cu;
+
+  /* 1-based index of the source file in the CU's file table. */
+  Elf_Word          file;
+
+  /* Source line number. */
+  Elf_Word          line;
+} Elf_LineRow;
+
 /* Encapsulates architecture-independent functionality of an ELF file.
  *
  * This class is a base class for templated ElfFileImpl. This class implements
@@ -372,6 +407,95 @@ class ElfFile {
    */
   void free_pc_address_info(Elf_AddressInfo* address_info) const;
 
+  /* Gets PC address information for a batch of addresses.
+   * Addresses are resolved in one pass over the address index, so they should
+   * be sorted in ascending order. Unsorted batches are still resolved, just
+   * not as fast.
+   * Param:
+   *  addresses - PC addresses to get information for. The addresses must be
+   *    relative to the beginning of ELF file represented by this class.
+   *  count - Number of addresses in the batch.
+   *  address_infos - Upon return contains information for each address. An
+   *    entry for an address that has not been resolved has its routine_name
+   *    field set to NULL.
+   * Return:
+   *  Number of resolved addresses, or -1 if the address index could not be
+   *  built, in which case errno contains extended error information.
+   *  NOTE: each resolved entry must be freed with free_pc_address_info().
+   */
+  int get_pc_address_info_batch(const Elf_Xword* addresses,
+                                int count,
+                                Elf_AddressInfo* address_infos);
+
+  /* Enables, or disables saving the address index to (and loading it from) a
+   * cache file next to the ELF file. Cache is named after the ELF file, with
+   * .elffidx suffix, and is ignored once the ELF file is changed.
+   */
+  void set_index_cache(bool enable) {
+    index_cache_ = enable;
+  }
+
+  /* Adds a row to the line number table of the address index. This method is
+   * called by the compilation units while they run their line number programs.
+   * Param:
+   *  cu - Index of the compilation unit passed to collect_line_rows(), or
+   *    ELF_LINE_ROW_END for the row that ends a sequence.
+   *  address, file, line - Row's address, file index, and line number.
+   * Return:
+   *  true on success, or false on memory error.
+   */
+  bool add_line_row(Elf_Word cu, Elf_Xword address, Elf_Word file,
+                    Elf_Word line);
+
+ protected:
+  /* Builds the address index on the first use. The index consists of the
+   * sorted table of the address spans of routine DIEs, and the sorted line
+   * number table of all compilation units, so that lookups are just binary
+   * searches (or one merge pass for a batch of sorted addresses) instead of
+   * walks through the DIE trees and line number programs.
+   * Return:
+   *  true on success, or false on failure, with errno containing extended
+   *  error information.
+   */
+  bool build_address_index();
+
+  /* Adds address ranges of a DIE and its children to addr_spans_. */
+  bool index_die(DIEObject* die);
+
+  /* Adds address ranges of a DIE to addr_spans_.
+   * Template param:
+   *  AddrType - Type of the compilation unit address (see get_range()).
+   */
+  template<typename AddrType>
+  bool index_die_ranges(DIEObject* die);
+
+  /* Converts sorted, and nested ranges in addr_spans_ into the spans of their
+   * innermost DIEs. */
+  bool flatten_addr_spans();
+
+  /* Loads the line number table from the index cache file.
+   * Return:
+   *  true if table has been loaded, or false if cache file is missing, or
+   *  stale.
+   */
+  bool load_index_cache(const char* path, const struct stat* elf_stat);
+
+  /* Saves the line number table to the index cache file. */
+  void save_index_cache(const char* path, const struct stat* elf_stat) const;
+
+  /* Fills in PC address information from the entries of the address index.
+   * Param:
+   *  span - Index of the address span that may contain the address, or -1.
+   *  row - Index of the line row that may describe the address, or -1.
+   *  address_info - See get_pc_address_info().
+   * Return:
+   *  See get_pc_address_info().
+   */
+  bool set_pc_address_info(Elf_Xword address, int span, int row,
+                           Elf_AddressInfo* address_info);
+
+ public:
+
   /* Gets beginning of the .debug_info section data.
    * Return:
    *  Beginning of the .debug_info section data.
@@ -558,6 +682,25 @@ class ElfFile {
    * instance is an executable. If this member is 0, file is a shared library.
    */
   bool                is_exec_;
+
+  /* Flags whether the address index has been built. */
+  bool                index_built_;
+
+  /* Flags whether the address index is cached on disk. */
+  bool                index_cache_;
+
+  /* Compilation units indexed by Elf_LineRow::cu, in .debug_info order. */
+  class DwarfCU**     index_cus_;
+
+  /* Sorted address spans of the address index. */
+  Elf_AddrSpan*       addr_spans_;
+  Elf_Word            addr_span_count_;
+  Elf_Word            addr_span_size_;
+
+  /* Sorted line number table of the address index. */
+  Elf_LineRow*        line_rows_;
+  Elf_Word            line_row_count_;
+  Elf_Word            line_row_size_;
 };
 
 /* Encapsulates architecture-dependent functionality of an ELF file.
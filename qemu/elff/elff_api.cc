@@ -78,6 +78,32 @@ elff_free_pc_address_info(ELFF_HANDLE handle, Elf_AddressInfo* address_info)
   reinterpret_cast<ElfFile*>(handle)->free_pc_address_info(address_info);
 }
 
+int
+elff_get_pc_address_info_batch(ELFF_HANDLE handle,
+                               const uint64_t* addresses,
+                               int count,
+                               Elf_AddressInfo* address_infos)
+{
+  assert(handle != NULL && addresses != NULL && address_infos != NULL);
+  if (handle == NULL || addresses == NULL || address_infos == NULL) {
+    _set_errno(EINVAL);
+    return -1;
+  }
+
+  return reinterpret_cast<ElfFile*>(handle)->get_pc_address_info_batch(
+      addresses, count, address_infos);
+}
+
+void
+elff_set_index_cache(ELFF_HANDLE handle, int enable)
+{
+  assert(handle != NULL);
+  if (handle == NULL) {
+    return;
+  }
+  reinterpret_cast<ElfFile*>(handle)->set_index_cache(enable != 0);
+}
+
 #ifdef __cplusplus
 }   /* end of extern "C" */
 #endif
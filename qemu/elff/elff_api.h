@@ -166,6 +166,41 @@ int elff_get_pc_address_info(ELFF_HANDLE handle,
 void elff_free_pc_address_info(ELFF_HANDLE handle,
                                Elf_AddressInfo* address_info);
 
+/* Gets PC address information for a batch of addresses.
+ * On the first lookup ELFF API builds a sorted index of routine address ranges
+ * and line number rows for the ELF file, so a batch of addresses sorted in
+ * ascending order is resolved in a single pass over that index.
+ * Param:
+ *  handle - A handle obtained from successful call to elff_init().
+ *  addresses - PC addresses to get information for, sorted in ascending
+ *    order. Addresses must be relative to the beginning of ELF file
+ *    represented by the handle parameter.
+ *  count - Number of addresses in the batch.
+ *  address_infos - Upon return contains information for each address in the
+ *    batch. For an address that has not been resolved, routine_name field of
+ *    its entry is set to NULL.
+ * Return:
+ *  Number of resolved addresses, or -1 on failure, with errno providing
+ *  extended error information.
+ *  NOTE: Each resolved entry must be complimented with a call to
+ *  elff_free_pc_address_info.
+ */
+int elff_get_pc_address_info_batch(ELFF_HANDLE handle,
+                                   const uint64_t* addresses,
+                                   int count,
+                                   Elf_AddressInfo* address_infos);
+
+/* Enables, or disables on-disk cache of the address index.
+ * When enabled, the line number rows of the index are saved next to the ELF
+ * file (in a file with .elffidx suffix), and loaded from there next time,
+ * unless the ELF file has changed since. Must be called before the first
+ * lookup.
+ * Param:
+ *  handle - A handle obtained from successful call to elff_init().
+ *  enable - 1 to enable the cache, or 0 to disable it.
+ */
+void elff_set_index_cache(ELFF_HANDLE handle, int enable);
+
 #ifdef __cplusplus
 }   /* end of extern "C" */
 #endif
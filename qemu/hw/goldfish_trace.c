@@ -17,6 +17,7 @@
 #include "goldfish_trace.h"
 #include "sysemu.h"
 #include "android-trace.h"
+#include "tlb_trace.h"
 #ifdef CONFIG_MEMCHECK
 #include "memcheck/memcheck.h"
 #include "memcheck/memcheck_util.h"
@@ -139,6 +140,7 @@ static void trace_dev_write(void *opaque, target_phys_addr_t offset, uint32_t va
             memcheck_mmap_exepath(vstart, vend, eoff, exec_path);
         }
 #endif  // CONFIG_MEMCHECK
+        tlbtrace_proc_mmap(vstart, vend, eoff, exec_path);
         exec_path[0] = 0;
         break;
     case TRACE_DEV_REG_CMDLINE_LEN:     // execve, process cmdline length
@@ -149,6 +151,7 @@ static void trace_dev_write(void *opaque, target_phys_addr_t offset, uint32_t va
         if (trace_filename != NULL) {
             trace_execve(exec_arg, cmdlen);
         }
+        tlbtrace_proc_execve(exec_arg, cmdlen);
 #ifdef CONFIG_MEMCHECK
         if (memcheck_enabled) {
             memcheck_set_cmd_line(exec_arg, cmdlen);
@@ -190,6 +193,7 @@ static void trace_dev_write(void *opaque, target_phys_addr_t offset, uint32_t va
             trace_name(exec_path);
             D("QEMU.trace: kernel, name %s\n", exec_path);
         }
+        tlbtrace_proc_name(exec_path);
         break;
     case TRACE_DEV_REG_MMAP_EXEPATH:    // mmap, path of EXE, the others are same as execve
         vstrcpy(value, exec_path, CLIENT_PAGE_SIZE);
@@ -208,6 +212,7 @@ static void trace_dev_write(void *opaque, target_phys_addr_t offset, uint32_t va
             memcheck_mmap_exepath(vstart, vend, eoff, exec_path);
         }
 #endif  // CONFIG_MEMCHECK
+        tlbtrace_proc_mmap(vstart, vend, eoff, exec_path);
         exec_path[0] = 0;
         break;
     case TRACE_DEV_REG_INIT_PID:        // init, name the pid that starts before device registered
@@ -300,6 +305,7 @@ static void trace_dev_write(void *opaque, target_phys_addr_t offset, uint32_t va
             memcheck_unmap(unmap_start, value);
         }
 #endif  // CONFIG_MEMCHECK
+        tlbtrace_proc_munmap(unmap_start, value);
         break;
 
     case TRACE_DEV_REG_METHOD_ENTRY:
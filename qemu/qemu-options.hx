@@ -1691,6 +1691,19 @@ DEF("nand", HAS_ARG, QEMU_OPTION_nand, \
 
 #ifdef CONFIG_ANDROID
 
+DEF("tlbtrace", HAS_ARG, QEMU_OPTION_tlbtrace, \
+    "-tlbtrace <options>\n" \
+    "                configure the TLB tracer, e.g. size=128,ways=4,dir=/tmp\n")
+STEXI
+@item -tlbtrace @var{options}
+Configure the TLB tracer with comma-separated @var{name}=@var{value} pairs
+(size, ways, tlbs, mode, dir, buffer, stop, stop_bytes, stop_time, stop_insns,
+insns, tag_pc, maps, priv, ring, ring_time, segment), the options of the
+@code{tlbtrace config} console command described in tlb_trace.h. If one of
+them is invalid, none of them is applied. Tracing is started with F10 or the
+@code{tlbtrace start} console command.
+ETEXI
+
 DEF("savevm-on-exit", HAS_ARG, QEMU_OPTION_savevm_on_exit, \
     "savevm-on-exit [tag|id]\n" \
     "                save state automatically on exit\n")
@@ -63,6 +63,7 @@
 #endif  // CONFIG_MEMCHECK && !OUTSIDE_JIT && !SOFTMMU_CODE_ACCESS
 
 extern void tlbtrace_refmem_qemu(unsigned int addr, int ins);
+extern int tlbtrace_started;
 
 static DATA_TYPE glue(glue(slow_ld, SUFFIX), MMUSUFFIX)(target_ulong addr,
                                                         int mmu_idx,
@@ -111,7 +112,8 @@ DATA_TYPE REGPARM glue(glue(__ld, SUFFIX), MMUSUFFIX)(target_ulong addr,
 #endif  // CONFIG_MEMCHECK_MMU
 
 	// WHITESTONE: this is the entry point for each memory reference!!!
-	tlbtrace_refmem_qemu(addr, 0);
+	if (unlikely(tlbtrace_started))
+		tlbtrace_refmem_qemu(addr, 0);
 
     /* test if there is match for unaligned or IO access */
     /* XXX: could done more in memory macro in a non portable way */
@@ -293,7 +295,8 @@ void REGPARM glue(glue(__st, SUFFIX), MMUSUFFIX)(target_ulong addr,
 #endif  // CONFIG_MEMCHECK_MMU
 
 	// WHITESTONE: this is the entry point for each memory reference (write)!!!
-	tlbtrace_refmem_qemu(addr, 0);
+	if (unlikely(tlbtrace_started))
+		tlbtrace_refmem_qemu(addr, 0);
 
     index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
  redo:
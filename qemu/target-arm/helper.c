@@ -1626,21 +1626,25 @@ void HELPER(set_cp15)(CPUState *env, uint32_t insn, uint32_t val)
         case 1: /* Invalidate single TLB entry.  */
             tlb_flush_page(env, val & TARGET_PAGE_MASK);
 			{
-				void tlbtrace_flush_entry(unsigned int addr);
+				void tlbtrace_flush_entry(unsigned long va);
 				tlbtrace_flush_entry(val);
 			}
             break;
         case 2: /* Invalidate on ASID.  */
             tlb_flush(env, val == 0);
 			{
-				void tlbtrace_flush_asid(unsigned int asid);
+				void tlbtrace_flush_asid(unsigned long asid);
 				tlbtrace_flush_asid(val);
 			}
             break;
         case 3: /* Invalidate single entry on MVA.  */
-            /* ??? This is like case 1, but ignores ASID.  */
-			fprintf(stderr, "[TLBTRACE] NOT SUPPORT YET........................................... (%s:%d)\n", __FUNCTION__, __LINE__);
-            tlb_flush(env, 1);
+            /* This is like case 1, but ignores ASID.  The QEMU TLB is
+               not tagged with the ASID, so flushing the page is enough.  */
+            tlb_flush_page(env, val & TARGET_PAGE_MASK);
+			{
+				void tlbtrace_flush_mva(unsigned long va);
+				tlbtrace_flush_mva(val);
+			}
             break;
         default:
             goto bad_reg;
@@ -1793,6 +1797,10 @@ void HELPER(set_cp15)(CPUState *env, uint32_t insn, uint32_t val)
                 && !arm_feature(env, ARM_FEATURE_MPU))
               tlb_flush(env, 0);
             env->cp15.c13_context = val;
+			{
+				void tlbtrace_proc_context(unsigned long ctx);
+				tlbtrace_proc_context(val);
+			}
             break;
         default:
             goto bad_reg;
@@ -2211,6 +2219,12 @@ bad_reg:
     return 0;
 }
 
+void HELPER(tlbtrace_magic)(CPUState *env, uint32_t op, uint32_t val)
+{
+    void tlbtrace_magic(CPUState *env, int op, uint32_t val);
+    tlbtrace_magic(env, op, val);
+}
+
 void HELPER(set_r13_banked)(CPUState *env, uint32_t mode, uint32_t val)
 {
     if ((env->uncached_cpsr & CPSR_M) == mode) {
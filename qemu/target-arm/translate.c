@@ -29,6 +29,7 @@
 #include "disas.h"
 #include "tcg-op.h"
 #include "qemu-log.h"
+#include "tlb_trace.h"
 
 #include "helper.h"
 #define GEN_HELPER 1
@@ -69,6 +70,8 @@ typedef struct DisasContext {
 #ifdef CONFIG_MEMCHECK
     int search_pc;
 #endif
+    /* Nonzero if instruction fetches are traced by the TLB tracer.  */
+    int tlbtrace;
 } DisasContext;
 
 #include "translate-android.h"
@@ -822,6 +825,50 @@ static inline void gen_trace_pc(TCGv addr)
     tcg_gen_qemu_trace_pc(addr);
 }
 
+/* Trace the fetch at s->pc.  Every fetch is traced, even though it hits
+   the main TLB when it is on the page of the previous one: the hits keep
+   the LRU order of the simulated main TLB.  */
+static inline void gen_trace_insn(DisasContext *s)
+{
+    if (s->tlbtrace)
+        gen_trace_pc(s->pc);
+}
+
+static TCGArg *tlbtrace_insns_arg;
+
+/* Add the length of the TB to tlbtrace_insns when the TB is entered.
+   The length is only known at the end of translation, so it is patched
+   in by gen_trace_insns_end(), like gen_icount_start() does.  */
+static inline void gen_trace_insns_start(DisasContext *s)
+{
+    TCGv_ptr ptr;
+    TCGv_i32 len;
+    TCGv_i64 cnt, tmp;
+
+    if (!s->tlbtrace)
+        return;
+    ptr = tcg_const_ptr((tcg_target_long)&tlbtrace_insns);
+    len = tcg_temp_new_i32();
+    tlbtrace_insns_arg = gen_opparam_ptr + 1;
+    tcg_gen_movi_i32(len, 0xdeadbeef);
+    tmp = tcg_temp_new_i64();
+    tcg_gen_extu_i32_i64(tmp, len);
+    cnt = tcg_temp_new_i64();
+    tcg_gen_ld_i64(cnt, ptr, 0);
+    tcg_gen_add_i64(cnt, cnt, tmp);
+    tcg_gen_st_i64(cnt, ptr, 0);
+    tcg_temp_free_i64(cnt);
+    tcg_temp_free_i64(tmp);
+    tcg_temp_free_i32(len);
+    tcg_temp_free_ptr(ptr);
+}
+
+static inline void gen_trace_insns_end(DisasContext *s, int num_insns)
+{
+    if (s->tlbtrace)
+        *tlbtrace_insns_arg = num_insns;
+}
+
 static inline void gen_st8(TCGv val, TCGv addr, int index)
 {
     tcg_gen_qemu_st8(val, addr, index);
@@ -2575,6 +2622,19 @@ static int disas_cp15_insn(CPUState *env, DisasContext *s, uint32_t insn)
         /* cdp */
         return 1;
     }
+    if ((insn & TLBTRACE_MAGIC_MASK) == TLBTRACE_MAGIC_INSN
+            && !(insn & ARM_CP_RW_BIT)) {
+        /* Guest request to the TLB tracer, allowed in user mode.  */
+        rd = (insn >> 12) & 0xf;
+        tmp = load_reg(s, rd);
+        tmp2 = tcg_const_i32((insn >> 5) & 7);
+        gen_helper_tlbtrace_magic(cpu_env, tmp2, tmp);
+        tcg_temp_free_i32(tmp2);
+        tcg_temp_free_i32(tmp);
+        gen_lookup_tb(s);
+        return 0;
+    }
+
     if (IS_USER(s) && !cp15_user_ok(insn)) {
         return 1;
     }
@@ -6434,7 +6494,7 @@ static void disas_arm_insn(CPUState * env, DisasContext *s)
 
     ANDROID_TRACE_START_ARM();
 
-	gen_trace_pc(s->pc);
+    gen_trace_insn(s);
 
     s->pc += 4;
 
@@ -7840,6 +7900,9 @@ static int disas_thumb2_insn(CPUState *env, DisasContext *s, uint16_t insn_hw1)
         /* Fall through to 32-bit decode.  */
     }
 
+    /* The second halfword is a fetch of its own if it is on the next page.  */
+    if ((s->pc & TARGET_PAGE_MASK) != ((s->pc - 2) & TARGET_PAGE_MASK))
+        gen_trace_insn(s);
     insn = lduw_code(s->pc);
     ANDROID_TRACE_START_THUMB();
     s->pc += 2;
@@ -8864,6 +8927,9 @@ static void disas_thumb_insn(CPUState *env, DisasContext *s)
     TCGv tmp2;
     TCGv addr;
 
+    /* Traced before the IT condition test: skipped insns are fetched too.  */
+    gen_trace_insn(s);
+
     if (s->condexec_mask) {
         cond = s->condexec_cond;
         if (cond != 0x0e) {     /* Skip conditional when condition is AL. */
@@ -9581,6 +9647,8 @@ static inline void gen_intermediate_code_internal(CPUState *env,
     dc->vfp_enabled = ARM_TBFLAG_VFPEN(tb->flags);
     dc->vec_len = ARM_TBFLAG_VECLEN(tb->flags);
     dc->vec_stride = ARM_TBFLAG_VECSTRIDE(tb->flags);
+    /* The TB cache is flushed whenever the TLB tracer is toggled.  */
+    dc->tlbtrace = tlbtrace_enabled();
     cpu_F0s = tcg_temp_new_i32();
     cpu_F1s = tcg_temp_new_i32();
     cpu_F0d = tcg_temp_new_i64();
@@ -9597,6 +9665,7 @@ static inline void gen_intermediate_code_internal(CPUState *env,
         max_insns = CF_COUNT_MASK;
 
     gen_icount_start();
+    gen_trace_insns_start(dc);
     ANDROID_TRACE_START_BB();
 
     tcg_clear_temp_count();
@@ -9811,6 +9880,7 @@ static inline void gen_intermediate_code_internal(CPUState *env,
 
 done_generating:
     gen_icount_end(tb, num_insns);
+    gen_trace_insns_end(dc, num_insns);
     *gen_opc_ptr = INDEX_op_end;
 
 #ifdef DEBUG_DISAS
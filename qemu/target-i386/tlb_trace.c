@@ -1,16 +1,46 @@
+#include <string.h>
+#include "tlb_trace.h"
+
+int tlbtrace_started;
+
 void tlbtrace_toggle(void)
 {
 
 }
 
-void tlbtrace_refmem_qemu(unsigned int addr)
+void tlbtrace_set_state(int on)
+{
+
+}
+
+int tlbtrace_trigger(void)
 {
+	return -1;
+}
 
+int tlbtrace_enabled(void)
+{
+	return 0;
 }
 
-int tlbtrace_init(void)
+int tlbtrace_set_options(const char *options)
 {
+	return -1;
+}
 
+void tlbtrace_get_stats(struct TLBTRACE_STATS *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+void tlbtrace_refmem_qemu(unsigned int addr)
+{
+
+}
+
+int tlbtrace_init_qemu(const char *options)
+{
+	return 0;
 }
 
 void qemu_trace_pc_helper(unsigned int pc)
@@ -0,0 +1 @@
+../../tlb_trace.h
\ No newline at end of file
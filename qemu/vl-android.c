@@ -406,6 +406,7 @@ const char* drop_log_filename = NULL;
 static int rotate_logs_requested = 0;
 
 const char* savevm_on_exit = NULL;
+static const char* tlbtrace_options = NULL;
 
 #define TFR(expr) do { if ((expr) != -1) break; } while (errno == EINTR)
 
@@ -3041,6 +3042,9 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_loadvm:
                 loadvm = optarg;
                 break;
+            case QEMU_OPTION_tlbtrace:
+                tlbtrace_options = optarg;
+                break;
             case QEMU_OPTION_savevm_on_exit:
                 savevm_on_exit = optarg;
                 break;
@@ -4165,8 +4169,10 @@ int main(int argc, char **argv, char **envp)
     }
 #endif
 	{
-		extern int tlbtrace_init(void);
-		tlbtrace_init();
+		extern int tlbtrace_init_qemu(const char *options);
+		if (tlbtrace_init_qemu(tlbtrace_options) != 0) {
+			PANIC("Invalid -tlbtrace options: %s", tlbtrace_options);
+		}
 	}
 
     /* Check the CPU Architecture value */
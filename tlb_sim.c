@@ -21,6 +21,7 @@
 #include <dirent.h>
 
 #include "tlb_sim.h"
+#include "tlb_trace.h"
 
 #define CACHE_MAX_ENTRIES	512
 #define MAX_TRACE_FILES		128
@@ -30,130 +31,1713 @@ struct TLB_ENTRY{
 	unsigned int pa;		// Physical Address
 	unsigned int asid;		// AP-Specific ID
 	unsigned int ts;		// LRU
+	unsigned int shift;		// log2 of the size of the mapping (NTLB)
 };
 
 unsigned long long systs;
 int TLB_WAYMASK_NTLB, TLB_MAX_ENTRIES_NTLB, TLB_WAYSTEP_NTLB;
 int TLB_WAYMASK_PWC, TLB_MAX_ENTRIES_PWC, TLB_WAYSTEP_PWC;
 
-struct TLB_ENTRY ntlb_tlb[CACHE_MAX_ENTRIES];	// nested tlb
-struct TLB_ENTRY ntlb2_tlb[CACHE_MAX_ENTRIES];	// nested tlb
-struct TLB_ENTRY pwc_tlb[CACHE_MAX_ENTRIES];		// page walk cache
-struct TLB_ENTRY pwc2_tlb[CACHE_MAX_ENTRIES];		// page walk cache
-struct TLB_ENTRY pwc3_tlb[CACHE_MAX_ENTRIES];		// page walk cache
+/* One bank of caches per CPU. All CPUs use bank 0 when the caches are shared. */
+static struct TLB_ENTRY ntlb_banks[TLBTRACE_MAX_CPUS][CACHE_MAX_ENTRIES];
+static struct TLB_ENTRY ntlb2_banks[TLBTRACE_MAX_CPUS][CACHE_MAX_ENTRIES];
+static struct TLB_ENTRY pwc_banks[TLBTRACE_MAX_CPUS][CACHE_MAX_ENTRIES];
+static struct TLB_ENTRY pwc2_banks[TLBTRACE_MAX_CPUS][CACHE_MAX_ENTRIES];
+static struct TLB_ENTRY pwc3_banks[TLBTRACE_MAX_CPUS][CACHE_MAX_ENTRIES];
+
+struct TLB_ENTRY *ntlb_tlb = ntlb_banks[0];		// nested tlb
+struct TLB_ENTRY *ntlb2_tlb = ntlb2_banks[0];	// nested tlb
+struct TLB_ENTRY *pwc_tlb = pwc_banks[0];		// page walk cache
+struct TLB_ENTRY *pwc2_tlb = pwc2_banks[0];		// page walk cache
+struct TLB_ENTRY *pwc3_tlb = pwc3_banks[0];		// page walk cache
+
+static int private_caches;
+
+/* Main TLB of page-mode traces, one bank per CPU */
+static struct TLB_ENTRY *main_banks[TLBTRACE_MAX_CPUS];
+static int main_size, main_step, main_mask;
+static enum TLBSIM_POLICY main_policy;
+static unsigned int main_ts;
+static unsigned int main_seed;
+static struct TLB_COUNTER main_cnt;
+
+/* Walks of a page-mode trace, the same table as in the tracer */
+struct PAGE_DEDUP{
+	uint32_t page;
+	uint32_t asid;
+	uint32_t ret;			// traversal result, size and #TLBTRACE_PRIV_FLAG, 0 if empty
+	uint32_t l1, l2, gpa;
+	uint32_t global;		// #TLBTRACE_GLOBAL of the walk record
+};
+
+static struct PAGE_DEDUP dedup_table[1 << TLBTRACE_DEDUP_BITS];
+static struct PAGE_DEDUP *dedup = dedup_table;	// table of the trace being read
+static uint32_t refs[3];		// packed references being read
+static int refs_n, refs_i;
+
+static unsigned long long sim_insns;	// guest instructions, from the instruction stamps
+static unsigned long long sim_records;	// simulated records
+static void (*fill_result)(struct SIM_RESULT *result);	// counters of the running simulation
+
+/* Windows of instructions or records, see tlbsim_set_window() and tlbsim_set_window_records() */
+static unsigned long long window_insns;
+static unsigned long long window_records;
+static unsigned long long window_left;	// records left in the window, never reaching 0 without record windows
+static void (*window_report)(const struct SIM_RESULT *result, void *arg);
+static void *window_arg;
+static unsigned long long window_end;
+static struct SIM_RESULT window_last;	// counters at the end of the last window
+static const char *window_trace;		// base name of the trace simulated, NULL with several VMs
+
+/* Breakdown by privilege level */
+static int sim_priv;					// privilege level of the current accesses
+static struct SIM_RESULT priv_base;		// counters when sim_priv was entered
+static struct SIM_RESULT priv_res[2];		// counters of each level, see struct SIM_PRIV_RESULT
+
+/* Breakdown of the walks by step and by traversal result */
+static struct SIM_STEP_RESULT steps[SIM_STEPS];
+static struct SIM_LEVEL_RESULT levels[SIM_LEVELS];
+static unsigned long long refs_hist[SIM_HIST_BINS], accs_hist[SIM_HIST_BINS];
+static struct SIM_STEP_RESULT walk_cnt;		// lookups and accesses of the record being simulated
+
+/* Pages causing the most misses, see tlbsim_set_hot_pages(). The misses of each kind of page are counted in a
+ * count-min sketch, and the pages of the largest estimates are kept in a min-heap. */
+#define HOT_ROWS	4		// 1 - e^-4 = 98% confidence
+#define HOT_BITS	12		// e / 4096 = 0.07% of the misses error
+#define HOT_MAX		1024
+
+static unsigned long long hot_sketch[SIM_HOT_KINDS][HOT_ROWS][1 << HOT_BITS];
+static unsigned long long hot_total[SIM_HOT_KINDS];	// misses counted in the sketch
+static struct SIM_HOT_PAGE hot_heap[SIM_HOT_KINDS][HOT_MAX];
+static int hot_nr[SIM_HOT_KINDS];
+static int hot_n;			// pages reported per kind, 0 if disabled
+static void (*hot_report)(const struct SIM_HOT_PAGE *hot, void *arg);
+static void *hot_arg;
+
+/* Cost per PC, see tlbsim_set_profile(). An open-addressing table keyed by PC and ASID. */
+struct PC_SLOT{
+	int used;
+	struct SIM_PC_COST cost;
+};
+
+static void (*profile_report)(const struct SIM_PC_COST *cost, void *arg);
+static void *profile_arg;
+static struct PC_SLOT *pc_slots;
+static unsigned int pc_size, pc_used;					// slots, a power of 2, and slots in use
+static uint32_t sim_pc[TLBTRACE_MAX_CPUS];				// last tag of each CPU
+static uint32_t sim_pc_asid[TLBTRACE_MAX_CPUS];
+static struct SIM_PC_COST *pc_cur[TLBTRACE_MAX_CPUS];	// slot of the last tag, NULL if not looked up yet
+static struct SIM_RESULT cost_last;						// counters after the last record
+
+/* Cost per memory region, see tlbsim_set_regions(). The mappings of each ASID are sorted by address and do not overlap. */
+#define REGION_KERNEL	0
+#define REGION_STACK	1
+#define REGION_HEAP		2
+#define REGION_ANON		3
+#define REGION_FILES	4			// region of the file name of index 1
+#define MAP_ANY_ASID	256			// mappings of all ASIDs, the last one wins
+#define KERNEL_BASE		0xC0000000	// default split of ARM Linux
+#define STACK_BASE		0xBE000000	// main stack, in the 16M below the top of the user space
+#define MMAP_BASE		0x40000000	// mmap() allocates from here, and the heap grows below
+
+struct SIM_MAP{
+	uint32_t start;
+	uint32_t end;			// exclusive
+	unsigned int region;
+};
+
+struct MAP_TABLE{
+	struct SIM_MAP *maps;
+	int n, size;
+};
+
+struct REGION{
+	char name[TLBTRACE_NAME_MAX];
+	struct SIM_REGION_COST cost;
+};
+
+static void (*region_report)(const struct SIM_REGION_COST *cost, void *arg);
+static void *region_arg;
+static struct MAP_TABLE map_tables[MAP_ANY_ASID + 1];
+static struct REGION *regions;
+static int region_nr, region_max;
+static unsigned int sim_asid[TLBTRACE_MAX_CPUS];		// ASID of the records of each CPU, TLBTRACE_MAP_NO_ASID if not known
+
+/* Consolidated VMs, see tlbsim_set_vms() and tlbsim_sim_vms(). The reader state of the VMs which are not running is kept
+ * in their VM_READER, and the entries of the caches are tagged with the VMID in the bits of the ASID above the guest ASID. */
+struct VM_READER{
+	FILE *fin;
+	struct PAGE_DEDUP *dedup;
+	uint32_t refs[3];
+	int refs_n, refs_i;
+	unsigned int asid[TLBTRACE_MAX_CPUS];
+	int done;				// the trace ended
+};
+
+static unsigned long long vm_quantum = 100000;
+static enum TLBSIM_SWITCH vm_switch;
+static struct VM_READER vm_readers[SIM_MAX_VMS];
+static int vm_n;						// VMs sharing the caches, 0 or 1 for a trace alone
+static int vm_cur;
+static unsigned int vm_tag;				// VMID of the running VM, shifted above the guest ASID
+static unsigned long long vm_left;		// records left in the quantum
+static struct SIM_RESULT *vm_out[SIM_MAX_VMS];	// counters of each VM
+static struct SIM_RESULT vm_base;				// counters when the running VM was scheduled
+static unsigned long long vm_quanta[SIM_MAX_VMS], vm_evicted[SIM_MAX_VMS];
+
+#define VM_SHIFT	9		// shift of the VMID in the ASID of an entry
+#define ASID_GLOBAL	0x100	// ASID of the main TLB entries of global mappings, which hit with any ASID of their VM
+
+#define FLUSH_TLB(tlb, size)		do{ \
+	int _idx_; \
+	for(_idx_ = 0; _idx_ < size; _idx_++){\
+		tlb[_idx_].va = 0xFFFFFFFF; \
+		tlb[_idx_].asid = 0; \
+		tlb[_idx_].ts = 0; \
+		tlb[_idx_].shift = 0; \
+	} \
+}while(0)
+
+#define INIT_TLB(tlb, size, cnt)		do{ \
+	FLUSH_TLB(tlb, size);	\
+	cnt.miss = cnt.hit = 0; \
+}while(0)
+
+struct TLB_COUNTER ntlb_cnt;
+struct TLB_COUNTER ntlb2_cnt;
+struct TLB_COUNTER pwc_cnt;
+struct TLB_COUNTER pwc2_cnt;
+struct TLB_COUNTER pwc3_cnt;
+
+unsigned long long ntlb2_mem_accs;
+unsigned long long pwc2_mem_accs;
+unsigned long long pwc3_mem_accs;
+unsigned long long full_mem_accs;
+
+static FILE *fin;
+static char trace_files[MAX_TRACE_FILES][512];
+static int trace_count;
+
+/* Stage-2 page table, see tlbsim_set_stage2(). Descriptor addresses are computed with the shift of each level. */
+static struct SIM_STAGE2 s2 = {2, {12, 8}, 12, 2, 0, 0, 0, 0};
+static unsigned int s2_shift[SIM_S2_MAX_LEVELS] = {20, 12};		// lowest bit of the index of each level
+static uint32_t s2_level_base[SIM_S2_MAX_LEVELS] = {0, 16 * 1024};	// first table of each level
+static uint32_t s2_page_mask = 0xFFFFF000;
+static uint32_t s2_block_last;					// offset of the last address mapped by blocks from block_start
+static unsigned int ntlb_shift[2] = {12};		// sizes of the NTLB entries, from the granule
+static int ntlb_sizes = 1;
+
+/* Whether the walk of a record maps a guest section or supersection, whose output address is translated like the one of a page. */
+#define WALK_SECTION(walk)	(((walk) & TLBTRACE_SIZE_MASK) >= (TLBTRACE_SIZE_1M << TLBTRACE_SIZE_SHIFT))
+
+/* Checkpoints, see tlbsim_set_checkpoint() and tlbsim_set_warm_start() */
+#define CKPT_VERSION	6
+#define CKPT_GEOMETRY	16			// configuration values a warm start depends on
+#define CKPT_CONFIG		21
+
+struct CKPT_HEADER{
+	char magic[8];
+	uint32_t version;
+	uint32_t pad;
+	uint64_t config[CKPT_CONFIG];	// model, geometry and options, see ckpt_config()
+	char trace[256];				// file name of the trace, without the directory
+	uint64_t offset;				// of the next record in the trace
+	uint64_t records;				// simulated records
+	uint64_t files[SIM_CKPT_FILES];	// sizes of the report files, see tlbsim_set_checkpoint_files()
+};
+
+static const char ckpt_magic[8] = "TLBSIM1";
+static char ckpt_dir[512];			// empty if disabled
+static unsigned long long ckpt_records;
+static unsigned long long ckpt_left;	// records left before the next checkpoint, never reaching 0 without periodic checkpoints
+static char warm_file[512];			// empty if disabled
+static int ckpt_ended;				// the trace resumed at its end, so its last window and profile were already reported
+static void (*files_save)(unsigned long long sizes[SIM_CKPT_FILES], void *arg);
+static void (*files_restore)(const unsigned long long sizes[SIM_CKPT_FILES], void *arg);
+static void *files_arg;
+static unsigned long long files_sizes[SIM_CKPT_FILES];	// sizes the files are truncated to before the next report
+static int files_pending;			// the files were not truncated since the simulation started
+static enum SIM_CMD sim_cmd;		// model of the running simulation
+static FILE *ckpt_f;
+static int ckpt_err;
+
+static void select_cpu(int cpu)
+{
+	ntlb_tlb = ntlb_banks[cpu];
+	ntlb2_tlb = ntlb2_banks[cpu];
+	pwc_tlb = pwc_banks[cpu];
+	pwc2_tlb = pwc2_banks[cpu];
+	pwc3_tlb = pwc3_banks[cpu];
+}
+
+static void flush_all()
+{
+	int i;
+
+	systs = 0;
+	full_mem_accs = pwc3_mem_accs = pwc2_mem_accs = ntlb2_mem_accs = 0;
+
+	for(i = 0; i < TLBTRACE_MAX_CPUS; i++){
+		FLUSH_TLB(ntlb_banks[i], CACHE_MAX_ENTRIES);
+		FLUSH_TLB(ntlb2_banks[i], CACHE_MAX_ENTRIES);
+		FLUSH_TLB(pwc_banks[i], CACHE_MAX_ENTRIES);
+		FLUSH_TLB(pwc2_banks[i], CACHE_MAX_ENTRIES);
+		FLUSH_TLB(pwc3_banks[i], CACHE_MAX_ENTRIES);
+	}
+	select_cpu(0);
+
+	INIT_TLB(ntlb_tlb, CACHE_MAX_ENTRIES, ntlb_cnt);
+	INIT_TLB(ntlb2_tlb, CACHE_MAX_ENTRIES, ntlb2_cnt);
+	INIT_TLB(pwc_tlb, CACHE_MAX_ENTRIES, pwc_cnt);
+	INIT_TLB(pwc2_tlb, CACHE_MAX_ENTRIES, pwc2_cnt);
+	INIT_TLB(pwc3_tlb, CACHE_MAX_ENTRIES, pwc3_cnt);
+
+	for(i = 0; i < TLBTRACE_MAX_CPUS && main_size != 0; i++)
+		FLUSH_TLB(main_banks[i], main_size);
+	main_cnt.miss = main_cnt.hit = 0;
+	main_ts = 0;
+	main_seed = 1;
+
+	memset(dedup, 0, sizeof(dedup_table));
+	refs_n = refs_i = 0;
+
+	sim_insns = 0;
+	sim_records = 0;
+	window_end = window_insns;
+	window_left = window_records != 0 ? window_records : ~0ULL;
+	memset(&window_last, 0, sizeof(window_last));
+
+	sim_priv = 0;
+	memset(&priv_base, 0, sizeof(priv_base));
+	memset(priv_res, 0, sizeof(priv_res));
+
+	memset(sim_pc, 0, sizeof(sim_pc));
+	memset(sim_pc_asid, 0, sizeof(sim_pc_asid));
+	memset(pc_cur, 0, sizeof(pc_cur));
+	memset(&cost_last, 0, sizeof(cost_last));
+	if(pc_slots != NULL)	memset(pc_slots, 0, sizeof(struct PC_SLOT) * pc_size);
+	pc_used = 0;
+
+	memset(steps, 0, sizeof(steps));
+	memset(levels, 0, sizeof(levels));
+	memset(refs_hist, 0, sizeof(refs_hist));
+	memset(accs_hist, 0, sizeof(accs_hist));
+	memset(&walk_cnt, 0, sizeof(walk_cnt));
+
+	for(i = 0; i <= MAP_ANY_ASID; i++)
+		map_tables[i].n = 0;
+	for(i = 0; i < TLBTRACE_MAX_CPUS; i++)
+		sim_asid[i] = TLBTRACE_MAP_NO_ASID;
+	region_nr = 0;
+
+	if(hot_n != 0)	memset(hot_sketch, 0, sizeof(hot_sketch));
+	memset(hot_total, 0, sizeof(hot_total));
+	memset(hot_nr, 0, sizeof(hot_nr));
+}
+
+/* Add the counters of \a cur since \a base to \a dst, without the breakdowns. */
+static void result_add_delta(struct SIM_RESULT *dst, const struct SIM_RESULT *cur, const struct SIM_RESULT *base)
+{
+	dst->records += cur->records - base->records;
+	dst->insns += cur->insns - base->insns;
+	dst->accs += cur->accs - base->accs;
+	dst->ntlb.hit += cur->ntlb.hit - base->ntlb.hit;
+	dst->ntlb.miss += cur->ntlb.miss - base->ntlb.miss;
+	dst->pwc.hit += cur->pwc.hit - base->pwc.hit;
+	dst->pwc.miss += cur->pwc.miss - base->pwc.miss;
+	dst->tlb.hit += cur->tlb.hit - base->tlb.hit;
+	dst->tlb.miss += cur->tlb.miss - base->tlb.miss;
+}
+
+/* Add the counters since the last change of privilege level to the current level. */
+static void account_priv(void)
+{
+	struct SIM_RESULT cur;
+
+	memset(&cur, 0, sizeof(cur));
+	fill_result(&cur);
+	result_add_delta(&priv_res[sim_priv], &cur, &priv_base);
+
+	priv_base = cur;
+}
+
+/* Switch the privilege level the following accesses are accounted to. */
+static inline void set_priv(uint32_t flags)
+{
+	int priv = (flags & TLBTRACE_PRIV_FLAG) != 0;
+
+	if(priv == sim_priv)	return;
+	account_priv();
+	sim_priv = priv;
+}
+
+/* Count an entry of another VM about to be replaced by the running one. */
+static inline void vm_evict(const struct TLB_ENTRY *e)
+{
+	if(vm_n > 1 && e->va != 0xFFFFFFFF && (e->asid >> VM_SHIFT) != (unsigned int)vm_cur)	vm_evicted[e->asid >> VM_SHIFT]++;
+}
+
+/* Look up the main TLB of a CPU, where \a asid is the tag of the entry to fill. Every access misses if no main TLB is set. */
+static int main_tlb_find(int cpu, uint32_t page, uint32_t asid)
+{
+	struct TLB_ENTRY *tlb = main_banks[cpu];
+	int i, mi = (page >> 12) & main_mask;
+	unsigned int mts;
+
+	if(main_size == 0)	return 0;
+
+	mts = tlb[mi].ts;
+	for(i = mi; i < main_size; i += main_step){
+		if(tlb[i].va == page && (tlb[i].asid == asid || tlb[i].asid == (ASID_GLOBAL | vm_tag))){		// hit
+			if(main_policy == TP_LRU)	tlb[i].ts = ++main_ts;
+			main_cnt.hit++;
+			return 1;
+		}
+
+		if(tlb[i].ts < mts){
+			mts = tlb[i].ts;
+			mi = i;
+		}
+	}
+
+	// miss: LRU and FIFO replace the oldest entry, which is the oldest fill for FIFO
+	if(main_policy == TP_RANDOM)	mi = ((page >> 12) & main_mask) + (rand_r(&main_seed) % (main_size / main_step)) * main_step;
+	vm_evict(&tlb[mi]);
+	tlb[mi].va = page;
+	tlb[mi].asid = asid;
+	tlb[mi].ts = ++main_ts;
+	main_cnt.miss++;
+
+	return 0;
+}
+
+/* Walk record of a page-mode trace: remember the walk, and keep the record if the main TLB misses. */
+static int page_walk(uint32_t t[4])
+{
+	uint32_t page = t[0] & 0xFFFFF000, asid = t[3] & 0xFF;
+	struct PAGE_DEDUP *e = &dedup[TLBTRACE_DEDUP_IDX(page, asid)];
+
+	e->page = page;
+	e->asid = asid;
+	e->ret = t[0] & (TLBTRACE_RET_MASK | TLBTRACE_SIZE_MASK | TLBTRACE_PRIV_FLAG);
+	e->l1 = t[1];
+	e->l2 = t[2];
+	e->gpa = t[3] & 0xFFFFF000;
+	e->global = t[3] & TLBTRACE_GLOBAL;
+
+	t[0] &= ~TLBTRACE_PAGE_FLAG;
+	t[3] = e->gpa;
+
+	sim_asid[(t[0] & TLBTRACE_CPU_MASK) >> TLBTRACE_CPU_SHIFT] = asid;
+	set_priv(e->ret);
+	return main_tlb_find((t[0] & TLBTRACE_CPU_MASK) >> TLBTRACE_CPU_SHIFT, page, (e->global ? ASID_GLOBAL : asid) | vm_tag) == 0;
+}
+
+/* Packed reference of a page-mode trace: rebuild its record if the main TLB misses. */
+static int page_ref(uint32_t ref, uint32_t t[4])
+{
+	uint32_t page = ref & 0xFFFFF000, asid = ref & 0xFF;
+	struct PAGE_DEDUP *e = &dedup[TLBTRACE_DEDUP_IDX(page, asid)];
+
+	if(e->ret == 0 || e->page != page || e->asid != asid){
+		fprintf(stderr, "[tlbsim] no walk for page 0x%08X, ASID %u.\n", page, asid);
+		return 0;
+	}
+
+	sim_asid[(ref & TLBTRACE_CPU_MASK) >> TLBTRACE_CPU_SHIFT] = asid;
+	set_priv(e->ret);
+	if(main_tlb_find((ref & TLBTRACE_CPU_MASK) >> TLBTRACE_CPU_SHIFT, page, (e->global ? ASID_GLOBAL : asid) | vm_tag) != 0)	return 0;
+
+	t[0] = page | (ref & TLBTRACE_CPU_MASK) | e->ret;
+	t[1] = e->l1;
+	t[2] = e->l2;
+	t[3] = e->gpa;
+	return 1;
+}
+
+/* Drop the guest descriptors of the running VM at \a l1 and \a l2 from a page walk cache, or all of them if \a l1 is 0.
+   Guest descriptors are tagged with ASID 1, and descriptors of the extended page table with ASID 0, besides the VMID. */
+static void flush_descs(struct TLB_ENTRY *tlb, uint32_t l1, uint32_t l2)
+{
+	int i;
+
+	for(i = 0; i < CACHE_MAX_ENTRIES; i++){
+		if(tlb[i].asid != (1 | vm_tag))	continue;
+		if(l1 != 0 && tlb[i].va != l1 && (l2 == 0 || tlb[i].va != l2))	continue;
+		tlb[i].va = 0xFFFFFFFF;
+		tlb[i].asid = 0;
+		tlb[i].ts = 0;
+	}
+}
+
+/* Replay a TLB invalidation of the trace on the main TLB and the page walk caches of its CPU.
+   The NTLB caches the extended page table, which is not affected by the guest. */
+static void replay_flush(const uint32_t t[4])
+{
+	int cpu = (t[0] & TLBTRACE_CPU_MASK) >> TLBTRACE_CPU_SHIFT;
+	int bank = private_caches ? cpu : 0;
+	int op = t[1] & 0xF, i;
+	uint32_t va = t[0] & 0xFFFFF000, asid = (t[1] >> 8) & 0xFF;
+	struct TLB_ENTRY *tlb = main_banks[cpu];
+
+	for(i = 0; i < main_size; i++){
+		if((tlb[i].asid >> VM_SHIFT) != (vm_tag >> VM_SHIFT))	continue;		// entry of another VM
+		if(op == TLBTRACE_FLUSH_ENTRY && (tlb[i].va != va || (tlb[i].asid != (asid | vm_tag) && tlb[i].asid != (ASID_GLOBAL | vm_tag))))	continue;
+		if(op == TLBTRACE_FLUSH_ASID && tlb[i].asid != (asid | vm_tag))	continue;
+		if(op == TLBTRACE_FLUSH_MVA && tlb[i].va != va)	continue;
+		tlb[i].va = 0xFFFFFFFF;
+		tlb[i].asid = 0;
+		tlb[i].ts = 0;
+	}
+
+	flush_descs(pwc_banks[bank], t[2], t[3]);
+	flush_descs(pwc2_banks[bank], t[2], t[3]);
+	flush_descs(pwc3_banks[bank], t[2], t[3]);
+}
+
+static inline unsigned int pc_hash(uint32_t pc, uint32_t asid)
+{
+	return ((pc >> 1) ^ (asid << 24)) * 2654435761u;
+}
+
+/* Slot of a PC, which is added if it is not in the table yet. */
+static struct SIM_PC_COST *pc_slot(uint32_t pc, uint32_t asid)
+{
+	struct PC_SLOT *e;
+	unsigned int i;
+
+	if(pc_used * 2 >= pc_size){		// grow, and keep the load under 1/2
+		struct PC_SLOT *old = pc_slots;
+		unsigned int n = pc_size;
+
+		pc_size = pc_size != 0 ? pc_size * 2 : 4096;
+		if((pc_slots = (struct PC_SLOT*)calloc(pc_size, sizeof(struct PC_SLOT))) == NULL){
+			fprintf(stderr, "[tlbsim] out of memory.\n");
+			exit(1);
+		}
+		pc_used = 0;
+		for(i = 0; i < n; i++){
+			if(old[i].used)	*pc_slot(old[i].cost.pc, old[i].cost.asid) = old[i].cost;
+		}
+		free(old);
+		memset(pc_cur, 0, sizeof(pc_cur));	// the slots have moved
+	}
+
+	for(i = pc_hash(pc, asid) & (pc_size - 1); ; i = (i + 1) & (pc_size - 1)){
+		e = &pc_slots[i];
+		if(!e->used)	break;
+		if(e->cost.pc == pc && e->cost.asid == asid)	return &e->cost;
+	}
+
+	e->used = 1;
+	e->cost.pc = pc;
+	e->cost.asid = asid;
+	pc_used++;
+
+	return &e->cost;
+}
+
+/* Set the PC of the following records of a CPU. */
+static void replay_pc(const uint32_t t[4])
+{
+	int cpu = (t[0] & TLBTRACE_CPU_MASK) >> TLBTRACE_CPU_SHIFT;
+
+	sim_pc[cpu] = t[1];
+	sim_pc_asid[cpu] = t[2] & 0xFF;
+	sim_asid[cpu] = t[2] & 0xFF;
+	pc_cur[cpu] = NULL;
+}
+
+/* Region of a file name or a pseudo-region, which is added if it is new. */
+static struct REGION *region_slot(unsigned int idx)
+{
+	static const char *pseudo[REGION_FILES] = {"[kernel]", "[stack]", "[heap]", "[anon]"};
+	struct REGION *r;
+
+	if(idx >= (unsigned int)region_max){
+		region_max = idx + 64;
+		if((r = (struct REGION*)realloc(regions, sizeof(struct REGION) * region_max)) == NULL){
+			fprintf(stderr, "[tlbsim] out of memory.\n");
+			exit(1);
+		}
+		regions = r;
+	}
+
+	for(; region_nr <= (int)idx; region_nr++){
+		r = &regions[region_nr];
+		memset(r, 0, sizeof(*r));
+		strcpy(r->name, region_nr < REGION_FILES ? pseudo[region_nr] : "?");
+		r->cost.name = r->name;
+	}
+
+	return &regions[idx];
+}
+
+/* Mapping of a table which holds \a page, or NULL. */
+static const struct SIM_MAP *map_find(const struct MAP_TABLE *t, uint32_t page)
+{
+	int lo = 0, hi = t->n - 1, mid;
+
+	while(lo <= hi){
+		mid = (lo + hi) / 2;
+		if(page < t->maps[mid].start)	hi = mid - 1;
+		else if(page >= t->maps[mid].end)	lo = mid + 1;
+		else		return &t->maps[mid];
+	}
+
+	return NULL;
+}
+
+/* Insert a mapping before mapping \a i of a table. */
+static void map_insert(struct MAP_TABLE *t, int i, uint32_t start, uint32_t end, unsigned int region)
+{
+	if(t->n == t->size){
+		t->size = t->size != 0 ? t->size * 2 : 64;
+		if((t->maps = (struct SIM_MAP*)realloc(t->maps, sizeof(struct SIM_MAP) * t->size)) == NULL){
+			fprintf(stderr, "[tlbsim] out of memory.\n");
+			exit(1);
+		}
+	}
+
+	memmove(&t->maps[i + 1], &t->maps[i], sizeof(struct SIM_MAP) * (t->n - i));
+	t->maps[i].start = start;
+	t->maps[i].end = end;
+	t->maps[i].region = region;
+	t->n++;
+}
+
+/* Drop the pages in [start, end) from a table, cutting the mappings which cover a part of it. */
+static void map_cut(struct MAP_TABLE *t, uint32_t start, uint32_t end)
+{
+	struct SIM_MAP *m;
+	int i;
+
+	for(i = 0; i < t->n && t->maps[i].start < end; i++){
+		m = &t->maps[i];
+		if(m->end <= start)	continue;
+
+		if(m->start < start && m->end > end){		// the middle
+			map_insert(t, i + 1, end, t->maps[i].end, t->maps[i].region);
+			t->maps[i].end = start;
+			break;
+		}else if(m->start < start){
+			m->end = start;
+		}else if(m->end > end){
+			m->start = end;
+		}else{
+			memmove(m, m + 1, sizeof(struct SIM_MAP) * (t->n - i - 1));
+			t->n--;
+			i--;
+		}
+	}
+}
+
+/* Add a mapping to a table, replacing the pages it overlaps. */
+static void map_add(struct MAP_TABLE *t, uint32_t start, uint32_t end, unsigned int region)
+{
+	int i;
+
+	map_cut(t, start, end);
+	for(i = 0; i < t->n && t->maps[i].start < start; i++);
+	map_insert(t, i, start, end, region);
+}
+
+/* Replay a change of the memory mappings, or the ASID of the following records of a CPU. */
+static void replay_map(const uint32_t t[4])
+{
+	int cpu = (t[0] & TLBTRACE_CPU_MASK) >> TLBTRACE_CPU_SHIFT;
+	int op = (t[1] >> TLBTRACE_MAP_OP_SHIFT) & 0xF;
+	uint32_t start = t[0] & 0xFFFFF000, end = t[1] & 0xFFFFF000, asid = t[1] & 0xFF;
+
+	if(op == TLBTRACE_MAP_ASID){
+		sim_asid[cpu] = asid;
+		return;
+	}
+	if(region_report == NULL || end <= start)	return;
+
+	if(op == TLBTRACE_MAP_ADD){
+		unsigned int region = t[3] != 0 ? REGION_FILES + t[3] - 1 : REGION_ANON;
+
+		map_add(&map_tables[asid], start, end, region);
+		map_add(&map_tables[MAP_ANY_ASID], start, end, region);		// other ASIDs may still map the old pages
+	}else if(op == TLBTRACE_MAP_REMOVE){
+		map_cut(&map_tables[asid], start, end);
+	}
+}
+
+/* Add a part of a file name. */
+static void replay_name(const uint32_t t[4])
+{
+	struct REGION *r;
+	int part = (t[0] & TLBTRACE_CPU_MASK) >> TLBTRACE_CPU_SHIFT;
+
+	if(region_report == NULL || (t[0] >> TLBTRACE_NAME_SHIFT) == 0)	return;
+
+	r = region_slot(REGION_FILES + (t[0] >> TLBTRACE_NAME_SHIFT) - 1);
+	memcpy(&r->name[part * 12], &t[1], 12);
+	r->name[TLBTRACE_NAME_MAX - 1] = '\0';
+}
+
+/* Region of a page accessed by a CPU. The pages which are not mapped in the ASID of the CPU are looked up in
+   the mappings of all ASIDs, e.g. for processes forked before their parent's mappings were traced. Other pages
+   are classified by address. */
+static unsigned int region_of(int cpu, uint32_t page)
+{
+	const struct SIM_MAP *m = NULL;
+
+	if(page >= KERNEL_BASE)	return REGION_KERNEL;
+
+	if(sim_asid[cpu] != TLBTRACE_MAP_NO_ASID)	m = map_find(&map_tables[sim_asid[cpu]], page);
+	if(m == NULL)	m = map_find(&map_tables[MAP_ANY_ASID], page);
+	if(m != NULL)	return m->region;
+
+	if(page >= STACK_BASE)	return REGION_STACK;
+	if(page < MMAP_BASE)	return REGION_HEAP;
+	return REGION_ANON;
+}
+
+/* Add the cost of the record just simulated to the PC of its CPU, and to the region of its page. */
+static void record_cost(uint32_t mva)
+{
+	int cpu = (mva & TLBTRACE_CPU_MASK) >> TLBTRACE_CPU_SHIFT;
+	struct SIM_PC_COST *c;
+	struct SIM_REGION_COST *r;
+	struct SIM_RESULT cur, d;
+
+	memset(&cur, 0, sizeof(cur));		// the models without an NTLB or a PWC leave their counters
+	fill_result(&cur);
+	memset(&d, 0, sizeof(d));
+	result_add_delta(&d, &cur, &cost_last);
+	cost_last = cur;
+
+	if(profile_report != NULL){
+		if((c = pc_cur[cpu]) == NULL)	c = pc_cur[cpu] = pc_slot(sim_pc[cpu], sim_pc_asid[cpu]);
+		c->walks++;
+		c->ntlb_miss += d.ntlb.miss;
+		c->pwc_miss += d.pwc.miss;
+		c->accs += d.accs;
+	}
+
+	if(region_report != NULL){
+		r = &region_slot(region_of(cpu, mva & 0xFFFFF000))->cost;
+		r->walks++;
+		r->ntlb_miss += d.ntlb.miss;
+		r->pwc_miss += d.pwc.miss;
+		r->accs += d.accs;
+	}
+}
+
+static void profile_end(void)
+{
+	unsigned int i;
+
+	for(i = 0; i < pc_size; i++){
+		if(pc_slots[i].used)	profile_report(&pc_slots[i].cost, profile_arg);
+	}
+}
+
+static int region_cmp(const void *p1, const void *p2)
+{
+	const struct REGION *r1 = *(const struct REGION* const*)p1, *r2 = *(const struct REGION* const*)p2;
+
+	if(r1->cost.accs != r2->cost.accs)	return r1->cost.accs < r2->cost.accs ? 1 : -1;
+	return r1 < r2 ? -1 : r1 > r2;
+}
+
+/* Report the regions which made a simulated access, the most expensive first. */
+static void region_end(void)
+{
+	struct REGION **sorted;
+	int i, n = 0;
+
+	if((sorted = (struct REGION**)malloc(sizeof(struct REGION*) * (region_nr + 1))) == NULL){
+		fprintf(stderr, "[tlbsim] out of memory.\n");
+		return;
+	}
+
+	for(i = 0; i < region_nr; i++){
+		if(regions[i].cost.walks != 0)	sorted[n++] = &regions[i];
+	}
+	qsort(sorted, n, sizeof(struct REGION*), region_cmp);
+	for(i = 0; i < n; i++)
+		region_report(&sorted[i]->cost, region_arg);
+
+	free(sorted);
+}
+
+/* Report the counters of the window ending now, if anything happened in it. */
+static void end_window(void)
+{
+	struct SIM_RESULT cur, w;
+
+	memset(&cur, 0, sizeof(cur));
+	fill_result(&cur);
+	cur.records = sim_records;
+	if(cur.records == window_last.records && cur.insns == window_last.insns)	return;
+
+	memset(&w, 0, sizeof(w));
+	result_add_delta(&w, &cur, &window_last);
+	w.trace = window_trace;
+	window_report(&w, window_arg);
+
+	window_last = cur;
+}
+
+/* Add the instructions of a stamp, and end the window if it is complete. */
+static void replay_stamp(const uint32_t t[4])
+{
+	unsigned long long delta = 0;
+	uint8_t b[12];
+	int i;
+
+	memcpy(b, &t[1], sizeof(b));
+	for(i = 0; i < 10; i++){		// LEB128
+		delta |= (unsigned long long)(b[i] & 0x7F) << (7 * i);
+		if(!(b[i] & 0x80))	break;
+	}
+	sim_insns += delta;
+
+	if(window_insns != 0 && sim_insns >= window_end){
+		end_window();
+		while(window_end <= sim_insns)	window_end += window_insns;
+	}
+}
+
+/* Read the next record of the trace, and switch to the caches of its CPU.
+   Page-mode traces are filtered through the main TLB first. */
+static inline int next_record(uint32_t t[4])
+{
+	for(;;){
+		if(refs_i < refs_n){
+			if(page_ref(refs[refs_i++], t))	break;
+			continue;
+		}
+
+		if(fread(t, sizeof(uint32_t), 4, fin) != 4)	return 0;
+
+		if((t[0] & TLBTRACE_RET_MASK) == 0){		// skip events, such as markers
+			switch((t[0] & TLBTRACE_EVENT_MASK) >> TLBTRACE_EVENT_SHIFT){
+				case TLBTRACE_EVENT_REFS:
+					memcpy(refs, &t[1], sizeof(refs));
+					refs_n = (t[0] >> TLBTRACE_REFS_SHIFT) & 3;
+					refs_i = 0;
+					break;
+				case TLBTRACE_EVENT_FLUSH:
+					replay_flush(t);
+					break;
+				case TLBTRACE_EVENT_INSNS:
+					replay_stamp(t);
+					break;
+				case TLBTRACE_EVENT_PC:
+					replay_pc(t);
+					break;
+				case TLBTRACE_EVENT_MAP:
+					replay_map(t);
+					break;
+				case TLBTRACE_EVENT_NAME:
+					replay_name(t);
+					break;
+			}
+			continue;
+		}
+
+		if(!(t[0] & TLBTRACE_PAGE_FLAG)){
+			set_priv(t[0]);
+			break;
+		}
+		if(page_walk(t))	break;
+	}
+
+	if(private_caches)	select_cpu((t[0] & TLBTRACE_CPU_MASK) >> TLBTRACE_CPU_SHIFT);
+
+	return 1;
+}
+
+void tlbsim_set_private_caches(int enable)
+{
+	private_caches = enable;
+}
+
+void tlbsim_set_profile(void (*report)(const struct SIM_PC_COST *cost, void *arg), void *arg)
+{
+	profile_report = report;
+	profile_arg = arg;
+}
+
+void tlbsim_set_regions(void (*report)(const struct SIM_REGION_COST *cost, void *arg), void *arg)
+{
+	region_report = report;
+	region_arg = arg;
+}
+
+int tlbsim_set_hot_pages(int n, void (*report)(const struct SIM_HOT_PAGE *hot, void *arg), void *arg)
+{
+	if(report != NULL && (n <= 0 || n > HOT_MAX)){
+		fprintf(stderr, "[tlbsim] %d hot pages, at most %d can be reported.\n", n, HOT_MAX);
+		return -1;
+	}
+
+	hot_n = report != NULL ? n : 0;
+	hot_report = report;
+	hot_arg = arg;
+	return 0;
+}
+
+int tlbsim_set_stage2(const struct SIM_STAGE2 *layout)
+{
+	static const struct SIM_STAGE2 def = {2, {12, 8}, 12, 2, 0, 0, 0, 0};
+	uint64_t end;
+	uint32_t block_mask;
+	int k, bits, bad = 0;
+
+	if(layout == NULL)	layout = &def;
+
+	bits = layout->granule_bits;
+	for(k = 0; k < layout->levels && k < SIM_S2_MAX_LEVELS; k++){
+		if(layout->bits[k] <= 0)	bad = 1;
+		bits += layout->bits[k];
+	}
+	if(bad || layout->levels < 1 || layout->levels > SIM_S2_MAX_LEVELS || bits != 32 || layout->granule_bits < 12 ||
+			layout->entry_bits < 2 || layout->entry_bits > 3 || (layout->base & ((1u << layout->granule_bits) - 1)) != 0 ||
+			layout->block_level < 0 || layout->block_level >= layout->levels){
+		fprintf(stderr, "[tlbsim] invalid stage-2 layout.\n");
+		return -1;
+	}
+
+	bits = layout->granule_bits;		// size of the blocks
+	for(k = layout->block_level; k < layout->levels && layout->block_level != 0; k++)
+		bits += layout->bits[k];
+	block_mask = (1u << bits) - 1;
+	if(layout->block_level != 0 && ((layout->block_start & block_mask) != 0 || (layout->block_end & block_mask) != 0 ||
+			(layout->block_end != 0 && layout->block_end <= layout->block_start))){
+		fprintf(stderr, "[tlbsim] invalid stage-2 block range.\n");
+		return -1;
+	}
+
+	memset(&s2, 0, sizeof(s2));
+	s2.levels = layout->levels;
+	memcpy(s2.bits, layout->bits, sizeof(int) * s2.levels);
+	s2.granule_bits = layout->granule_bits;
+	s2.entry_bits = layout->entry_bits;
+	s2.base = layout->base;
+	s2.block_level = layout->block_level;
+	s2.block_start = layout->block_start;
+	s2.block_end = layout->block_end;
+	s2_page_mask = ~((1u << s2.granule_bits) - 1);
+	s2_block_last = s2.block_end - s2.block_start - 1;		// wraps to the end of the space for a block_end of 0
+
+	end = s2.base;
+	for(k = s2.levels - 1, bits = s2.granule_bits; k >= 0; bits += s2.bits[k--])
+		s2_shift[k] = bits;
+	for(k = 0; k < s2.levels; k++){		// the tables of a level cover the whole space, from a page of the granule
+		s2_level_base[k] = end;
+		end += (uint64_t)1 << (32 - s2_shift[k] + s2.entry_bits);
+		end = (end + (1u << s2.granule_bits) - 1) & ~(uint64_t)((1u << s2.granule_bits) - 1);
+	}
+	ntlb_shift[0] = s2.granule_bits;
+	ntlb_shift[1] = s2.block_level != 0 ? s2_shift[s2.block_level - 1] : 0;
+	ntlb_sizes = s2.block_level != 0 ? 2 : 1;
+	if(end > 0x100000000ULL){
+		fprintf(stderr, "[tlbsim] stage-2 tables above 4GB.\n");
+		tlbsim_set_stage2(NULL);
+		return -1;
+	}
+
+	return 0;
+}
+
+int tlbsim_set_checkpoint(const char *dir, unsigned long long records)
+{
+	if(dir != NULL && strlen(dir) >= sizeof(ckpt_dir)){
+		fprintf(stderr, "[tlbsim] checkpoint directory %s is too long.\n", dir);
+		return -1;
+	}
+
+	strcpy(ckpt_dir, dir != NULL ? dir : "");
+	ckpt_records = dir != NULL ? records : 0;
+	return 0;
+}
+
+void tlbsim_set_checkpoint_files(void (*save)(unsigned long long sizes[SIM_CKPT_FILES], void *arg),
+		void (*restore)(const unsigned long long sizes[SIM_CKPT_FILES], void *arg), void *arg)
+{
+	files_save = save;
+	files_restore = restore;
+	files_arg = arg;
+}
+
+int tlbsim_set_warm_start(const char *file)
+{
+	if(file != NULL && strlen(file) >= sizeof(warm_file)){
+		fprintf(stderr, "[tlbsim] checkpoint %s is too long.\n", file);
+		return -1;
+	}
+
+	strcpy(warm_file, file != NULL ? file : "");
+	return 0;
+}
+
+void tlbsim_set_window(unsigned long long insns, void (*report)(const struct SIM_RESULT *result, void *arg), void *arg)
+{
+	window_insns = report != NULL ? insns : 0;
+	window_records = 0;
+	window_report = report;
+	window_arg = arg;
+}
+
+void tlbsim_set_window_records(unsigned long long records, void (*report)(const struct SIM_RESULT *result, void *arg), void *arg)
+{
+	window_records = report != NULL ? records : 0;
+	window_insns = 0;
+	window_report = report;
+	window_arg = arg;
+}
+
+int tlbsim_set_main_tlb(int size, int way, enum TLBSIM_POLICY policy)
+{
+	int i;
+
+	if(size < 0 || (size > 0 && (way <= 0 || size % way != 0 || ((size / way) & (size / way - 1)) != 0))){
+		fprintf(stderr, "[tlbsim] invalid main TLB geometry %d, %d-WAY.\n", size, way);
+		return -1;
+	}
+
+	for(i = 0; i < TLBTRACE_MAX_CPUS; i++){
+		free(main_banks[i]);
+		main_banks[i] = NULL;
+	}
+	main_size = 0;
+
+	for(i = 0; i < TLBTRACE_MAX_CPUS && size > 0; i++){
+		if((main_banks[i] = (struct TLB_ENTRY*)malloc(sizeof(struct TLB_ENTRY) * size)) == NULL){
+			fprintf(stderr, "[tlbsim] out of memory.\n");
+			return -1;
+		}
+	}
+
+	main_size = size;
+	main_step = size > 0 ? size / way : 1;
+	main_mask = main_step - 1;
+	main_policy = policy;
+
+	return 0;
+}
+
+/* Hash of a page for a row of the sketch. */
+static inline unsigned int hot_hash(uint32_t page, int row)
+{
+	static const uint32_t mul[HOT_ROWS] = {0x9E3779B1, 0x85EBCA77, 0xC2B2AE3D, 0x27D4EB2F};
+
+	return (uint32_t)((page >> 12) * mul[row]) >> (32 - HOT_BITS);
+}
+
+/* Estimated misses of a page, never less than the actual ones. */
+static unsigned long long hot_estimate(int kind, uint32_t page)
+{
+	unsigned long long est = ~0ULL;
+	int r;
+
+	for(r = 0; r < HOT_ROWS; r++)
+		if(hot_sketch[kind][r][hot_hash(page, r)] < est)	est = hot_sketch[kind][r][hot_hash(page, r)];
+
+	return est;
+}
+
+static void hot_swap(struct SIM_HOT_PAGE *a, struct SIM_HOT_PAGE *b)
+{
+	struct SIM_HOT_PAGE t = *a;
+
+	*a = *b;
+	*b = t;
+}
+
+/* Count a miss on the page of \a addr, and keep the page in the heap if it is one of the hottest. */
+static void hot_miss(int kind, uint32_t addr)
+{
+	struct SIM_HOT_PAGE *heap = hot_heap[kind];
+	uint32_t page = addr & 0xFFFFF000;
+	unsigned long long *c, est;
+	int r, i, j;
+
+	est = hot_estimate(kind, page) + 1;
+	for(r = 0; r < HOT_ROWS; r++){		// conservative update
+		c = &hot_sketch[kind][r][hot_hash(page, r)];
+		if(*c < est)	*c = est;
+	}
+	hot_total[kind]++;
+
+	if(hot_nr[kind] == hot_n && est <= heap[0].misses)	return;		// not one of the hottest
+
+	for(i = 0; i < hot_nr[kind] && heap[i].page != page; i++);
+
+	if(i == hot_nr[kind] && hot_nr[kind] < hot_n){		// new page, heap not full: sift up
+		heap[i].kind = kind;
+		heap[i].page = page;
+		heap[i].misses = est;
+		for(hot_nr[kind]++; i > 0 && heap[(i - 1) / 2].misses > heap[i].misses; i = (i - 1) / 2)
+			hot_swap(&heap[i], &heap[(i - 1) / 2]);
+		return;
+	}
+
+	if(i == hot_nr[kind]){		// new page: replace the coldest one
+		i = 0;
+		heap[i].page = page;
+	}
+	heap[i].misses = est;
+	for(;;){		// the estimate only grows: sift down
+		j = 2 * i + 1;
+		if(j >= hot_nr[kind])	break;
+		if(j + 1 < hot_nr[kind] && heap[j + 1].misses < heap[j].misses)	j++;
+		if(heap[i].misses <= heap[j].misses)	break;
+		hot_swap(&heap[i], &heap[j]);
+		i = j;
+	}
+}
+
+static int hot_cmp(const void *a, const void *b)
+{
+	const struct SIM_HOT_PAGE *x = (const struct SIM_HOT_PAGE*)a, *y = (const struct SIM_HOT_PAGE*)b;
+
+	if(x->misses != y->misses)	return x->misses < y->misses ? 1 : -1;
+	return x->page < y->page ? -1 : x->page > y->page;
+}
+
+/* Report the hottest pages of each kind, with their estimates at the end of the trace. */
+static void hot_end(void)
+{
+	struct SIM_HOT_PAGE *heap;
+	int k, i;
+
+	for(k = 0; k < SIM_HOT_KINDS; k++){
+		heap = hot_heap[k];
+		for(i = 0; i < hot_nr[k]; i++){
+			heap[i].misses = hot_estimate(k, heap[i].page);
+			heap[i].error = hot_total[k] * 2719 / (1000ULL << HOT_BITS);	// e * misses / columns
+		}
+		qsort(heap, hot_nr[k], sizeof(struct SIM_HOT_PAGE), hot_cmp);
+		for(i = 0; i < hot_nr[k]; i++)
+			hot_report(&heap[i], hot_arg);
+	}
+}
+
+/* Configuration the state of the simulation depends on. The first CKPT_GEOMETRY values are the ones of the caches. */
+static void ckpt_config(uint64_t config[CKPT_CONFIG])
+{
+	config[0] = sim_cmd;
+	config[1] = TLB_MAX_ENTRIES_NTLB;
+	config[2] = TLB_WAYSTEP_NTLB;
+	config[3] = TLB_MAX_ENTRIES_PWC;
+	config[4] = TLB_WAYSTEP_PWC;
+	config[5] = private_caches;
+	config[6] = main_size;
+	config[7] = main_step;
+	config[8] = main_policy;
+	config[9] = s2.levels;
+	config[10] = (uint64_t)s2.bits[0] | (uint64_t)s2.bits[1] << 8 | (uint64_t)s2.bits[2] << 16 | (uint64_t)s2.bits[3] << 24;
+	config[11] = s2.granule_bits;
+	config[12] = s2.entry_bits;
+	config[13] = s2.base;
+	config[14] = s2.block_level;
+	config[15] = (uint64_t)s2.block_start | (uint64_t)s2.block_end << 32;
+	config[16] = window_insns;
+	config[17] = window_records;
+	config[18] = hot_n;
+	config[19] = profile_report != NULL;
+	config[20] = region_report != NULL;
+}
+
+static void ckpt_io(void *p, size_t n, int save)
+{
+	if(ckpt_err || n == 0)	return;
+	if(save)	ckpt_err = fwrite(p, 1, n, ckpt_f) != n;
+	else		ckpt_err = fread(p, 1, n, ckpt_f) != n;
+}
+
+/* Save or load the state of the simulation, both in the same order. Only the caches are loaded for a warm start. */
+static void ckpt_state(int save, int warm)
+{
+	struct MAP_TABLE *t;
+	unsigned int n;
+	int i;
+
+	ckpt_io(&systs, sizeof(systs), save);
+	ckpt_io(ntlb_banks, sizeof(ntlb_banks), save);
+	ckpt_io(ntlb2_banks, sizeof(ntlb2_banks), save);
+	ckpt_io(pwc_banks, sizeof(pwc_banks), save);
+	ckpt_io(pwc2_banks, sizeof(pwc2_banks), save);
+	ckpt_io(pwc3_banks, sizeof(pwc3_banks), save);
+	for(i = 0; i < TLBTRACE_MAX_CPUS && main_size != 0; i++)
+		ckpt_io(main_banks[i], sizeof(struct TLB_ENTRY) * main_size, save);
+	ckpt_io(&main_ts, sizeof(main_ts), save);
+	ckpt_io(&main_seed, sizeof(main_seed), save);
+	if(warm)	return;
+
+	ckpt_io(&ntlb_cnt, sizeof(ntlb_cnt), save);
+	ckpt_io(&ntlb2_cnt, sizeof(ntlb2_cnt), save);
+	ckpt_io(&pwc_cnt, sizeof(pwc_cnt), save);
+	ckpt_io(&pwc2_cnt, sizeof(pwc2_cnt), save);
+	ckpt_io(&pwc3_cnt, sizeof(pwc3_cnt), save);
+	ckpt_io(&main_cnt, sizeof(main_cnt), save);
+	ckpt_io(&ntlb2_mem_accs, sizeof(ntlb2_mem_accs), save);
+	ckpt_io(&pwc2_mem_accs, sizeof(pwc2_mem_accs), save);
+	ckpt_io(&pwc3_mem_accs, sizeof(pwc3_mem_accs), save);
+	ckpt_io(&full_mem_accs, sizeof(full_mem_accs), save);
+
+	ckpt_io(dedup, sizeof(dedup_table), save);
+	ckpt_io(refs, sizeof(refs), save);
+	ckpt_io(&refs_n, sizeof(refs_n), save);
+	ckpt_io(&refs_i, sizeof(refs_i), save);
+
+	ckpt_io(&sim_insns, sizeof(sim_insns), save);
+	ckpt_io(&sim_records, sizeof(sim_records), save);
+	ckpt_io(&window_end, sizeof(window_end), save);
+	ckpt_io(&window_left, sizeof(window_left), save);
+	ckpt_io(&window_last, sizeof(window_last), save);
+
+	ckpt_io(&sim_priv, sizeof(sim_priv), save);
+	ckpt_io(&priv_base, sizeof(priv_base), save);
+	ckpt_io(priv_res, sizeof(priv_res), save);
+
+	ckpt_io(steps, sizeof(steps), save);
+	ckpt_io(levels, sizeof(levels), save);
+	ckpt_io(refs_hist, sizeof(refs_hist), save);
+	ckpt_io(accs_hist, sizeof(accs_hist), save);
+
+	ckpt_io(sim_pc, sizeof(sim_pc), save);
+	ckpt_io(sim_pc_asid, sizeof(sim_pc_asid), save);
+	ckpt_io(&cost_last, sizeof(cost_last), save);
+	n = pc_size;
+	ckpt_io(&n, sizeof(n), save);
+	ckpt_io(&pc_used, sizeof(pc_used), save);
+	if(!save && !ckpt_err && n != pc_size){
+		free(pc_slots);
+		pc_size = n;
+		if((pc_slots = (struct PC_SLOT*)calloc(pc_size, sizeof(struct PC_SLOT))) == NULL && pc_size != 0){
+			fprintf(stderr, "[tlbsim] out of memory.\n");
+			exit(1);
+		}
+	}
+	ckpt_io(pc_slots, sizeof(struct PC_SLOT) * pc_size, save);
+	memset(pc_cur, 0, sizeof(pc_cur));		// looked up again
+
+	ckpt_io(sim_asid, sizeof(sim_asid), save);
+	for(i = 0; i <= MAP_ANY_ASID; i++){
+		t = &map_tables[i];
+		n = t->n;
+		ckpt_io(&n, sizeof(n), save);
+		if(!save && !ckpt_err){
+			t->n = 0;
+			if((int)n > t->size){
+				t->size = n;
+				if((t->maps = (struct SIM_MAP*)realloc(t->maps, sizeof(struct SIM_MAP) * t->size)) == NULL){
+					fprintf(stderr, "[tlbsim] out of memory.\n");
+					exit(1);
+				}
+			}
+			t->n = n;
+		}
+		ckpt_io(t->maps, sizeof(struct SIM_MAP) * t->n, save);
+	}
+	n = region_nr;
+	ckpt_io(&n, sizeof(n), save);
+	if(!save && !ckpt_err){
+		region_nr = 0;
+		if(n != 0)	region_slot(n - 1);
+	}
+	ckpt_io(regions, sizeof(struct REGION) * region_nr, save);
+	for(i = 0; i < region_nr; i++)
+		regions[i].cost.name = regions[i].name;
+
+	if(hot_n != 0)	ckpt_io(hot_sketch, sizeof(hot_sketch), save);
+	ckpt_io(hot_total, sizeof(hot_total), save);
+	ckpt_io(hot_heap, sizeof(hot_heap), save);
+	ckpt_io(hot_nr, sizeof(hot_nr), save);
+}
 
-#define FLUSH_TLB(tlb, size)		do{ \
-	int _idx_; \
-	for(_idx_ = 0; _idx_ < size; _idx_++){\
-		tlb[_idx_].va = 0xFFFFFFFF; \
-		tlb[_idx_].asid = 0; \
-		tlb[_idx_].ts = 0; \
-	} \
-}while(0)
+static const char *base_name(const char *path)
+{
+	const char *p = strrchr(path, '/');
 
-#define INIT_TLB(tlb, size, cnt)		do{ \
-	FLUSH_TLB(tlb, size);	\
-	cnt.miss = cnt.hit = 0; \
-}while(0)
+	return p != NULL ? p + 1 : path;
+}
 
-struct TLB_COUNTER ntlb_cnt;
-struct TLB_COUNTER ntlb2_cnt;
-struct TLB_COUNTER pwc_cnt;
-struct TLB_COUNTER pwc2_cnt;
-struct TLB_COUNTER pwc3_cnt;
+/* Write the state of the simulation of a trace to its checkpoint, replacing the last one only once it is complete. */
+static void ckpt_save(const char *trace_name)
+{
+	struct CKPT_HEADER h;
+	char path[1024], tmp[1040];
 
-unsigned long long ntlb2_mem_accs;
-unsigned long long pwc2_mem_accs;
-unsigned long long pwc3_mem_accs;
-unsigned long long full_mem_accs;
+	snprintf(path, sizeof(path), "%s/%s.ckpt", ckpt_dir, base_name(trace_name));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if((ckpt_f = fopen(tmp, "wb")) == NULL){
+		fprintf(stderr, "[tlbsim] can't write %s.\n", tmp);
+		return;
+	}
 
-static FILE *fin;
-static char trace_files[MAX_TRACE_FILES][512];
-static int trace_count;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, ckpt_magic, sizeof(h.magic));
+	h.version = CKPT_VERSION;
+	ckpt_config(h.config);
+	strncpy(h.trace, base_name(trace_name), sizeof(h.trace) - 1);
+	h.offset = ftello(fin);
+	h.records = sim_records;
+	if(files_save != NULL){		// the reports written so far reach the files before a kill can drop them
+		unsigned long long sizes[SIM_CKPT_FILES];
+
+		memset(sizes, 0, sizeof(sizes));
+		files_save(sizes, files_arg);
+		memcpy(h.files, sizes, sizeof(h.files));
+	}
 
-static void flush_all()
+	ckpt_err = 0;
+	ckpt_io(&h, sizeof(h), 1);
+	ckpt_state(1, 0);
+	if(fclose(ckpt_f) != 0)	ckpt_err = 1;
+
+	if(ckpt_err || rename(tmp, path) != 0){
+		fprintf(stderr, "[tlbsim] can't write %s.\n", path);
+		remove(tmp);
+	}
+}
+
+/* Load a checkpoint: the whole state of the simulation of the same trace, which then continues at the offset of the checkpoint,
+   or only the caches for a warm start.
+   @return 0 on success, -1 if there is no usable checkpoint, and the simulation starts from the beginning. */
+static int ckpt_load(const char *path, const char *trace_name, int warm)
 {
-	systs = 0;
-	full_mem_accs = pwc3_mem_accs = pwc2_mem_accs = ntlb2_mem_accs = 0;
+	struct CKPT_HEADER h;
+	uint64_t config[CKPT_CONFIG];
 
-	INIT_TLB(ntlb_tlb, CACHE_MAX_ENTRIES, ntlb_cnt);
-	INIT_TLB(ntlb2_tlb, CACHE_MAX_ENTRIES, ntlb2_cnt);
-	INIT_TLB(pwc_tlb, CACHE_MAX_ENTRIES, pwc_cnt);
-	INIT_TLB(pwc2_tlb, CACHE_MAX_ENTRIES, pwc2_cnt);
-	INIT_TLB(pwc3_tlb, CACHE_MAX_ENTRIES, pwc3_cnt);
+	if((ckpt_f = fopen(path, "rb")) == NULL){
+		if(warm)	fprintf(stderr, "[tlbsim] can't open %s.\n", path);
+		return -1;
+	}
+
+	ckpt_err = 0;
+	ckpt_io(&h, sizeof(h), 0);
+	ckpt_config(config);
+	if(ckpt_err || memcmp(h.magic, ckpt_magic, sizeof(h.magic)) != 0 || h.version != CKPT_VERSION){
+		fprintf(stderr, "[tlbsim] %s is not a checkpoint of this version, ignored.\n", path);
+		fclose(ckpt_f);
+		return -1;
+	}
+	if(memcmp(config, h.config, sizeof(uint64_t) * (warm ? CKPT_GEOMETRY : CKPT_CONFIG)) != 0){
+		fprintf(stderr, "[tlbsim] %s was taken with another configuration, ignored.\n", path);
+		fclose(ckpt_f);
+		return -1;
+	}
+	if(!warm && (strncmp(h.trace, base_name(trace_name), sizeof(h.trace)) != 0 || fseeko(fin, h.offset, SEEK_SET) != 0)){
+		fprintf(stderr, "[tlbsim] %s was taken on another trace, ignored.\n", path);
+		fclose(ckpt_f);
+		return -1;
+	}
+
+	ckpt_state(0, warm);
+	fclose(ckpt_f);
+
+	if(ckpt_err){
+		fprintf(stderr, "[tlbsim] %s is truncated, ignored.\n", path);
+		flush_all();
+		if(!warm)	fseeko(fin, 0, SEEK_SET);
+		return -1;
+	}
+
+	if(!warm && files_pending)	memcpy(files_sizes, h.files, sizeof(files_sizes));	// the reports of the last checkpoint loaded are kept
+	if(warm)	fprintf(stderr, "[tlbsim] %s starts with the caches of %s.\n", base_name(trace_name), path);
+	else		fprintf(stderr, "[tlbsim] %s resumes at record %llu.\n", base_name(trace_name), (unsigned long long)h.records);
+	return 0;
 }
 
-static int tlbtrace_ntlb_find2(unsigned int addr, int final)
+/* Host physical address of the descriptor of level \a k which translates \a gpa: the tables of a level follow each other,
+   so the index of the descriptor in the level is all the bits of \a gpa above the shift of the level. */
+static inline uint32_t s2_desc(int k, uint32_t gpa)
 {
-	int i, mi = 0;
-	unsigned int mts = ntlb2_tlb[0].ts;
+	return s2_level_base[k] + ((gpa >> s2_shift[k]) << s2.entry_bits);
+}
 
-	if(!final)	ntlb2_mem_accs++;	// access EPT desc content
+/* Levels of the stage-2 walk of \a gpa, which end at the block level for the addresses mapped by blocks. */
+static inline int s2_levels(uint32_t gpa)
+{
+	return (s2.block_level != 0 && gpa - s2.block_start <= s2_block_last) ? s2.block_level : s2.levels;
+}
 
-	for(i = ((addr >> 12) & TLB_WAYMASK_NTLB) ;i<TLB_MAX_ENTRIES_NTLB;i+=TLB_WAYSTEP_NTLB){
-		if(ntlb2_tlb[i].va == addr){			// hit
-			ntlb2_tlb[i].ts = ++systs;
-			ntlb2_cnt.hit++;
-			return 1;
-		}
+/* Look \a gpa up in an NTLB holding pages of the granule and blocks: the set of each size is probed, as the size of
+   the mapping is not known before the lookup. On a miss, the mapping of a walk of \a levels levels replaces the least
+   recently used entry of its set, and its address is returned in \a page. */
+static inline int ntlb_lookup(struct TLB_ENTRY *tlb, uint32_t gpa, int levels, uint32_t *page)
+{
+	unsigned int shift = s2_shift[levels - 1], mts;
+	uint32_t tag;
+	int i, k, mi = (gpa >> shift) & TLB_WAYMASK_NTLB;		// the victim is in the set of the size of the mapping
+
+	mts = tlb[mi].ts;
+
+	for(k = 0; k < ntlb_sizes; k++){
+		tag = gpa & ~((1u << ntlb_shift[k]) - 1);
+		for(i = ((gpa >> ntlb_shift[k]) & TLB_WAYMASK_NTLB); i < TLB_MAX_ENTRIES_NTLB; i += TLB_WAYSTEP_NTLB){
+			if(tlb[i].va == tag && tlb[i].shift == ntlb_shift[k] && tlb[i].asid == vm_tag){		// hit
+				tlb[i].ts = ++systs;
+				return 1;
+			}
 
-		if(ntlb2_tlb[i].ts < mts){
-			mts = ntlb2_tlb[i].ts;
-			mi = i;
+			if(ntlb_shift[k] == shift && tlb[i].ts < mts){
+				mts = tlb[i].ts;
+				mi = i;
+			}
 		}
 	}
 
-	ntlb2_mem_accs+=2;	// access EPTL2 + EPTL1
+	*page = gpa & ~((1u << shift) - 1);
+	vm_evict(&tlb[mi]);
+	tlb[mi].va = *page;
+	tlb[mi].asid = vm_tag;
+	tlb[mi].shift = shift;
+	tlb[mi].ts = ++systs;
+	return 0;
+}
+
+/* Count an NTLB lookup made for a step of the walk. */
+static inline int step_ntlb(int step, int hit)
+{
+	if(hit){
+		steps[step].ntlb.hit++;
+		walk_cnt.ntlb.hit++;
+	}else{
+		steps[step].ntlb.miss++;
+		walk_cnt.ntlb.miss++;
+	}
+	return hit;
+}
+
+/* Count a PWC lookup made for a step of the walk. */
+static inline int step_pwc(int step, int hit)
+{
+	if(hit){
+		steps[step].pwc.hit++;
+		walk_cnt.pwc.hit++;
+	}else{
+		steps[step].pwc.miss++;
+		walk_cnt.pwc.miss++;
+	}
+	return hit;
+}
+
+/* Count a memory access of a step of the walk in \a accs, the counter of the model. */
+static inline void step_acc(int step, unsigned long long *accs)
+{
+	(*accs)++;
+	steps[step].accs++;
+	walk_cnt.accs++;
+}
+
+static inline int hist_bin(unsigned long long n)
+{
+	return n < SIM_HIST_BINS ? n : SIM_HIST_BINS - 1;
+}
+
+/* Add the lookups and accesses of the record just simulated to its traversal result. */
+static void end_walk(int ret)
+{
+	struct SIM_LEVEL_RESULT *l = &levels[ret <= SIM_LEVELS ? ret - 1 : SIM_LEVELS - 1];
+
+	l->walks++;
+	l->ntlb.hit += walk_cnt.ntlb.hit;
+	l->ntlb.miss += walk_cnt.ntlb.miss;
+	l->pwc.hit += walk_cnt.pwc.hit;
+	l->pwc.miss += walk_cnt.pwc.miss;
+	l->accs += walk_cnt.accs;
+	refs_hist[hist_bin(walk_cnt.ntlb.hit + walk_cnt.ntlb.miss + walk_cnt.pwc.hit + walk_cnt.pwc.miss)]++;
+	accs_hist[hist_bin(walk_cnt.accs)]++;
+
+	memset(&walk_cnt, 0, sizeof(walk_cnt));
+}
+
+/* Look up the NTLB of the NTLB-only model for a step of the walk. */
+static int tlbtrace_ntlb_find2(unsigned int addr, int step)
+{
+	int i, levels = s2_levels(addr);
+	uint32_t page;
+
+	if(step != SIM_STEP_GPA)	step_acc(step, &ntlb2_mem_accs);	// access EPT desc content
+
+	if(ntlb_lookup(ntlb2_tlb, addr, levels, &page)){		// hit
+		ntlb2_cnt.hit++;
+		return 1;
+	}
+
+	for(i = 0; i < levels; i++)		// access EPTL1 .. EPTLn
+		step_acc(SIM_STEP_EPTL1 + i, &ntlb2_mem_accs);
 
-	ntlb2_tlb[mi].va = addr;
-	ntlb2_tlb[mi].ts = ++systs;
 	ntlb2_cnt.miss++;
+	if(hot_n != 0)	hot_miss(step == SIM_STEP_GPA ? SIM_HOT_PAGE : SIM_HOT_PT, page);
 	
 	return 0;
 }
 
-static void emulate_ntlb2(int level, uint32_t l1_gpa, uint32_t l2_gpa, uint32_t gpa)
+static void emulate_ntlb2(uint32_t walk, uint32_t l1_gpa, uint32_t l2_gpa, uint32_t gpa)
 {
-	tlbtrace_ntlb_find2(l1_gpa & 0xFFFFF000, 0);	// mem_accs = hit * 1 + miss * 3
+	int level = walk & TLBTRACE_RET_MASK;
+
+	step_ntlb(SIM_STEP_PTL1, tlbtrace_ntlb_find2(l1_gpa & s2_page_mask, SIM_STEP_PTL1));	// mem_accs = hit * 1 + miss * (1 + levels)
 
 	if(level > 1){
-		tlbtrace_ntlb_find2(l2_gpa & 0xFFFFF000, 0);
+		step_ntlb(SIM_STEP_PTL2, tlbtrace_ntlb_find2(l2_gpa & s2_page_mask, SIM_STEP_PTL2));
 	}
 
-	if(level > 2){
-		tlbtrace_ntlb_find2(gpa, 1);	// mem_accs = hit * 0 + miss * 2
+	if(level > 2 || WALK_SECTION(walk)){
+		step_ntlb(SIM_STEP_GPA, tlbtrace_ntlb_find2(gpa & s2_page_mask, SIM_STEP_GPA));	// mem_accs = hit * 0 + miss * levels
 	}
 }
 
-void tlbsim_sim_ntlb(const char* trace_name, int ntlb_size, int ntlb_way,
-		int pwc_size __attribute__((unused)), int pwc_way __attribute((unused)), struct SIM_RESULT *result)
+/* Simulate a record read by next_record(). */
+static inline void sim_record(void (*emulate)(uint32_t walk, uint32_t l1_gpa, uint32_t l2_gpa, uint32_t gpa), const uint32_t t[4])
+{
+	emulate(t[0] & (TLBTRACE_RET_MASK | TLBTRACE_SIZE_MASK), t[1], t[2], t[3]);
+	end_walk(t[0] & TLBTRACE_RET_MASK);
+	if(profile_report != NULL || region_report != NULL)	record_cost(t[0]);
+
+	sim_records++;
+	if(--window_left == 0){		// the only cost of record windows per record
+		end_window();
+		window_left = window_records;
+	}
+}
+
+/* Report the last window and the other reports of the simulation, and put its counters and breakdowns in \a result. */
+static void end_sim(struct SIM_RESULT *result)
+{
+	int i;
+
+	if((window_insns != 0 || window_records != 0) && !ckpt_ended)	end_window();
+	if(profile_report != NULL && !ckpt_ended)	profile_end();
+	if(region_report != NULL)	region_end();
+	if(hot_n != 0)	hot_end();
+	account_priv();
+	fill_result(result);
+	result->records = sim_records;
+	for(i = 0; i < 2; i++){
+		result->priv[i].accs = priv_res[i].accs;
+		result->priv[i].ntlb = priv_res[i].ntlb;
+		result->priv[i].pwc = priv_res[i].pwc;
+		result->priv[i].tlb = priv_res[i].tlb;
+	}
+	memcpy(result->step, steps, sizeof(result->step));
+	memcpy(result->level, levels, sizeof(result->level));
+	memcpy(result->refs_hist, refs_hist, sizeof(result->refs_hist));
+	memcpy(result->accs_hist, accs_hist, sizeof(result->accs_hist));
+}
+
+/* Truncate the report files to the sizes of the last checkpoint loaded, before the first report of the simulation,
+   dropping the reports an interrupted job wrote after it; the files are started again if no checkpoint was loaded. */
+static void files_sync(void)
+{
+	if(files_pending && files_restore != NULL)	files_restore(files_sizes, files_arg);
+	files_pending = 0;
+}
+
+/* Whether the simulation of the trace is at its end, without reading a record. */
+static int trace_at_end(void)
+{
+	int c;
+
+	if(refs_i < refs_n)	return 0;
+	if((c = getc(fin)) == EOF)	return 1;
+	ungetc(c, fin);
+	return 0;
+}
+
+/* Simulate a trace, and report its last window. */
+static void run_trace(const char *trace_name, enum SIM_CMD cmd, void (*emulate)(uint32_t walk, uint32_t l1_gpa, uint32_t l2_gpa, uint32_t gpa),
+		void (*fill)(struct SIM_RESULT *result), struct SIM_RESULT *result)
 {
 	uint32_t t[4];
+	char path[1024];
+	int resumed = 0;
 
-	TLB_MAX_ENTRIES_NTLB = ntlb_size;
-	TLB_WAYSTEP_NTLB = ntlb_size / ntlb_way;
-	TLB_WAYMASK_NTLB = TLB_WAYSTEP_NTLB - 1;
+	fill_result = fill;
+	sim_cmd = cmd;
+	window_trace = base_name(trace_name);
 
-	fin = fopen(trace_name, "r");
+	flush_all();
+	if(ckpt_dir[0] != '\0'){
+		snprintf(path, sizeof(path), "%s/%s.ckpt", ckpt_dir, base_name(trace_name));
+		resumed = ckpt_load(path, trace_name, 0) == 0;
+	}
+	if(!resumed && warm_file[0] != '\0')	ckpt_load(warm_file, trace_name, 1);
+	ckpt_left = ckpt_records != 0 ? ckpt_records : ~0ULL;
+
+	// a trace resumed at its end reports nothing, and leaves the files to the traces after it
+	ckpt_ended = resumed && trace_at_end();
+	if(!ckpt_ended)	files_sync();
+
+	while(next_record(t)){
+		sim_record(emulate, t);
+		if(--ckpt_left == 0){
+			ckpt_save(trace_name);
+			ckpt_left = ckpt_records;
+		}
+	}
+
+	end_sim(result);
+
+	// to continue with warm caches, or skip the trace and its last reports when restarted
+	if(ckpt_dir[0] != '\0' && !ckpt_ended)	ckpt_save(trace_name);
+	ckpt_ended = 0;
+}
+
+/* Add the counters since the running VM was scheduled to its result. */
+static void account_vm(void)
+{
+	struct SIM_RESULT cur;
+
+	memset(&cur, 0, sizeof(cur));
+	fill_result(&cur);
+	cur.records = sim_records;
+	result_add_delta(vm_out[vm_cur], &cur, &vm_base);
+
+	vm_base = cur;
+}
+
+/* Flush a cache on a switch, counting its entries as evicted from the VM leaving. */
+static void vm_flush(struct TLB_ENTRY *tlb, int size)
+{
+	int i;
+
+	for(i = 0; i < size; i++)
+		if(tlb[i].va != 0xFFFFFFFF)	vm_evicted[vm_cur]++;
+	FLUSH_TLB(tlb, size);
+}
+
+/* Switch from the running VM to VM \a next: save the state of the reader of the one, and load the one of the other. */
+static void vm_schedule(int next)
+{
+	struct VM_READER *v = &vm_readers[vm_cur];
+	int i;
+
+	account_vm();
+	v->fin = fin;
+	memcpy(v->refs, refs, sizeof(refs));
+	v->refs_n = refs_n;
+	v->refs_i = refs_i;
+	memcpy(v->asid, sim_asid, sizeof(sim_asid));
+
+	if(vm_switch == TS_FLUSH && next != vm_cur){
+		for(i = 0; i < TLBTRACE_MAX_CPUS; i++){
+			vm_flush(ntlb_banks[i], CACHE_MAX_ENTRIES);
+			vm_flush(ntlb2_banks[i], CACHE_MAX_ENTRIES);
+			vm_flush(pwc_banks[i], CACHE_MAX_ENTRIES);
+			vm_flush(pwc2_banks[i], CACHE_MAX_ENTRIES);
+			vm_flush(pwc3_banks[i], CACHE_MAX_ENTRIES);
+		}
+		for(i = 0; i < TLBTRACE_MAX_CPUS && main_size != 0; i++)
+			vm_flush(main_banks[i], main_size);
+	}
+
+	v = &vm_readers[next];
+	fin = v->fin;
+	dedup = v->dedup;
+	memcpy(refs, v->refs, sizeof(refs));
+	refs_n = v->refs_n;
+	refs_i = v->refs_i;
+	memcpy(sim_asid, v->asid, sizeof(sim_asid));
+
+	vm_cur = next;
+	vm_tag = (unsigned int)next << VM_SHIFT;
+	vm_quanta[next]++;
+	vm_left = vm_quantum;
+}
+
+/* Simulate \a n traces interleaved on the same caches, one VM each, and put the counters of each VM in \a out. */
+static int run_vms(char traces[][512], int n, void (*emulate)(uint32_t walk, uint32_t l1_gpa, uint32_t l2_gpa, uint32_t gpa),
+		void (*fill)(struct SIM_RESULT *result), struct SIM_RESULT **out, struct SIM_RESULT *total)
+{
+	uint32_t t[4];
+	int i, live, next = 0, err = 0;
 
+	fill_result = fill;
+	window_trace = NULL;
 	flush_all();
-	while(fread(t, sizeof(uint32_t), 4, fin) == 4){
-		emulate_ntlb2(t[0] & 0xF, t[1], t[2], t[3]);
+	memset(&vm_base, 0, sizeof(vm_base));
+	memset(vm_quanta, 0, sizeof(vm_quanta));
+	memset(vm_evicted, 0, sizeof(vm_evicted));
+
+	memset(vm_readers, 0, sizeof(vm_readers));
+	for(i = 0; i < n; i++){
+		vm_out[i] = out[i];
+		vm_readers[i].fin = fopen(traces[i], "r");
+		vm_readers[i].dedup = (struct PAGE_DEDUP*)calloc(1, sizeof(dedup_table));
+		memcpy(vm_readers[i].asid, sim_asid, sizeof(sim_asid));
+		if(vm_readers[i].fin == NULL || vm_readers[i].dedup == NULL){
+			fprintf(stderr, "[tlbsim] can't open %s.\n", traces[i]);
+			err = -1;
+		}
+	}
+
+	if(err == 0){
+		vm_n = n;
+		vm_cur = 0;
+		fin = vm_readers[0].fin;
+		vm_schedule(0);
+		for(live = n; live > 0; ){
+			if(!next_record(t)){
+				vm_readers[vm_cur].done = 1;
+				live--;
+				vm_left = 0;
+			}else{
+				sim_record(emulate, t);
+				if(--vm_left != 0)	continue;
+			}
+
+			for(i = 1; i <= n; i++){		// round robin over the VMs which are not done
+				next = (vm_cur + i) % n;
+				if(!vm_readers[next].done)	break;
+			}
+			if(live > 0)	vm_schedule(next);
+		}
+		account_vm();
+		end_sim(total);
+	}
+
+	for(i = 0; i < n; i++){
+		if(vm_readers[i].fin != NULL)	fclose(vm_readers[i].fin);
+		free(vm_readers[i].dedup);
 	}
+	fin = NULL;
+	dedup = dedup_table;
+	vm_n = vm_cur = 0;
+	vm_tag = 0;
+	return err;
+}
 
+static void result_ntlb(struct SIM_RESULT *result)
+{
 	result->accs = ntlb2_mem_accs;
 	result->ntlb = ntlb2_cnt;
+	result->tlb = main_cnt;
+	result->insns = sim_insns;
+}
+
+void tlbsim_sim_ntlb(const char* trace_name, int ntlb_size, int ntlb_way,
+		int pwc_size __attribute__((unused)), int pwc_way __attribute((unused)), struct SIM_RESULT *result)
+{
+	TLB_MAX_ENTRIES_NTLB = ntlb_size;
+	TLB_WAYSTEP_NTLB = ntlb_size / ntlb_way;
+	TLB_WAYMASK_NTLB = TLB_WAYSTEP_NTLB - 1;
+
+	fin = fopen(trace_name, "r");
+
+	run_trace(trace_name, SC_NTLB, emulate_ntlb2, result_ntlb, result);
 
 	fclose(fin);
 }
 
 static int tlbtrace_refppa_pwc2(unsigned int addr, unsigned int asid)
 {
-	int i, mi = 0;
-	unsigned int mts = pwc2_tlb[0].ts;
+	int i, mi = (addr >> 2) & TLB_WAYMASK_PWC;			// the victim is in the set of the descriptor
+	unsigned int mts = pwc2_tlb[mi].ts, tag = asid | vm_tag;
 
-	for(i = ((addr >> 2) & TLB_WAYMASK_PWC) ;i<TLB_MAX_ENTRIES_PWC;i+=TLB_WAYSTEP_PWC){
-		if(pwc2_tlb[i].va == addr && pwc2_tlb[i].asid == asid){			// hit
+	for(i = mi ;i<TLB_MAX_ENTRIES_PWC;i+=TLB_WAYSTEP_PWC){
+		if(pwc2_tlb[i].va == addr && pwc2_tlb[i].asid == tag){			// hit
 			pwc2_tlb[i].ts = ++systs;
 			pwc2_cnt.hit++;
 			return 1;
@@ -165,73 +1749,76 @@ static int tlbtrace_refppa_pwc2(unsigned int addr, unsigned int asid)
 		}
 	}
 
+	vm_evict(&pwc2_tlb[mi]);
 	pwc2_tlb[mi].va = addr;
 	pwc2_tlb[mi].ts = ++systs;
-	pwc2_tlb[mi].asid = asid;
+	pwc2_tlb[mi].asid = tag;
 	pwc2_cnt.miss++;
+	if(hot_n != 0)	hot_miss(asid != 0 ? SIM_HOT_PT : SIM_HOT_EPT, addr);
 
 	return 0;
 }
 
-static void emulate_pwc2(int level, uint32_t l1_gpa, uint32_t l2_gpa, uint32_t gpa)
+/* Translate a guest physical address with the EPT descriptors cached in the PWC. */
+static void ept_pwc2(uint32_t gpa)
+{
+	int k, levels = s2_levels(gpa);
+
+	for(k = 0; k < levels; k++){
+		if(step_pwc(SIM_STEP_EPTL1 + k, tlbtrace_refppa_pwc2(s2_desc(k, gpa), 0)) == 0)	step_acc(SIM_STEP_EPTL1 + k, &pwc2_mem_accs);
+	}
+}
+
+static void emulate_pwc2(uint32_t walk, uint32_t l1_gpa, uint32_t l2_gpa, uint32_t gpa)
 {
-	uint32_t l1_mpa, l2_mpa;
+	int level = walk & TLBTRACE_RET_MASK;
 
-	if(tlbtrace_refppa_pwc2(l1_gpa, 1) == 0){		// hit * 0 + miss * 3
-		l1_mpa = (l1_gpa >> 20) * 4;
-		l2_mpa = 16 * 1024 + (l1_gpa >> 20) * 1024 + ((l1_gpa >> 12) & 0xFF) * 4;
-		if(tlbtrace_refppa_pwc2(l1_mpa, 0) == 0)	pwc2_mem_accs++;
-		if(tlbtrace_refppa_pwc2(l2_mpa, 0) == 0)	pwc2_mem_accs++;
-		pwc2_mem_accs++;
+	if(step_pwc(SIM_STEP_PTL1, tlbtrace_refppa_pwc2(l1_gpa, 1)) == 0){		// hit * 0 + miss * 3
+		ept_pwc2(l1_gpa);
+		step_acc(SIM_STEP_PTL1, &pwc2_mem_accs);
 	}
 
 	if(level > 1){
-		if(tlbtrace_refppa_pwc2(l2_gpa, 1) == 0){		// hit * 0 + miss * 3
-			l1_mpa = (l2_gpa >> 20) * 4;
-			l2_mpa = 16 * 1024 + (l2_gpa >> 20) * 1024 + ((l2_gpa >> 12) & 0xFF) * 4;
-			if(tlbtrace_refppa_pwc2(l1_mpa, 0) == 0)	pwc2_mem_accs++;
-			if(tlbtrace_refppa_pwc2(l2_mpa, 0) == 0)	pwc2_mem_accs++;
-			pwc2_mem_accs++;
+		if(step_pwc(SIM_STEP_PTL2, tlbtrace_refppa_pwc2(l2_gpa, 1)) == 0){		// hit * 0 + miss * 3
+			ept_pwc2(l2_gpa);
+			step_acc(SIM_STEP_PTL2, &pwc2_mem_accs);
 		}
 	}
 
-	if(level > 2){
-		l1_mpa = (gpa >> 20) * 4;
-		l2_mpa = 16 * 1024 + (gpa >> 20) * 1024 + ((gpa >> 12) & 0xFF) * 4;
-		if(tlbtrace_refppa_pwc2(l1_mpa, 0) == 0)	pwc2_mem_accs++;
-		if(tlbtrace_refppa_pwc2(l2_mpa, 0) == 0)	pwc2_mem_accs++;
+	if(level > 2 || WALK_SECTION(walk)){
+		ept_pwc2(gpa);
 	}
 }
 
+static void result_pwc_ept(struct SIM_RESULT *result)
+{
+	result->accs = pwc2_mem_accs;
+	result->pwc = pwc2_cnt;
+	result->tlb = main_cnt;
+	result->insns = sim_insns;
+}
+
 void tlbsim_sim_pwc_ept(const char* trace_name, int ntlb_size __attribute__((unused)), int ntlb_way __attribute__((unused)),
 		int pwc_size, int pwc_way, struct SIM_RESULT *result)
 {
-	uint32_t t[4];
-
 	TLB_MAX_ENTRIES_PWC = pwc_size;
 	TLB_WAYSTEP_PWC = pwc_size / pwc_way;
 	TLB_WAYMASK_PWC = TLB_WAYSTEP_PWC - 1;
 
 	fin = fopen(trace_name, "r");
 
-	flush_all();
-	while(fread(t, sizeof(uint32_t), 4, fin) == 4){
-		emulate_pwc2(t[0] & 0xF, t[1], t[2], t[3]);
-	}
-
-	result->accs = pwc2_mem_accs;
-	result->pwc = pwc2_cnt;
+	run_trace(trace_name, SC_PWC_EPT, emulate_pwc2, result_pwc_ept, result);
 
 	fclose(fin);
 }
 
 static int tlbtrace_refppa_pwc3(unsigned int addr, unsigned int asid)
 {
-	int i, mi = 0;
-	unsigned int mts = pwc3_tlb[0].ts;
+	int i, mi = (addr >> 2) & TLB_WAYMASK_PWC;			// the victim is in the set of the descriptor
+	unsigned int mts = pwc3_tlb[mi].ts, tag = asid | vm_tag;
 
-	for(i = ((addr >> 2) & TLB_WAYMASK_PWC) ;i<TLB_MAX_ENTRIES_PWC;i+=TLB_WAYSTEP_PWC){
-		if(pwc3_tlb[i].va == addr && pwc3_tlb[i].asid == asid){			// hit
+	for(i = mi ;i<TLB_MAX_ENTRIES_PWC;i+=TLB_WAYSTEP_PWC){
+		if(pwc3_tlb[i].va == addr && pwc3_tlb[i].asid == tag){			// hit
 			pwc3_tlb[i].ts = ++systs;
 			pwc3_cnt.hit++;
 			return 1;
@@ -243,70 +1830,64 @@ static int tlbtrace_refppa_pwc3(unsigned int addr, unsigned int asid)
 		}
 	}
 
+	vm_evict(&pwc3_tlb[mi]);
 	pwc3_tlb[mi].va = addr;
 	pwc3_tlb[mi].ts = ++systs;
-	pwc3_tlb[mi].asid = asid;
+	pwc3_tlb[mi].asid = tag;
 	pwc3_cnt.miss++;
+	if(hot_n != 0)	hot_miss(asid != 0 ? SIM_HOT_PT : SIM_HOT_EPT, addr);
 
 	return 0;
 }
 
-static void emulate_pwc3(int level, uint32_t l1_gpa, uint32_t l2_gpa, uint32_t gpa __attribute__((__unused__)))
+static void emulate_pwc3(uint32_t walk, uint32_t l1_gpa, uint32_t l2_gpa, uint32_t gpa __attribute__((__unused__)))
 {
-	if(tlbtrace_refppa_pwc3(l1_gpa, 1) == 0){		// hit * 0 + miss * 3
-		pwc3_mem_accs++;
+	int level = walk & TLBTRACE_RET_MASK;
+
+	if(step_pwc(SIM_STEP_PTL1, tlbtrace_refppa_pwc3(l1_gpa, 1)) == 0){		// hit * 0 + miss * 3
+		step_acc(SIM_STEP_PTL1, &pwc3_mem_accs);
 	}
 
 	if(level > 1){
-		if(tlbtrace_refppa_pwc3(l2_gpa, 1) == 0){		// hit * 0 + miss * 3
-			pwc3_mem_accs++;
+		if(step_pwc(SIM_STEP_PTL2, tlbtrace_refppa_pwc3(l2_gpa, 1)) == 0){		// hit * 0 + miss * 3
+			step_acc(SIM_STEP_PTL2, &pwc3_mem_accs);
 		}
 	}
 }
 
+static void result_pwc_noept(struct SIM_RESULT *result)
+{
+	result->accs = pwc3_mem_accs;
+	result->pwc = pwc3_cnt;
+	result->tlb = main_cnt;
+	result->insns = sim_insns;
+}
+
 void tlbsim_sim_pwc_noept(const char* trace_name, int ntlb_size __attribute__((unused)), int ntlb_way __attribute__((unused)),
 		int pwc_size, int pwc_way, struct SIM_RESULT *result)
 {
-	uint32_t t[4];
-
 	TLB_MAX_ENTRIES_PWC = pwc_size;
 	TLB_WAYSTEP_PWC = pwc_size / pwc_way;
 	TLB_WAYMASK_PWC = TLB_WAYSTEP_PWC - 1;
 
 	fin = fopen(trace_name, "r");
 
-	flush_all();
-	while(fread(t, sizeof(uint32_t), 4, fin) == 4){
-		emulate_pwc3(t[0] & 0xF, t[1], t[2], t[3]);
-	}
-
-	result->accs = pwc3_mem_accs;
-	result->pwc = pwc3_cnt;
+	run_trace(trace_name, SC_PWC_NOEPT, emulate_pwc3, result_pwc_noept, result);
 
 	fclose(fin);
 }
 
-static int tlbtrace_ntlb_find(unsigned int addr)
+static int tlbtrace_ntlb_find(unsigned int addr, int levels, int step)
 {
-	int i, mi = 0;
-	unsigned int mts = ntlb_tlb[0].ts;
-
-	for(i = ((addr >> 12) & TLB_WAYMASK_NTLB) ;i<TLB_MAX_ENTRIES_NTLB;i+=TLB_WAYSTEP_NTLB){
-		if(ntlb_tlb[i].va == addr){			// hit
-			ntlb_tlb[i].ts = ++systs;
-			ntlb_cnt.hit++;
-			return 1;
-		}
+	uint32_t page;
 
-		if(ntlb_tlb[i].ts < mts){
-			mts = ntlb_tlb[i].ts;
-			mi = i;
-		}
+	if(ntlb_lookup(ntlb_tlb, addr, levels, &page)){		// hit
+		ntlb_cnt.hit++;
+		return 1;
 	}
 
-	ntlb_tlb[mi].va = addr;
-	ntlb_tlb[mi].ts = ++systs;
 	ntlb_cnt.miss++;
+	if(hot_n != 0)	hot_miss(step == SIM_STEP_GPA ? SIM_HOT_PAGE : SIM_HOT_PT, page);
 	
 	return 0;
 }
@@ -314,11 +1895,11 @@ static int tlbtrace_ntlb_find(unsigned int addr)
 
 static int tlbtrace_refppa_pwc(unsigned int addr, unsigned int asid)
 {
-	int i, mi = 0;
-	unsigned int mts = pwc_tlb[0].ts;
+	int i, mi = (addr >> 2) & TLB_WAYMASK_PWC;			// the victim is in the set of the descriptor
+	unsigned int mts = pwc_tlb[mi].ts, tag = asid | vm_tag;
 
-	for(i = ((addr >> 2) & TLB_WAYMASK_PWC) ;i<TLB_MAX_ENTRIES_PWC;i+=TLB_WAYSTEP_PWC){
-		if(pwc_tlb[i].va == addr && pwc_tlb[i].asid == asid){			// hit
+	for(i = mi ;i<TLB_MAX_ENTRIES_PWC;i+=TLB_WAYSTEP_PWC){
+		if(pwc_tlb[i].va == addr && pwc_tlb[i].asid == tag){			// hit
 			pwc_tlb[i].ts = ++systs;
 			pwc_cnt.hit++;
 			return 1;
@@ -330,57 +1911,63 @@ static int tlbtrace_refppa_pwc(unsigned int addr, unsigned int asid)
 		}
 	}
 
+	vm_evict(&pwc_tlb[mi]);
 	pwc_tlb[mi].va = addr;
 	pwc_tlb[mi].ts = ++systs;
-	pwc_tlb[mi].asid = asid;
+	pwc_tlb[mi].asid = tag;
 	pwc_cnt.miss++;
+	if(hot_n != 0)	hot_miss(asid != 0 ? SIM_HOT_PT : SIM_HOT_EPT, addr);
 
 	//if(asid == 0)	real_miss++;
 	return 0;
 }
 
-static void emulate_full(int level, uint32_t l1_gpa, uint32_t l2_gpa, uint32_t gpa)
+/* Translate the guest physical page of a step through the NTLB, and the EPT descriptors cached in the PWC on a miss. */
+static void ept_full(int step, uint32_t gpa)
 {
-	uint32_t l1_mpa, l2_mpa;
+	int k, levels = s2_levels(gpa);
 
-	if(tlbtrace_refppa_pwc(l1_gpa, 1) == 0){	// PTL1 desc
-		if(tlbtrace_ntlb_find(l1_gpa & 0xFFFFF000) == 0){	// miss => refppa
-			l1_mpa = (l1_gpa >> 20) * 4;		// base = 0
-			l2_mpa = 16 * 1024 + (l1_gpa >> 20) * 1024 + ((l1_gpa >> 12) & 0xFF) * 4;
-			if(tlbtrace_refppa_pwc(l1_mpa, 0) == 0)	full_mem_accs++;		// EPTL1 desc
-			if(tlbtrace_refppa_pwc(l2_mpa, 0) == 0)	full_mem_accs++;		// EPTL2 desc
-		}
-		full_mem_accs++;
+	if(step_ntlb(step, tlbtrace_ntlb_find(gpa, levels, step)) != 0)	return;		// miss => refppa
+
+	for(k = 0; k < levels; k++){		// EPTL1 .. EPTLn desc
+		if(step_pwc(SIM_STEP_EPTL1 + k, tlbtrace_refppa_pwc(s2_desc(k, gpa), 0)) == 0)	step_acc(SIM_STEP_EPTL1 + k, &full_mem_accs);
+	}
+}
+
+static void emulate_full(uint32_t walk, uint32_t l1_gpa, uint32_t l2_gpa, uint32_t gpa)
+{
+	int level = walk & TLBTRACE_RET_MASK;
+
+	if(step_pwc(SIM_STEP_PTL1, tlbtrace_refppa_pwc(l1_gpa, 1)) == 0){	// PTL1 desc
+		ept_full(SIM_STEP_PTL1, l1_gpa & s2_page_mask);
+		step_acc(SIM_STEP_PTL1, &full_mem_accs);
 	}
 
 	if(level > 1){
-		if(tlbtrace_refppa_pwc(l2_gpa, 1) == 0){	// PTL2 desc
-			if(tlbtrace_ntlb_find(l2_gpa & 0xFFFFF000) == 0){
-				l1_mpa = (l2_gpa >> 20) * 4;		// base = 0
-				l2_mpa = 16 * 1024 + (l2_gpa >> 20) * 1024 + ((l2_gpa >> 12) & 0xFF) * 4;
-				if(tlbtrace_refppa_pwc(l1_mpa, 0) == 0)	full_mem_accs++;	// EPTL1 desc
-				if(tlbtrace_refppa_pwc(l2_mpa, 0) == 0) full_mem_accs++;	// EPTL2 desc
-			}
-			full_mem_accs++;
+		if(step_pwc(SIM_STEP_PTL2, tlbtrace_refppa_pwc(l2_gpa, 1)) == 0){	// PTL2 desc
+			ept_full(SIM_STEP_PTL2, l2_gpa & s2_page_mask);
+			step_acc(SIM_STEP_PTL2, &full_mem_accs);
 		}
 	}
 
-	if(level > 2){
-		if(tlbtrace_ntlb_find(gpa) == 0){
-			l1_mpa = (gpa >> 20) * 4;		// base = 0
-			l2_mpa = 16 * 1024 + (gpa >> 20) * 1024 + ((gpa >> 12) & 0xFF) * 4;
-			if(tlbtrace_refppa_pwc(l1_mpa, 0) == 0)	full_mem_accs++;	// EPTL1 desc
-			if(tlbtrace_refppa_pwc(l2_mpa, 0) == 0)	full_mem_accs++;	// EPTL2 desc
-		}
+	if(level > 2 || WALK_SECTION(walk)){
+		ept_full(SIM_STEP_GPA, gpa & s2_page_mask);
 	}
 }
 
 
+static void result_ntlb_pwc(struct SIM_RESULT *result)
+{
+	result->accs = full_mem_accs;
+	result->ntlb = ntlb_cnt;
+	result->pwc = pwc_cnt;
+	result->tlb = main_cnt;
+	result->insns = sim_insns;
+}
+
 void tlbsim_sim_ntlb_pwc(const char* trace_name, int ntlb_size, int ntlb_way,
 		int pwc_size, int pwc_way, struct SIM_RESULT *result)
 {
-	uint32_t t[4];
-
 	TLB_MAX_ENTRIES_NTLB = ntlb_size;
 	TLB_WAYSTEP_NTLB = ntlb_size / ntlb_way;
 	TLB_WAYMASK_NTLB = TLB_WAYSTEP_NTLB - 1;
@@ -391,14 +1978,7 @@ void tlbsim_sim_ntlb_pwc(const char* trace_name, int ntlb_size, int ntlb_way,
 
 	fin = fopen(trace_name, "r");
 
-	flush_all();
-	while(fread(t, sizeof(uint32_t), 4, fin) == 4){
-		emulate_full(t[0] & 0xF, t[1], t[2], t[3]);
-	}
-
-	result->accs = full_mem_accs;
-	result->ntlb = ntlb_cnt;
-	result->pwc = pwc_cnt;
+	run_trace(trace_name, SC_NTLB_PWC, emulate_full, result_ntlb_pwc, result);
 
 	fclose(fin);
 }
@@ -422,11 +2002,15 @@ static void list_trace_files(const char *path, int tlb_size, int tlb_way)
 		return;
 	}
 
-	snprintf(suffix, 32, "_%d.%d", tlb_size, tlb_way);
+	if(main_size != 0)	strcpy(suffix, "_pages");
+	else		snprintf(suffix, 32, "_%d.%d", tlb_size, tlb_way);
 
 	while((dent = readdir(d)) != NULL){
 		if(strstr(dent->d_name, suffix) == NULL)	continue;
 		if(memcmp(dent->d_name, "trace_", 6) != 0)	continue;
+		if(strstr(dent->d_name, ".part") != NULL)	continue;	// segment still being written
+		if(strstr(dent->d_name, ".idx") != NULL)	continue;
+		if(strstr(dent->d_name, ".ckpt") != NULL)	continue;
 		snprintf(buf, 512, "%s/%s", path, dent->d_name);
 		strcpy(trace_files[trace_count++], buf);
 
@@ -450,6 +2034,8 @@ struct SIM_RESULT** tlbsim_sim(int tlb_size, int ntlb_size, int pwc_size, int wa
 	int i;
 
 	list_trace_files(path, tlb_size, way);
+	memset(files_sizes, 0, sizeof(files_sizes));
+	files_pending = 1;
 
 	if((results = (struct SIM_RESULT**)malloc(sizeof(struct SIM_RESULT*) * (trace_count + 1))) == NULL){
 		fprintf(stderr, "[tlbsim] out of memory.\n");
@@ -466,3 +2052,93 @@ struct SIM_RESULT** tlbsim_sim(int tlb_size, int ntlb_size, int pwc_size, int wa
 
 	return results;
 }
+
+int tlbsim_set_vms(unsigned long long quantum, enum TLBSIM_SWITCH policy)
+{
+	if(quantum == 0 || (policy != TS_TAGGED && policy != TS_FLUSH)){
+		fprintf(stderr, "[tlbsim] invalid VM schedule.\n");
+		return -1;
+	}
+
+	vm_quantum = quantum;
+	vm_switch = policy;
+	return 0;
+}
+
+struct SIM_VM_RESULT** tlbsim_sim_vms(int tlb_size, int ntlb_size, int pwc_size, int way, enum SIM_CMD cmd, const char *path,
+		struct SIM_RESULT *total)
+{
+	static void (*emulates[4])(uint32_t walk, uint32_t l1_gpa, uint32_t l2_gpa, uint32_t gpa) = {
+		emulate_ntlb2,
+		emulate_pwc2,
+		emulate_pwc3,
+		emulate_full};
+	static void (*fills[4])(struct SIM_RESULT *result) = {
+		result_ntlb,
+		result_pwc_ept,
+		result_pwc_noept,
+		result_ntlb_pwc};
+
+	struct SIM_VM_RESULT **results;
+	struct SIM_RESULT *out[SIM_MAX_VMS], solo;
+	unsigned long long insns = window_insns, records = window_records;
+	int i, hot = hot_n, err;
+
+	if(profile_report != NULL || region_report != NULL){		// PCs, ASIDs and file names are local to each trace
+		fprintf(stderr, "[tlbsim] profiles and regions are not supported with consolidated VMs.\n");
+		return NULL;
+	}
+
+	list_trace_files(path, tlb_size, way);
+	if(trace_count == 0 || trace_count > SIM_MAX_VMS){
+		fprintf(stderr, "[tlbsim] %d traces in %s, 1 to %d VMs can be consolidated.\n", trace_count, path, SIM_MAX_VMS);
+		return NULL;
+	}
+
+	TLB_MAX_ENTRIES_NTLB = ntlb_size;
+	TLB_WAYSTEP_NTLB = ntlb_size / way;
+	TLB_WAYMASK_NTLB = TLB_WAYSTEP_NTLB - 1;
+
+	TLB_MAX_ENTRIES_PWC = pwc_size;
+	TLB_WAYSTEP_PWC = pwc_size / way;
+	TLB_WAYMASK_PWC = TLB_WAYSTEP_PWC - 1;
+	sim_cmd = cmd;
+
+	if((results = (struct SIM_VM_RESULT**)calloc(trace_count + 1, sizeof(struct SIM_VM_RESULT*))) == NULL){
+		fprintf(stderr, "[tlbsim] out of memory.\n");
+		return NULL;
+	}
+	for(i = 0; i < trace_count; i++){
+		if((results[i] = (struct SIM_VM_RESULT*)calloc(1, sizeof(struct SIM_VM_RESULT))) == NULL)	break;
+		snprintf(results[i]->trace, sizeof(results[i]->trace), "%s", base_name(trace_files[i]));
+		out[i] = &results[i]->shared;
+	}
+
+	memset(total, 0, sizeof(*total));
+	err = i < trace_count ? -1 : run_vms(trace_files, trace_count, emulates[cmd], fills[cmd], out, total);
+	for(i = 0; i < trace_count && err == 0; i++){
+		results[i]->quanta = vm_quanta[i];
+		results[i]->evicted = vm_evicted[i];
+	}
+
+	// the traces alone, without reporting their windows and hot pages again
+	window_insns = window_records = 0;
+	hot_n = 0;
+	for(i = 0; i < trace_count && err == 0; i++){
+		out[0] = &results[i]->solo;
+		memset(&solo, 0, sizeof(solo));
+		err = run_vms(&trace_files[i], 1, emulates[cmd], fills[cmd], out, &solo);
+	}
+	window_insns = insns;
+	window_records = records;
+	hot_n = hot;
+
+	if(err != 0){
+		for(i = 0; i < trace_count; i++)
+			free(results[i]);
+		free(results);
+		return NULL;
+	}
+
+	return results;
+}
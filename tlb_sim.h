@@ -37,6 +37,55 @@ struct TLB_COUNTER{
 	unsigned long long miss;	/**< Number of cache misses. */
 };
 
+/**
+ * Simulation result of the accesses of one privilege level.
+ */
+struct SIM_PRIV_RESULT{
+	unsigned long long accs;	/**< Memory accesses. */
+	struct TLB_COUNTER ntlb;	/**< Statistics of NTLB. */
+	struct TLB_COUNTER pwc;		/**< Statistics of PWC. */
+	struct TLB_COUNTER tlb;		/**< Statistics of the main TLB, for page-mode traces. */
+};
+
+/**
+ * Steps of a nested walk, see struct SIM_STEP_RESULT.
+ */
+enum SIM_STEP {
+	SIM_STEP_PTL1 = 0,	/**< First level descriptor of the guest page table. */
+	SIM_STEP_PTL2,		/**< Second level descriptor of the guest page table. */
+	SIM_STEP_EPTL1,		/**< First level descriptor of the extended page table. */
+	SIM_STEP_EPTL2,		/**< Second level descriptor of the extended page table. */
+	SIM_STEP_EPTL3,		/**< Third level descriptor of the extended page table, see struct SIM_STAGE2. */
+	SIM_STEP_EPTL4,		/**< Fourth level descriptor of the extended page table. */
+	SIM_STEP_GPA,		/**< Translation of the guest physical address of the access. */
+	SIM_STEPS
+};
+
+#define SIM_LEVELS		3	/**< Traversal results a walk is broken down by, see struct SIM_LEVEL_RESULT. */
+#define SIM_HIST_BINS	16	/**< Bins of the histograms of a walk, the last one counting the larger values as well. */
+
+/**
+ * Lookups and memory accesses of one step of the walks.
+ *
+ * The NTLB lookup of a guest descriptor translates the guest physical page of the descriptor,
+ * and the accesses to the extended page table are accounted to its own steps, whichever step they translate for.
+ */
+struct SIM_STEP_RESULT{
+	struct TLB_COUNTER ntlb;	/**< NTLB lookups. */
+	struct TLB_COUNTER pwc;		/**< PWC lookups. */
+	unsigned long long accs;	/**< Memory accesses. */
+};
+
+/**
+ * Walks of one traversal result.
+ */
+struct SIM_LEVEL_RESULT{
+	unsigned long long walks;	/**< Simulated records. */
+	struct TLB_COUNTER ntlb;	/**< NTLB lookups. */
+	struct TLB_COUNTER pwc;		/**< PWC lookups. */
+	unsigned long long accs;	/**< Memory accesses. */
+};
+
 /**
  * Simulation Result.
  */
@@ -44,6 +93,82 @@ struct SIM_RESULT{
 	unsigned long long accs;	/**< Total number of memory accesses. */
 	struct TLB_COUNTER ntlb;	/**< Statistics of NTLB. */
 	struct TLB_COUNTER pwc;		/**< Statistics of PWC. */
+	struct TLB_COUNTER tlb;		/**< Statistics of the main TLB, for page-mode traces. */
+	unsigned long long insns;	/**< Guest instructions, from the instruction stamps of the trace. */
+	unsigned long long records;	/**< Simulated records: the walks, i.e. the main TLB misses of page-mode traces. */
+	const char *trace;			/**< Base name of the trace of a window, NULL for the windows of several VMs and the other results. */
+	struct SIM_PRIV_RESULT priv[2];	/**< Breakdown of the user (0) and kernel (1) accesses, see #TLBTRACE_PRIV_FLAG in tlb_trace.h. */
+	struct SIM_STEP_RESULT step[SIM_STEPS];	/**< Breakdown by step of the walk, see enum SIM_STEP. */
+	struct SIM_LEVEL_RESULT level[SIM_LEVELS];	/**< Breakdown by traversal result: a section or a fault at the first level (0), a fault at the second level (1), or a completed walk (2). */
+	unsigned long long refs_hist[SIM_HIST_BINS];	/**< Number of walks by their number of NTLB and PWC lookups. */
+	unsigned long long accs_hist[SIM_HIST_BINS];	/**< Number of walks by their number of memory accesses. */
+};
+
+/**
+ * Cost of the walks of the accesses made by one PC, see tlbsim_set_profile().
+ */
+struct SIM_PC_COST{
+	unsigned int pc;			/**< PC of the accesses, 0 if they were not tagged. */
+	unsigned int asid;			/**< Address space ID of the accesses. */
+	unsigned long long walks;	/**< Simulated records, i.e. main TLB misses. */
+	unsigned long long ntlb_miss;	/**< NTLB misses. */
+	unsigned long long pwc_miss;	/**< PWC misses. */
+	unsigned long long accs;	/**< Memory accesses. */
+};
+
+/**
+ * Cost of the walks of the accesses to one memory region, see tlbsim_set_regions().
+ */
+struct SIM_REGION_COST{
+	const char *name;			/**< Path of the mapped file, or [kernel], [stack], [heap] or [anon]. */
+	unsigned long long walks;	/**< Simulated records, i.e. main TLB misses. */
+	unsigned long long ntlb_miss;	/**< NTLB misses. */
+	unsigned long long pwc_miss;	/**< PWC misses. */
+	unsigned long long accs;	/**< Memory accesses. */
+};
+
+/**
+ * Kinds of pages the misses are counted for, see struct SIM_HOT_PAGE.
+ */
+enum SIM_HOT_KIND {
+	SIM_HOT_PAGE = 0,	/**< Guest physical page of an access: NTLB misses of the final translation. */
+	SIM_HOT_PT,			/**< Guest page-table page: NTLB misses translating it, and PWC misses on its descriptors. */
+	SIM_HOT_EPT,		/**< Extended page-table page: PWC misses on its descriptors. */
+	SIM_HOT_KINDS
+};
+
+/**
+ * A page causing many misses, see tlbsim_set_hot_pages().
+ */
+struct SIM_HOT_PAGE{
+	int kind;					/**< Kind of the page, see enum SIM_HOT_KIND. */
+	unsigned int page;			/**< Address of the page. */
+	unsigned long long misses;	/**< Estimated misses, never less than the actual ones. */
+	unsigned long long error;	/**< Bound of the overestimate of \a misses, with a probability of 98%. */
+};
+
+#define SIM_S2_MAX_LEVELS	4	/**< Levels of a stage-2 page table, see struct SIM_STAGE2. */
+
+/**
+ * Layout of the stage-2 (extended) page table which translates the guest physical addresses, see tlbsim_set_stage2().
+ *
+ * The guest physical address is split, from its top, into the index of each level and the offset in a page of the granule,
+ * so the \a bits of the levels and \a granule_bits add up to 32.
+ * The first-level table is at \a base, and the tables of each level follow the ones of the level above,
+ * in the order of the addresses they translate, from a page of the granule.
+ *
+ * The guest physical addresses from \a block_start to \a block_end may be mapped by blocks of level \a block_level,
+ * whose walks end at that level. The NTLB then holds entries of both sizes, and probes the set of each size on a lookup.
+ */
+struct SIM_STAGE2{
+	int levels;						/**< Levels of the table, 1 to #SIM_S2_MAX_LEVELS. */
+	int bits[SIM_S2_MAX_LEVELS];	/**< Bits of the guest physical address indexing each level, from the first one. */
+	int granule_bits;				/**< log2 of the size of a page mapped by the last level, and of the NTLB entries. */
+	int entry_bits;					/**< log2 of the size of a descriptor. */
+	unsigned int base;				/**< Host physical address of the first-level table, aligned to the granule. */
+	int block_level;				/**< Level of the block descriptors, 1 to \a levels - 1, or 0 for no blocks. */
+	unsigned int block_start;		/**< First address mapped by blocks, aligned to the block size. */
+	unsigned int block_end;			/**< End of the addresses mapped by blocks, aligned to the block size, or 0 for the end of the space. */
 };
 
 /**
@@ -56,6 +181,39 @@ enum SIM_CMD {
 	SC_NTLB_PWC			/**< Simulate both NTLB and PWC. */
 };
 
+/**
+ * Replacement policies of the main TLB.
+ */
+enum TLBSIM_POLICY {
+	TP_LRU = 0,			/**< Least recently used, as in the tracer. */
+	TP_FIFO,			/**< First in, first out. */
+	TP_RANDOM			/**< Random, with a fixed seed so that runs are repeatable. */
+};
+
+/**
+ * What happens to the caches when another VM is scheduled, see tlbsim_set_vms().
+ */
+enum TLBSIM_SWITCH {
+	TS_TAGGED = 0,		/**< Entries are tagged with the VMID, and kept across switches. */
+	TS_FLUSH			/**< The caches and the main TLB are flushed on every switch, as without VMIDs. */
+};
+
+#define SIM_MAX_VMS		16	/**< Maximum number of consolidated VMs, see tlbsim_sim_vms(). */
+
+/**
+ * Result of one VM of a consolidated simulation, see tlbsim_sim_vms().
+ *
+ * \a shared and \a solo hold the totals of the counters only, without the breakdowns.
+ * The interference of the other VMs is the difference between them.
+ */
+struct SIM_VM_RESULT{
+	char trace[256];				/**< File name of the trace of the VM, without the directory. */
+	struct SIM_RESULT shared;		/**< Counters of the VM when consolidated with the others. */
+	struct SIM_RESULT solo;			/**< Counters of the VM simulated alone, with the same caches. */
+	unsigned long long quanta;		/**< Quanta the VM was scheduled for. */
+	unsigned long long evicted;		/**< Entries of the VM replaced by the other VMs, or flushed on its switches. */
+};
+
 /**
  * @brief Run a simulation with NTLB.
  *
@@ -126,6 +284,210 @@ void tlbsim_sim_pwc_noept(const char* trace_name, int ntlb_size, int ntlb_way,
 void tlbsim_sim_ntlb_pwc(const char* trace_name, int ntlb_size, int ntlb_way,
 		int pwc_size, int pwc_way, struct SIM_RESULT *result);
 
+/**
+ * @brief Select whether the simulated caches are private to each CPU.
+ *
+ * By default, the caches are shared by all CPUs recorded in a trace.
+ * When enabled, each CPU has its own NTLB and PWC, chosen by the CPU ID of each record.
+ * The statistics in the result are the sum of all CPUs.
+ *
+ * @param enable
+ * - 0 to share the caches among all CPUs.
+ * - 1 to give each CPU private caches.
+ */
+void tlbsim_set_private_caches(int enable);
+
+/**
+ * @brief Set the main TLB which page-mode traces are filtered through.
+ *
+ * Page-mode traces (see tlb_trace.h) hold every page transition instead of the main TLB misses.
+ * Each CPU has its own main TLB, as in the tracer, and only its misses are passed to the NTLB and PWC.
+ * Once a main TLB is set, tlbsim_sim() selects the page-mode traces of the folder instead of the traces of a main TLB geometry.
+ *
+ * @param size Size of the main TLB, or 0 to simulate traces of main TLB misses (default).
+ * @param way Set associativity of the main TLB.
+ * @param policy Replacement policy of the main TLB.
+ * @return
+ * - 0 on success
+ * - -1 on an invalid geometry.
+ */
+int tlbsim_set_main_tlb(int size, int way, enum TLBSIM_POLICY policy);
+
+/**
+ * @brief Report the results of each window of guest instructions.
+ *
+ * The instructions are counted from the instruction stamps of the trace (see tlb_trace.h),
+ * so a window ends at the first stamp reaching its end, and may be longer than \a insns.
+ * \a report is called with the counters of each window, and of the last, partial one at the end of each trace;
+ * SIM_RESULT::trace tells which trace the window belongs to.
+ *
+ * @param insns Number of instructions of a window, or 0 to disable windows (default).
+ * @param report Function called at the end of each window.
+ * @param arg Argument passed to \a report.
+ */
+void tlbsim_set_window(unsigned long long insns, void (*report)(const struct SIM_RESULT *result, void *arg), void *arg);
+
+/**
+ * @brief Report the results of each window of records.
+ *
+ * Same as tlbsim_set_window(), with windows of exactly \a records records of the trace,
+ * for traces without instruction stamps. The two kinds of windows are exclusive, the last one set is used.
+ * Only the counters are reported: accesses, NTLB, PWC and main TLB hits and misses, instructions and records.
+ *
+ * @param records Number of records of a window, or 0 to disable windows (default).
+ * @param report Function called at the end of each window.
+ * @param arg Argument passed to \a report.
+ */
+void tlbsim_set_window_records(unsigned long long records, void (*report)(const struct SIM_RESULT *result, void *arg), void *arg);
+
+/**
+ * @brief Report the cost of the walks of each PC.
+ *
+ * Records are attributed to the PC tags of the trace (see tlb_trace.h), per CPU.
+ * At the end of each trace, \a report is called once for each PC and ASID which made a simulated access, in no particular order.
+ * Records before the first tag of their CPU are attributed to PC 0.
+ *
+ * @param report Function called with the cost of each PC, or NULL to disable the profile (default).
+ * @param arg Argument passed to \a report.
+ */
+void tlbsim_set_profile(void (*report)(const struct SIM_PC_COST *cost, void *arg), void *arg);
+
+/**
+ * @brief Report the cost of the walks of each memory region.
+ *
+ * Records are attributed to the mappings of the trace (see tlb_trace.h), in the ASID of their CPU.
+ * Pages which are not mapped in that ASID are looked up in the last mappings of any ASID,
+ * since forked processes inherit mappings which were reported to their parent.
+ * The remaining pages are classified by address, for the default memory layout of ARM Linux:
+ * [kernel] from 0xC0000000, [stack] in the 16M below, [heap] under 0x40000000, and [anon] otherwise.
+ * At the end of each trace, \a report is called once for each region which made a simulated access, the most memory accesses first.
+ * The name of a region is valid until the next trace is simulated.
+ *
+ * @param report Function called with the cost of each region, or NULL to disable the breakdown (default).
+ * @param arg Argument passed to \a report.
+ */
+void tlbsim_set_regions(void (*report)(const struct SIM_REGION_COST *cost, void *arg), void *arg);
+
+/**
+ * @brief Report the pages causing the most NTLB and PWC misses.
+ *
+ * The misses of every page are estimated in bounded memory with a count-min sketch,
+ * which overestimates them by at most 0.07% of the misses of the kind of page with a probability of 98%,
+ * and the \a n pages of each kind with the largest estimates are kept in a heap.
+ * At the end of each trace, \a report is called for the kept pages of each kind, the most misses first.
+ *
+ * @param n Number of pages reported per kind, at most 1024.
+ * @param report Function called with each hot page, or NULL to disable the tracking (default).
+ * @param arg Argument passed to \a report.
+ * @return
+ * - 0 on success
+ * - -1 on an invalid \a n.
+ */
+int tlbsim_set_hot_pages(int n, void (*report)(const struct SIM_HOT_PAGE *hot, void *arg), void *arg);
+
+/**
+ * @brief Set the layout of the stage-2 page table of the models with an EPT.
+ *
+ * The default is an ARMv7 short-descriptor layout: 2 levels of 12 and 8 bits, 4KB pages, 4-byte descriptors,
+ * and a 16KB first-level table at 0 followed by the 1KB second-level tables.
+ * An LPAE layout has 3 levels of 2, 9 and 9 bits, 4KB pages and 8-byte descriptors.
+ * The NTLB-only model counts one access per level of the walk on a miss.
+ * No address is mapped by blocks by default; blocks of level 1 of the short-descriptor layout map 1MB, and of level 2 of LPAE 2MB.
+ *
+ * @param layout Layout of the table, or NULL for the default.
+ * @return
+ * - 0 on success
+ * - -1 on an invalid layout.
+ */
+int tlbsim_set_stage2(const struct SIM_STAGE2 *layout);
+
+/**
+ * @brief Checkpoint the simulation of each trace.
+ *
+ * The state of the simulation of a trace (caches and their recency state, counters, breakdowns and offset in the trace)
+ * is written to \a dir/<trace file name>.ckpt every \a records records and at the end of the trace.
+ * A checkpoint replaces the previous one only once it is complete.
+ * When a trace is simulated again with the same model, geometry and options, the simulation resumes from its checkpoint,
+ * so a restarted job skips the records simulated before; the windows ended before the checkpoint are not reported again,
+ * nor the last window and the profile of a trace resumed at its end.
+ * Checkpoints are specific to the machine and the version of the simulator.
+ *
+ * @param dir Directory of the checkpoints, or NULL to disable them (default).
+ * @param records Number of records between checkpoints, or 0 to checkpoint at the end of each trace only.
+ * @return
+ * - 0 on success
+ * - -1 if \a dir is too long.
+ */
+int tlbsim_set_checkpoint(const char *dir, unsigned long long records);
+
+#define SIM_CKPT_FILES	4	/**< Maximum number of report files kept in step with the checkpoints, see tlbsim_set_checkpoint_files(). */
+
+/**
+ * @brief Keep the files written by the reports in step with the checkpoints.
+ *
+ * Before each checkpoint, \a save flushes the files and returns their sizes, which are stored in the checkpoint.
+ * Before the first report of tlbsim_sim(), \a restore truncates the files to the sizes stored in the last checkpoint loaded,
+ * or to 0 if none was, so the reports an interrupted job wrote after its checkpoint are not written twice,
+ * and a simulation which resumes nothing starts the files again.
+ * A trace resumed at its end neither loads sizes nor reports, so the files are left to the traces after it.
+ *
+ * @param save Function filling the sizes of the files, up to #SIM_CKPT_FILES, or NULL to disable (default).
+ * @param restore Function truncating the files to \a sizes.
+ * @param arg Argument passed to \a save and \a restore.
+ */
+void tlbsim_set_checkpoint_files(void (*save)(unsigned long long sizes[SIM_CKPT_FILES], void *arg),
+		void (*restore)(const unsigned long long sizes[SIM_CKPT_FILES], void *arg), void *arg);
+
+/**
+ * @brief Start the simulation of each trace with the caches of a checkpoint.
+ *
+ * Only the caches and their recency state are loaded; the counters start from 0.
+ * This continues e.g. the simulation of a trace with its next segment, from the checkpoint written at its end (see tlbsim_set_checkpoint()).
+ * The checkpoint must be of the same model and geometry. A trace which resumes from its own checkpoint ignores \a file.
+ *
+ * @param file Checkpoint to load, or NULL to start cold (default).
+ * @return
+ * - 0 on success
+ * - -1 if \a file is too long.
+ */
+int tlbsim_set_warm_start(const char *file);
+
+/**
+ * @brief Set the scheduling of the VMs consolidated by tlbsim_sim_vms().
+ *
+ * The VMs run in turn, from the first one, for \a quantum records each; a VM whose trace ends leaves the schedule.
+ * With #TS_TAGGED, the NTLB, PWC and main TLB entries of a VM are tagged with its VMID, so the VMs only interfere
+ * through the replacements. The default is a quantum of 100000 records with #TS_TAGGED.
+ *
+ * @param quantum Records simulated before switching to the next VM.
+ * @param policy What happens to the caches on a switch.
+ * @return
+ * - 0 on success
+ * - -1 on an invalid \a quantum or \a policy.
+ */
+int tlbsim_set_vms(unsigned long long quantum, enum TLBSIM_SWITCH policy);
+
+/**
+ * @brief Run a simulation of the traces in a specific folder consolidated on the same caches, one VM per trace.
+ *
+ * The traces are interleaved as set by tlbsim_set_vms(), each one read through its own stream and walk table,
+ * so the memory used does not depend on the length of the traces. Each trace is then simulated alone, for the comparison.
+ * The windows and hot pages see the records of all VMs; no checkpoint is taken.
+ * Profiles and regions are not supported, as the PCs, ASIDs and mapped files of the traces are not told apart.
+ *
+ * @param tlb_size Size of the main TLB. It is used to filter trace files, unless a main TLB is set by tlbsim_set_main_tlb().
+ * @param ntlb_size Size of NTLB for simulation.
+ * @param pwc_size Size of PWC for simulation.
+ * @param way Set associativity of caches.
+ * @param cmd Type of Simulation.
+ * @param path Path to the folder containing trace files for simulation, at most #SIM_MAX_VMS.
+ * @param total Pointer to a user-allocated object for the result of all VMs together, with the breakdowns.
+ * @return The results of the VMs ordered by filename and terminated by a NULL element, or NULL on failure,
+ * or if a profile (see tlbsim_set_profile()) or regions (see tlbsim_set_regions()) are set.
+ */
+struct SIM_VM_RESULT** tlbsim_sim_vms(int tlb_size, int ntlb_size, int pwc_size, int way, enum SIM_CMD cmd, const char *path,
+		struct SIM_RESULT *total);
+
 /**
  * @brief Run simulation with all traces in a specific folder with the specified type of simulation.
  *
@@ -133,7 +495,7 @@ void tlbsim_sim_ntlb_pwc(const char* trace_name, int ntlb_size, int ntlb_way,
  * All caches in the simulation are assumed to have the same set associativity.
  * The results are returned as a list ordered by filename and terminated by a NULL element.
  *
- * @param tlb_size Size of the main TLB. It is used to filter trace files.
+ * @param tlb_size Size of the main TLB. It is used to filter trace files, unless a main TLB is set by tlbsim_set_main_tlb().
  * @param ntlb_size Size of NTLB for simulation.
  * @param pwc_size Size of PWC for simulation.
  * @param way Set associativity of caches.
@@ -0,0 +1,466 @@
+/**
+ * This file is part of TLB Analyzer
+ *
+ * TLB Analyzer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * TLB Analyzer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with TLB Analyzer.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Symbolizes the profile written by 'tlb_sim -p' with the unstripped guest binaries,
+ * and writes the walk cost as folded stacks (module;caller;...;function;file:line cost),
+ * which flamegraph.pl reads directly.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "elff/elff_api.h"
+
+#define MAX_MODULES		64
+#define MAX_STACK		4096
+
+/* A guest binary and the range it is mapped at */
+struct MODULE{
+	int asid;				// -1 for all address spaces
+	unsigned int start;
+	unsigned int end;		// exclusive
+	const char *path;
+	const char *name;		// base name, the root frame of its stacks
+	ELFF_HANDLE handle;		// opened on first use
+	int is_exec;			// executables are symbolized by absolute address, libraries by offset
+	int failed;
+};
+
+static struct MODULE modules[MAX_MODULES];
+static int nmodule;
+
+/* Stacks of the symbolized addresses, keyed by module and address */
+struct SYM_SLOT{
+	char *stack;			// NULL if empty
+	int module;
+	uint32_t addr;
+};
+
+static struct SYM_SLOT *syms;
+static unsigned int sym_size, sym_used;
+
+/* Cost of each distinct stack */
+struct STACK_SLOT{
+	const char *stack;		// NULL if empty
+	unsigned long long cost;
+};
+
+static struct STACK_SLOT *stacks;
+static unsigned int stack_size, stack_used;
+
+/* A PC of the profile, and its cost */
+struct PC_COST{
+	unsigned int asid;
+	uint32_t pc;
+	unsigned long long cost;
+};
+
+static struct PC_COST *pcs;
+static unsigned int npc, pc_size;
+
+static unsigned long long lookups;
+static int functions_only;
+static int index_cache;
+
+static void *zalloc(size_t n, size_t size)
+{
+	void *p;
+
+	if((p = calloc(n, size)) == NULL){
+		fprintf(stderr, "[tlbsym] out of memory.\n");
+		exit(1);
+	}
+
+	return p;
+}
+
+static unsigned int str_hash(const char *s)
+{
+	unsigned int h = 2166136261u;		// FNV-1a
+
+	while(*s != '\0')	h = (h ^ (unsigned char)*s++) * 16777619u;
+
+	return h;
+}
+
+static void add_cost(const char *stack, unsigned long long cost)
+{
+	struct STACK_SLOT *e;
+	unsigned int i;
+
+	if(stack_used * 2 >= stack_size){		// grow, and keep the load under 1/2
+		struct STACK_SLOT *old = stacks;
+		unsigned int n = stack_size;
+
+		stack_size = stack_size != 0 ? stack_size * 2 : 4096;
+		stacks = (struct STACK_SLOT*)zalloc(stack_size, sizeof(struct STACK_SLOT));
+		stack_used = 0;
+		for(i = 0; i < n; i++){
+			if(old[i].stack != NULL)	add_cost(old[i].stack, old[i].cost);
+		}
+		free(old);
+	}
+
+	for(i = str_hash(stack) & (stack_size - 1); ; i = (i + 1) & (stack_size - 1)){
+		e = &stacks[i];
+		if(e->stack == NULL)	break;
+		if(strcmp(e->stack, stack) == 0){
+			e->cost += cost;
+			return;
+		}
+	}
+
+	e->stack = stack;
+	e->cost = cost;
+	stack_used++;
+}
+
+/* Append a frame to a stack, without the separators of the folded format. */
+static void append_frame(char *buf, int *n, const char *frame)
+{
+	if(*n < MAX_STACK - 1)	buf[(*n)++] = ';';
+	for(; *frame != '\0' && *n < MAX_STACK - 1; frame++)
+		buf[(*n)++] = (*frame == ';' || *frame == '\n') ? '_' : *frame;
+	buf[*n] = '\0';
+}
+
+static void open_module(struct MODULE *m)
+{
+	if(m->handle != NULL || m->failed)	return;
+
+	if((m->handle = elff_init(m->path)) == NULL){
+		fprintf(stderr, "[tlbsym] can't read the debug information of %s.\n", m->path);
+		m->failed = 1;
+	}else{
+		m->is_exec = elff_is_exec(m->handle) == 1;
+		elff_set_index_cache(m->handle, index_cache);
+	}
+}
+
+/* Stack of an address of a module, from its address information (NULL if unknown). */
+static char *format_stack(struct MODULE *m, uint32_t addr, Elf_AddressInfo *info)
+{
+	char buf[MAX_STACK], frame[MAX_STACK];
+	int n, i;
+
+	n = snprintf(buf, sizeof(buf), "%s", m->name);
+
+	if(info == NULL){
+		snprintf(frame, sizeof(frame), "0x%08x", addr);
+		append_frame(buf, &n, frame);
+		return strdup(buf);
+	}
+
+	// the last routine of the inline stack is the outermost one
+	if(info->inline_stack != NULL){
+		for(i = 0; !elfinlineinfo_is_last_entry(&info->inline_stack[i]); i++);
+		while(--i >= 0)
+			append_frame(buf, &n, info->inline_stack[i].routine_name);
+	}
+	append_frame(buf, &n, info->routine_name);
+	if(!functions_only && info->file_name != NULL){
+		snprintf(frame, sizeof(frame), "%s:%u", info->file_name, info->line_number);
+		append_frame(buf, &n, frame);
+	}
+
+	return strdup(buf);
+}
+
+static char *symbolize(struct MODULE *m, uint32_t addr)
+{
+	Elf_AddressInfo info;
+	char *stack;
+
+	lookups++;
+	if(m->handle == NULL || elff_get_pc_address_info(m->handle, addr, &info) != 0)
+		return format_stack(m, addr, NULL);
+
+	stack = format_stack(m, addr, &info);
+	elff_free_pc_address_info(m->handle, &info);
+
+	return stack;
+}
+
+static inline unsigned int sym_hash(int module, uint32_t addr)
+{
+	return ((addr >> 1) * 2654435761u + module) & (sym_size - 1);
+}
+
+/* Slot of an address of a module in the symbol cache, which is empty if not symbolized yet. */
+static struct SYM_SLOT *sym_slot(int module, uint32_t addr)
+{
+	struct SYM_SLOT *e;
+	unsigned int i;
+
+	if(sym_used * 2 >= sym_size){		// grow, and keep the load under 1/2
+		struct SYM_SLOT *old = syms;
+		unsigned int size = sym_size, n;
+
+		sym_size = sym_size != 0 ? sym_size * 2 : 4096;
+		syms = (struct SYM_SLOT*)zalloc(sym_size, sizeof(struct SYM_SLOT));
+		sym_used = 0;
+		for(i = 0; i < size; i++){
+			if(old[i].stack == NULL)	continue;
+			for(n = sym_hash(old[i].module, old[i].addr); syms[n].stack != NULL; n = (n + 1) & (sym_size - 1));
+			syms[n] = old[i];
+			sym_used++;
+		}
+		free(old);
+	}
+
+	for(i = sym_hash(module, addr); ; i = (i + 1) & (sym_size - 1)){
+		e = &syms[i];
+		if(e->stack == NULL || (e->module == module && e->addr == addr))	break;
+	}
+
+	return e;
+}
+
+static void set_stack(struct SYM_SLOT *e, int module, uint32_t addr, char *stack)
+{
+	e->stack = stack;
+	e->module = module;
+	e->addr = addr;
+	sym_used++;
+}
+
+/* Stack of an address of a module, symbolized once. */
+static const char *module_stack(int module, uint32_t addr)
+{
+	struct SYM_SLOT *e = sym_slot(module, addr);
+
+	if(e->stack == NULL)	set_stack(e, module, addr, symbolize(&modules[module], addr));
+
+	return e->stack;
+}
+
+/* The module a PC of an address space is in, or -1 */
+static int pc_module(unsigned int asid, uint32_t pc)
+{
+	struct MODULE *m;
+	int i;
+
+	for(i = 0; i < nmodule; i++){
+		m = &modules[i];
+		if((m->asid >= 0 && (unsigned int)m->asid != asid) || pc < m->start || pc >= m->end)	continue;
+		open_module(m);
+		return i;
+	}
+
+	return -1;
+}
+
+static inline uint32_t module_addr(int module, uint32_t pc)
+{
+	return modules[module].is_exec ? pc : pc - modules[module].start;
+}
+
+static const char *pc_stack(unsigned int asid, uint32_t pc)
+{
+	static char buf[64];
+	int module;
+
+	if(pc == 0)	return "[untagged]";
+
+	if((module = pc_module(asid, pc)) >= 0)	return module_stack(module, module_addr(module, pc));
+
+	snprintf(buf, sizeof(buf), "[asid %u];0x%08x", asid, pc);
+	return buf;
+}
+
+static int addr_cmp(const void *p1, const void *p2)
+{
+	uint64_t a1 = *(const uint64_t*)p1, a2 = *(const uint64_t*)p2;
+
+	return a1 < a2 ? -1 : a1 > a2;
+}
+
+/*
+ * Symbolize the PCs of the profile in a module at once: elff resolves a sorted batch
+ * in a single pass over its address index, rather than searching it for each PC.
+ */
+static void symbolize_module(int module)
+{
+	struct MODULE *m = &modules[module];
+	Elf_AddressInfo *infos;
+	uint64_t *addrs;
+	unsigned int i, n, k;
+
+	addrs = (uint64_t*)zalloc(npc + 1, sizeof(uint64_t));
+	for(i = n = 0; i < npc; i++){		// the module is opened with its first PC
+		if(pcs[i].pc != 0 && pc_module(pcs[i].asid, pcs[i].pc) == module)
+			addrs[n++] = module_addr(module, pcs[i].pc);
+	}
+	if(m->handle == NULL){
+		free(addrs);
+		return;
+	}
+	qsort(addrs, n, sizeof(uint64_t), addr_cmp);
+	for(i = k = 0; i < n; i++){		// the same address may come from several address spaces
+		if(k == 0 || addrs[i] != addrs[k - 1])	addrs[k++] = addrs[i];
+	}
+
+	infos = (Elf_AddressInfo*)zalloc(k + 1, sizeof(Elf_AddressInfo));
+	if(elff_get_pc_address_info_batch(m->handle, addrs, k, infos) < 0){
+		fprintf(stderr, "[tlbsym] can't index the debug information of %s.\n", m->path);
+		k = 0;
+	}
+	lookups += k;
+
+	for(i = 0; i < k; i++){
+		if(infos[i].routine_name == NULL){
+			set_stack(sym_slot(module, addrs[i]), module, addrs[i], format_stack(m, addrs[i], NULL));
+			continue;
+		}
+		set_stack(sym_slot(module, addrs[i]), module, addrs[i], format_stack(m, addrs[i], &infos[i]));
+		elff_free_pc_address_info(m->handle, &infos[i]);
+	}
+
+	free(infos);
+	free(addrs);
+}
+
+/* Parse a module in the format [asid:]start-end=path. */
+static int parse_module(char *str, struct MODULE *m)
+{
+	char *eq, *colon, *p;
+
+	if((eq = strchr(str, '=')) == NULL)	return -1;
+	*eq = '\0';
+
+	m->asid = -1;
+	if((colon = strchr(str, ':')) != NULL){
+		m->asid = strtol(str, &p, 0);
+		if(p != colon)	return -1;
+		str = colon + 1;
+	}
+
+	m->start = strtoul(str, &p, 0);
+	if(*p != '-')	return -1;
+	m->end = strtoul(p + 1, &p, 0);
+	if(*p != '\0' || m->end <= m->start)	return -1;
+
+	m->path = eq + 1;
+	m->name = strrchr(m->path, '/') != NULL ? strrchr(m->path, '/') + 1 : m->path;
+
+	return 0;
+}
+
+static int stack_cmp(const void *p1, const void *p2)
+{
+	return strcmp(((const struct STACK_SLOT*)p1)->stack, ((const struct STACK_SLOT*)p2)->stack);
+}
+
+int main(int argc, char* argv[])
+{
+	static const char *metrics[] = {"walks", "ntlb", "pwc", "accs"};
+	int metric = 3;
+	unsigned long long v[4], nline = 0;
+	unsigned int asid, pc, i, n;
+	char line[256];
+	FILE *fin;
+	int opt, bad = 0;
+
+	while((opt = getopt(argc, argv, "m:fc")) != -1){
+		if(opt == 'm'){
+			for(metric = 3; metric >= 0; metric--)
+				if(strcmp(optarg, metrics[metric]) == 0)	break;
+			if(metric < 0)	bad = 1;
+		}else if(opt == 'f'){
+			functions_only = 1;
+		}else if(opt == 'c'){
+			index_cache = 1;
+		}else{
+			bad = 1;
+		}
+	}
+
+	if(!bad && optind < argc){
+		for(i = optind + 1; i < (unsigned int)argc; i++){
+			if(nmodule == MAX_MODULES || parse_module(argv[i], &modules[nmodule]) != 0){
+				fprintf(stderr, "invalid module %s\n", argv[i]);
+				return 1;
+			}
+			nmodule++;
+		}
+	}
+
+	if(bad || optind >= argc){
+		fprintf(stderr, "Usage: tlb_sym [-m {walks, ntlb, pwc, accs}] [-f] [-c] profile [[asid:]start-end=binary ...]\n");
+		fprintf(stderr, "  profile is written by 'tlb_sim -p', and start is the address the binary is loaded at.\n");
+		fprintf(stderr, "  The cost (default accs) is written as folded stacks, per line or per function with -f.\n");
+		fprintf(stderr, "  -c caches the address index of each binary next to it, for the next runs.\n");
+		return 1;
+	}
+
+	if((fin = fopen(argv[optind], "r")) == NULL){
+		fprintf(stderr, "can't open %s\n", argv[optind]);
+		return 1;
+	}
+
+	while(fgets(line, sizeof(line), fin) != NULL){
+		if(line[0] == '#')	continue;
+		if(sscanf(line, "%u %x %llu %llu %llu %llu", &asid, &pc, &v[0], &v[1], &v[2], &v[3]) != 6){
+			fprintf(stderr, "[tlbsym] malformed line: %s", line);
+			continue;
+		}
+		nline++;
+		if(v[metric] == 0)	continue;
+
+		if(npc == pc_size){
+			pc_size = pc_size != 0 ? pc_size * 2 : 4096;
+			if((pcs = (struct PC_COST*)realloc(pcs, pc_size * sizeof(struct PC_COST))) == NULL){
+				fprintf(stderr, "[tlbsym] out of memory.\n");
+				return 1;
+			}
+		}
+		pcs[npc].asid = asid;
+		pcs[npc].pc = pc;
+		pcs[npc].cost = v[metric];
+		npc++;
+	}
+	fclose(fin);
+
+	for(i = 0; i < (unsigned int)nmodule; i++)
+		symbolize_module(i);
+
+	for(i = 0; i < npc; i++){
+		const char *stack = pc_stack(pcs[i].asid, pcs[i].pc);
+
+		if(stack[0] == '[')	stack = strdup(stack);		// not cached
+		add_cost(stack, pcs[i].cost);
+	}
+
+	// sort the stacks, so that the output is the same from run to run
+	for(i = n = 0; i < stack_size; i++){
+		if(stacks[i].stack != NULL)	stacks[n++] = stacks[i];
+	}
+	qsort(stacks, n, sizeof(struct STACK_SLOT), stack_cmp);
+	for(i = 0; i < n; i++)
+		fprintf(stdout, "%s %llu\n", stacks[i].stack, stacks[i].cost);
+
+	fprintf(stderr, "[tlbsym] %llu PCs, %llu lookups, %u stacks\n", nline, lookups, n);
+
+	for(i = 0; i < (unsigned int)nmodule; i++){
+		if(modules[i].handle != NULL)	elff_close(modules[i].handle);
+	}
+
+	return 0;
+}
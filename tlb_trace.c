@@ -18,10 +18,16 @@
 /* Memory Layout:
  *   0x0000_0000 -> 0x01FF_FFFF		Hypervisor (32MB)
  *   0x0200_0000 -> 0x21FF_FFFF		First VM (512MB)
+ *
+ * The records hold guest physical addresses only. The stage-2 page table of the hypervisor,
+ * its levels and where its tables are, is a parameter of the simulator, see tlbsim_set_stage2() in tlb_sim.h.
  */
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -29,12 +35,10 @@
 #ifdef USE_QEMU
 #include <cpu-all.h>
 #include <exec-all.h>
+#include <hw/hw.h>
 #endif	/* USE_QEMU */
 
-static int tlb_size;
-static int tlb_set;
-static int tlb_set_step;
-static int tlb_set_mask;
+#include "tlb_trace.h"
 
 struct TLB_ENTRY{
 	unsigned int va;		// Virtual Address
@@ -48,43 +52,176 @@ struct TLB_COUNTER{
 	unsigned long long miss;
 };
 
-static struct TLB_ENTRY *sl_tlb;
-static struct TLB_COUNTER sl_cnt;
+/* Per-CPU main TLB of a configuration. */
+struct TLBTRACE_CPU{
+	struct TLB_ENTRY *sl_tlb;	// main TLB
+	struct TLB_COUNTER sl_cnt;
+	int last_ins_idx;			// entry hit by the last instruction fetch
+	int fill_idx;				// entry refilled by the last miss
+};
+
+/* Trace stream of a configuration. Records of all CPUs are interleaved in a single stream.
+ * The vCPUs are executed by a single thread, so the stream order is the global order. */
+struct TLBTRACE_STREAM{
+	int fout;
+	int fbc;
+	uint32_t *fbuf;
+	unsigned long long *ring_ts;	// flight recorder: fbuf is used as a ring, stamped once per block
+	int ring_full;
+	char trace_base[512];			// file name without the segment number
+	int seg_no;
+	unsigned long long seg_bytes;
+	unsigned long long seg_first;	// first record of the current segment
+	unsigned long long rec_cnt;		// records added to this stream
+	unsigned long long bytes;		// bytes written to this stream
+	unsigned long long insns;		// tlbtrace_insns at the last instruction stamp
+	unsigned long long pc_tag[TLBTRACE_MAX_CPUS];	// PC and ASID each CPU is tagged with, ~0 if none
+	unsigned long long tag_seg;		// segment the tags belong to
+	unsigned long long map_seg;		// segment, or block of the ring, the mappings were repeated in, ~0 if none
+	unsigned int map_asid[TLBTRACE_MAX_CPUS];	// ASID each CPU is marked with, TLBTRACE_MAP_NO_ASID if none
+};
+
+/* Main TLB configuration. All configurations are looked up on each reference,
+ * and each one writes the references missing in its main TLB to its own stream. */
+struct TLBTRACE_CONF{
+	int size;
+	int set;
+	int set_step;
+	int set_mask;
+	struct TLBTRACE_CPU cpus[TLBTRACE_MAX_CPUS];
+	struct TLBTRACE_STREAM out;
+};
+
+static struct TLBTRACE_CONF confs[TLBTRACE_MAX_CONFS];
+static int nconf;
+static int nstream;		// streams opened by tlbtrace_start(), a single one in page mode
+
+static unsigned long long systs;	// LRU clock shared by all CPUs
+int tlbtrace_started;			// tested inline by the softmmu hooks
+
+static int fbuf_words;
+
+/* Run-time configuration, see tlbtrace_set_options() */
+static char out_dir[256] = ".";
+static int buf_words = 1024 * 1024 * 8;				// size of fbuf
+static unsigned long long stop_refs;				// stop conditions, 0 if disabled
+static unsigned long long stop_bytes;
+static unsigned long long stop_time_ns;
+static unsigned long long stop_insns;
+static unsigned long long seg_limit;				// bytes per segment, 0 for a single file
+static unsigned long long ring_recs;				// records kept in flight-recorder mode, 0 if disabled
+static unsigned long long ring_time_ns;				// age limit of the records written by a dump
+static unsigned long long stamp_insns = 100000;		// instructions between instruction stamps, 0 if disabled
+static int trace_priv = TLBTRACE_PRIV_USER;			// privilege levels traced by QEMU
+static int tag_pcs;								// records are tagged with the PC of the access
+static int trace_maps;							// mapping changes are written, see tlbtrace_map()
+
+#define RING_BLOCK_WORDS	(1024 * 4)
+#define BUF_MAX_BYTES		(1ULL << 30)		// largest buffer of a stream, or ring, so that its words fit an int
+
+/* Page mode, see tlbtrace_set_options(). Every page transition of each CPU is written to a single stream,
+   and the main TLB is simulated offline. */
+struct PAGE_DEDUP{
+	uint32_t page;
+	uint32_t asid;
+	uint32_t ret;			// traversal result, size and #TLBTRACE_PRIV_FLAG, 0 if empty
+	uint32_t l1, l2, gpa;
+};
+
+static int page_mode;
+static unsigned long long page_last[TLBTRACE_MAX_CPUS];	// last page and ASID of each CPU, ~0 if none
+static struct PAGE_DEDUP *dedup;		// walks already written, mirrored by the simulator
+static unsigned long long dedup_seg;	// segment the walk table belongs to
+static uint32_t pack[3];				// references waiting for a #TLBTRACE_EVENT_REFS record
+static int pack_n;
+
+unsigned long long tlbtrace_insns;
+
+static unsigned int cur_pc[TLBTRACE_MAX_CPUS];	// PC of the current access of each CPU, see tlbtrace_set_pc()
+#define PC_KEY(cpu, asid)	(((unsigned long long)cur_pc[cpu] << 8) | (asid))
+
+/* Filters, see tlbtrace_set_options(). Out-of-scope accesses are dropped before the main TLB lookup. */
+#define FILTER_MAX_RANGES	16
+#define FILTER_MAX_PROCS	8
+#define ASID_BY_OPTION		1		// selected with the asid option
+#define ASID_BY_PROC		2		// selected with the proc option, while its context ID is unchanged
+
+struct FILTER_RANGE{
+	unsigned int start;
+	unsigned int end;		// exclusive
+};
+
+static int filter_on;				// any filter is set
+static int asid_filter;				// only ASIDs in asid_set are traced
+static unsigned char asid_set[256];		// ASID_BY_OPTION or ASID_BY_PROC for a traced ASID
+static struct FILTER_RANGE va_ranges[FILTER_MAX_RANGES];
+static int va_nr;
+static struct FILTER_RANGE pc_ranges[FILTER_MAX_RANGES];
+static int pc_nr;
+static char procs[FILTER_MAX_PROCS][64];	// process names mapped to ASIDs when they are seen
+static int proc_nr;
+static unsigned long long filtered_cnt;
+
+/* Memory mappings of the guest, see tlbtrace_map(). They are kept while the tracer is stopped,
+   since the guest reports each mapping only once. */
+struct TRACE_MAP{
+	uint32_t start;			// first page
+	uint32_t end;			// exclusive
+	uint32_t offset;		// offset in the file
+	uint32_t name;			// index in map_names plus 1, 0 if anonymous
+	unsigned int asid;
+};
 
-static unsigned long long systs;
-static int started;
+static struct TRACE_MAP *maps;
+static int map_nr, map_max;
+static char **map_names;
+static int name_nr, name_max;
 
-static int fout;
-static int fbc;
-static uint32_t *fbuf;
+/* Live statistics, see tlbtrace_get_stats() */
+#define OVH_SAMPLE	64				// time one out of OVH_SAMPLE misses
+static unsigned long long rec_cnt;		// records written to all streams
+static unsigned long long byte_cnt;		// bytes written to all trace files
+static unsigned long long ovh_ns;		// estimated time spent in the tracer
+static unsigned long long start_ns;
+static unsigned long long stop_ns;
 
 static int (*my_pte_helper)(void *arg, uint32_t address, uint32_t *l1, uint32_t *l2, uint32_t *gpa);
 
+static int put_maps(struct TLBTRACE_STREAM *s, void (*put)(struct TLBTRACE_STREAM *s, uint32_t mva, uint32_t l1, uint32_t l2, uint32_t gpa));
+static void dump_record(struct TLBTRACE_STREAM *s, uint32_t mva, uint32_t l1, uint32_t l2, uint32_t gpa);
+
 #ifdef USE_QEMU
 static int get_ptes(void *arg, uint32_t address, uint32_t *l1, uint32_t *l2, uint32_t *gpa);
+static void walk_cache_flush_all(void);
+static void walk_cache_flush_entry(uint32_t va, uint32_t asid);
+static void walk_cache_flush_asid(uint32_t asid);
+static void walk_descs(uint32_t va, uint32_t *l1, uint32_t *l2);
 #endif /* USE_QEMU */
 
 void tlbtrace_stop(void);
 
-static int last_ins_idx = 0;
-static int tlbtrace_refmem_sl(unsigned int addr, unsigned int asid, int ins)
+#define ASID_GLOBAL		0xFFFFFFFF		// tag of the main TLB entries of global mappings
+#define ASID_MATCH(tag, asid)	((tag) == (asid) || (tag) == ASID_GLOBAL)
+
+static int tlbtrace_refmem_sl(struct TLBTRACE_CONF *conf, struct TLBTRACE_CPU *c, unsigned int addr, unsigned int asid, int ins, unsigned int ts)
 {
-	int i, mi = 0;
-	unsigned int mts = sl_tlb[0].ts;
+	struct TLB_ENTRY *sl_tlb = c->sl_tlb;
+	int i, mi = (addr >> 12) & conf->set_mask;		// the victim is chosen within the set
+	unsigned int mts = sl_tlb[mi].ts;
 
 	if(ins){
-		if(sl_tlb[last_ins_idx].va == addr && sl_tlb[last_ins_idx].asid == asid){	// fast path
-			sl_tlb[last_ins_idx].ts = ++systs;
-			sl_cnt.hit++;
+		if(sl_tlb[c->last_ins_idx].va == addr && ASID_MATCH(sl_tlb[c->last_ins_idx].asid, asid)){	// fast path
+			sl_tlb[c->last_ins_idx].ts = ts;
+			c->sl_cnt.hit++;
 			return 1;
 		}
 	}
 
-	for(i = ((addr >> 12) & tlb_set_mask) ;i<tlb_size;i+=tlb_set_step){
-		if(sl_tlb[i].va == addr && sl_tlb[i].asid == asid){	// hit
-			sl_tlb[i].ts = ++systs;
-			sl_cnt.hit++;
-			if(ins)	last_ins_idx = i;
+	for(i = mi ;i<conf->size;i+=conf->set_step){
+		if(sl_tlb[i].va == addr && ASID_MATCH(sl_tlb[i].asid, asid)){	// hit
+			sl_tlb[i].ts = ts;
+			c->sl_cnt.hit++;
+			if(ins)	c->last_ins_idx = i;
 			return 1;
 		}
 
@@ -97,269 +234,1930 @@ static int tlbtrace_refmem_sl(unsigned int addr, unsigned int asid, int ins)
 	// miss and refill with LRU policy
 	sl_tlb[mi].va = addr;
 	sl_tlb[mi].asid = asid;
-	sl_tlb[mi].ts = ++systs;
-	if(ins)	last_ins_idx = mi;
-	sl_cnt.miss++;
+	sl_tlb[mi].ts = ts;
+	if(ins)	c->last_ins_idx = mi;
+	c->fill_idx = mi;
+	c->sl_cnt.miss++;
 
-	if(systs >= 150000000000ULL){
-		tlbtrace_stop();
-		exit(0);
+	return 0;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void segment_name(struct TLBTRACE_STREAM *s, char *buf, int size, int no)
+{
+	snprintf(buf, size, "%s.%04d", s->trace_base, no);
+}
+
+/* Segments are written as <name>.part, and renamed once they are complete. */
+static void open_segment(struct TLBTRACE_STREAM *s)
+{
+	char buf[600];
+
+	segment_name(s, buf, sizeof(buf), s->seg_no);
+	strcat(buf, ".part");
+	s->fout = open(buf, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	s->seg_bytes = 0;
+	s->seg_first = s->bytes / (4 * sizeof(uint32_t));
+}
+
+static void close_segment(struct TLBTRACE_STREAM *s)
+{
+	char part[640], name[600], line[700];
+	int idx;
+
+	close(s->fout);
+	s->fout = -1;
+
+	segment_name(s, name, sizeof(name), s->seg_no);
+	snprintf(part, sizeof(part), "%s.part", name);
+	rename(part, name);
+
+	// index entry: file, first record, records, bytes
+	snprintf(line, sizeof(line), "%s %llu %llu %llu\n", strrchr(name, '/') + 1, s->seg_first,
+			s->seg_bytes / (4 * sizeof(uint32_t)), s->seg_bytes);
+	snprintf(part, sizeof(part), "%s.idx", s->trace_base);
+	if((idx = open(part, O_WRONLY | O_CREAT | O_APPEND, 0644)) >= 0){
+		if(write(idx, line, strlen(line)) < 0)	fprintf(stderr, "[TLBTRACE] can't write %s.\n", part);
+		close(idx);
+	}
+
+	s->seg_no++;
+}
+
+static int write_all(struct TLBTRACE_STREAM *s, const char *p, unsigned long long len)
+{
+	ssize_t n;
+
+	while(len > 0){
+		if((n = write(s->fout, p, len)) <= 0){
+			fprintf(stderr, "[TLBTRACE] write error, %llu bytes dropped.\n", len);
+			return -1;
+		}
+		p += n;
+		len -= n;
+		byte_cnt += n;
+		s->bytes += n;
+		s->seg_bytes += n;
 	}
 
 	return 0;
 }
 
-/* Main function of PWC method */
-static void tlbtrace_refmem_pwc(unsigned int addr, void *arg)
+static void write_trace(struct TLBTRACE_STREAM *s, const char *p, unsigned long long len)
 {
-	uint32_t l1_ppa = 0, l2_ppa = 0, gpa = 0;
-	int ret;
+	unsigned long long room;
 
-	// get the PPAs of the PTEs
-	ret = my_pte_helper(arg, addr, &l1_ppa, &l2_ppa, &gpa);		// ret: 1 if section or fault, 2 if the walk is completed
-	fbuf[fbc++] = addr | ret;
-	fbuf[fbc++] = l1_ppa;
-	fbuf[fbc++] = l2_ppa;
-	fbuf[fbc++] = gpa;
+	if(seg_limit == 0){
+		write_all(s, p, len);
+		return;
+	}
+
+	while(len > 0){
+		if(s->fout < 0)	open_segment(s);
+
+		room = seg_limit - s->seg_bytes;
+		if(room > len)	room = len;
+		if(write_all(s, p, room) != 0)	return;
+		p += room;
+		len -= room;
 
-	if(fbc == 1024 * 1024 * 8){
-		write(fout, fbuf, sizeof(uint32_t) * 1024 * 1024 * 8);
-		fbc = 0;
+		if(s->seg_bytes == seg_limit)	close_segment(s);
 	}
 }
 
+/* Write the ring, oldest record first, to a new segment and empty it. */
+static void ring_dump(struct TLBTRACE_STREAM *s)
+{
+	unsigned long long t0 = now_ns(), cutoff = 0;
+	int first = s->ring_full ? s->fbc : 0;	// oldest word
+	int words = s->ring_full ? fbuf_words : s->fbc;
 
-void tlbtrace_refmem(unsigned int addr, unsigned int asid, int ins, void *arg)
+	if(ring_time_ns != 0 && t0 > ring_time_ns)	cutoff = t0 - ring_time_ns;
+
+	// skip blocks which are older than ring_time, i.e. the next block was started before the cutoff
+	while(words > 0){
+		int skip = RING_BLOCK_WORDS - first % RING_BLOCK_WORDS;
+		int next = (first + skip) % fbuf_words;
+
+		if(skip >= words || s->ring_ts[next / RING_BLOCK_WORDS] >= cutoff)	break;
+		first = next;
+		words -= skip;
+	}
+
+	if(words > 0){
+		open_segment(s);
+		s->seg_first = s->rec_cnt - words / 4;
+		if(trace_maps)	s->seg_first -= put_maps(s, dump_record);		// the mappings of the oldest records may be gone
+		if(first + words <= fbuf_words){
+			write_all(s, (const char*)&s->fbuf[first], words * sizeof(uint32_t));
+		}else{
+			write_all(s, (const char*)&s->fbuf[first], (fbuf_words - first) * sizeof(uint32_t));
+			write_all(s, (const char*)s->fbuf, (first + words - fbuf_words) * sizeof(uint32_t));
+		}
+		close_segment(s);
+		fprintf(stderr, "[TLBTRACE] dumped %d records to %s.\n", words / 4, s->trace_base);
+	}
+
+	s->fbc = 0;
+	s->ring_full = 0;
+
+	ovh_ns += now_ns() - t0;
+}
+
+int tlbtrace_trigger(void)
 {
-	addr = addr & 0xFFFFF000;
+	int k;
 
-	if(tlbtrace_refmem_sl(addr, asid, ins) != 0)		return;		// hit in first level TLB
+	if(!tlbtrace_started || ring_recs == 0)	return -1;
 
-	tlbtrace_refmem_pwc(addr, arg);						// simulate PWC
+	for(k = 0; k < nstream; k++)
+		ring_dump(&confs[k].out);
+	return 0;
 }
 
-#define FLUSH_TLB(tlb, size)		do{ \
-	int _idx_; \
-	for(_idx_ = 0; _idx_ < size; _idx_++){\
-		tlb[_idx_].va = 0xFFFFFFFF; \
-		tlb[_idx_].asid = 0; \
-		tlb[_idx_].ts = 0; \
-	} \
-}while(0)
+static void flush_buffer(struct TLBTRACE_STREAM *s)
+{
+	unsigned long long t0 = now_ns();
 
-#define FLUSH_TLB_ENTRY(tlb, size, _va, _asid)		do{ \
-	int _idx_; \
-	for(_idx_ = 0; _idx_ < size; _idx_++){\
-		if((tlb[_idx_].va != (_va)) || (tlb[_idx_].asid != (_asid)))	continue; \
-		tlb[_idx_].va = 0xFFFFFFFF; \
-		tlb[_idx_].asid = 0; \
-		tlb[_idx_].ts = 0; \
-	} \
-}while(0)
+	write_trace(s, (const char*)s->fbuf, s->fbc * sizeof(uint32_t));
+	s->fbc = 0;
 
-#define FLUSH_TLB_ASID(tlb, size, _asid)		do{ \
-	int _idx_; \
-	for(_idx_ = 0; _idx_ < size; _idx_++){\
-		if(tlb[_idx_].asid != _asid)	continue; \
-		tlb[_idx_].va = 0xFFFFFFFF; \
-		tlb[_idx_].asid = 0; \
-		tlb[_idx_].ts = 0; \
-	} \
-}while(0)
+	ovh_ns += now_ns() - t0;
+}
+#ifdef USE_QEMU
+static QEMUBH *state_bh;
+static int stop_pending;
+static int start_pending;
 
-#define INIT_TLB(tlb, size, cnt)		do{ \
-	FLUSH_TLB(tlb, size);	\
-	cnt.miss = cnt.hit = 0; \
-}while(0)
+/* Starting and stopping flush the QEMU TLBs and the TB cache, which is not allowed
+   inside a helper. Requests made by helpers are deferred to the main loop. */
+static void tlbtrace_state_bh(void *opaque)
+{
+	if(stop_pending){
+		stop_pending = 0;
+		tlbtrace_stop();
+		tb_flush(first_cpu);
+	}
+
+	if(start_pending){
+		start_pending = 0;
+		tlbtrace_start();
+		tb_flush(first_cpu);
+	}
+}
 
-void tlbtrace_flush_all()
+static void request_state(int on)
 {
-	if(!started)	return;
-	FLUSH_TLB(sl_tlb, tlb_size);
+	if(on){
+		if(tlbtrace_started || start_pending)	return;
+		start_pending = 1;
+	}else if(start_pending){
+		start_pending = 0;			// cancel the pending start
+		return;
+	}else{
+		if(!tlbtrace_started)	return;
+		tlbtrace_started = 0;		// ignore further references until the trace is closed
+		stop_pending = 1;
+	}
+
+	qemu_bh_schedule(state_bh);
+	if(cpu_single_env != NULL)	cpu_exit(cpu_single_env);
 }
+#endif /* USE_QEMU */
 
-void tlbtrace_flush_entry(unsigned long va)
+/* Put a record in the buffer of a stream, or in its ring in flight-recorder mode. */
+static inline void put_record(struct TLBTRACE_STREAM *s, uint32_t mva, uint32_t l1, uint32_t l2, uint32_t gpa)
 {
-	if(!started)	return;
-	FLUSH_TLB_ENTRY(sl_tlb, tlb_size, va & 0xFFFFF000, va & 0xFF);
+	uint32_t *fbuf = s->fbuf;
+
+	if(s->ring_ts != NULL && s->fbc % RING_BLOCK_WORDS == 0)	s->ring_ts[s->fbc / RING_BLOCK_WORDS] = now_ns();
+
+	fbuf[s->fbc++] = mva;
+	fbuf[s->fbc++] = l1;
+	fbuf[s->fbc++] = l2;
+	fbuf[s->fbc++] = gpa;
+	s->rec_cnt++;
+	rec_cnt++;
+
+	if(s->fbc == fbuf_words){
+		if(ring_recs != 0){			// wrap around, overwriting the oldest records
+			s->fbc = 0;
+			s->ring_full = 1;
+		}else{
+			flush_buffer(s);
+		}
+	}
 }
 
-void tlbtrace_flush_asid(unsigned long asid)
+/* Write the instructions executed since the last stamp of a stream, LEB128-encoded. */
+static void put_stamp(struct TLBTRACE_STREAM *s)
 {
-	if(!started)	return;
-	FLUSH_TLB_ASID(sl_tlb, tlb_size, asid);
+	unsigned long long delta = tlbtrace_insns - s->insns;
+	uint8_t b[12];
+	uint32_t w[3];
+	int n = 0;
+
+	memset(b, 0, sizeof(b));
+	do{
+		b[n] = delta & 0x7F;
+		delta >>= 7;
+		if(delta != 0)	b[n] |= 0x80;
+		n++;
+	}while(delta != 0);		// at most 10 bytes
+	memcpy(w, b, sizeof(w));
+
+	put_record(s, TLBTRACE_EVENT_INSNS << TLBTRACE_EVENT_SHIFT, w[0], w[1], w[2]);
+	s->insns = tlbtrace_insns;
 }
 
+/* Add a record to a stream, after an instruction stamp if the period has elapsed. */
+static inline void add_record(struct TLBTRACE_STREAM *s, uint32_t mva, uint32_t l1, uint32_t l2, uint32_t gpa)
+{
+	if(stamp_insns != 0 && tlbtrace_insns - s->insns >= stamp_insns)	put_stamp(s);
+	put_record(s, mva, l1, l2, gpa);
+}
 
-#ifdef USE_QEMU
-static int pcnt = 0;
-void tlbtrace_refmem_qemu(unsigned int addr, int ins)
+/* Records per segment that PC tags are reset in, 0 if the stream is a single file or a ring. */
+static inline unsigned long long tag_recs(void)
 {
-	CPUState *env = first_cpu;	// global variable provided by QEMU
-	unsigned int asid;
+	return ring_recs == 0 ? seg_limit / (4 * sizeof(uint32_t)) : 0;
+}
 
-	if(!started)	return;
-	if((env->uncached_cpsr & CPSR_M) != ARM_CPU_MODE_USR)	return;			// we only trace access in user mode
+static void untag(struct TLBTRACE_STREAM *s, unsigned long long seg)
+{
+	int i;
 
-	asid = env->cp15.c13_context & 0xFF;
+	for(i = 0; i < TLBTRACE_MAX_CPUS; i++)
+		s->pc_tag[i] = ~0ULL;
+	s->tag_seg = seg;
+}
 
-	//if(pcnt++ < 100)	fprintf(stderr, "[TLBTRACE] addr=0x%08X, asid=0x%08X\n", addr, asid);
-	tlbtrace_refmem(addr, asid, ins, first_cpu);
+/* Whether the next record of \a cpu in a stream is already tagged with its PC and \a asid. */
+static inline int pc_tagged(struct TLBTRACE_STREAM *s, int cpu, unsigned int asid)
+{
+	unsigned long long recs = tag_recs();
 
+	return s->pc_tag[cpu] == PC_KEY(cpu, asid) && (recs == 0 || s->rec_cnt / recs == s->tag_seg);
 }
 
-static uint32_t get_level1_table_address(CPUState *env, uint32_t address)
+/* Write a #TLBTRACE_EVENT_PC event before the next record of \a cpu if its PC or ASID changed.
+   Each segment starts untagged, so a tag is always in the same segment as the record following it. */
+static void tag_pc(struct TLBTRACE_STREAM *s, int cpu, unsigned int asid)
 {
-    uint32_t table;
+	uint32_t mva = (TLBTRACE_EVENT_PC << TLBTRACE_EVENT_SHIFT) | (cpu << TLBTRACE_CPU_SHIFT);
+	unsigned long long recs = tag_recs();
 
-    if (address & env->cp15.c2_mask)
-        table = env->cp15.c2_base1 & 0xffffc000;
-    else
-        table = env->cp15.c2_base0 & env->cp15.c2_base_mask;
+	if(stamp_insns != 0 && tlbtrace_insns - s->insns >= stamp_insns)	put_stamp(s);	// not between the tag and the record
+	if(recs != 0 && s->rec_cnt / recs != s->tag_seg)	untag(s, s->rec_cnt / recs);
+	if(pc_tagged(s, cpu, asid))	return;
 
-    table |= (address >> 18) & 0x3ffc;
-    return table;
+	if(recs != 0 && (s->rec_cnt + 1) % recs == 0){
+		put_record(s, mva, cur_pc[cpu], asid, 0);		// would end the segment, so it is repeated in the next one
+		untag(s, s->rec_cnt / recs);
+	}
+	put_record(s, mva, cur_pc[cpu], asid, 0);
+	s->pc_tag[cpu] = PC_KEY(cpu, asid);
 }
 
-static int get_ptes(void *arg, uint32_t address, uint32_t *l1, uint32_t *l2, uint32_t *gpa)
+/* Write the parts of a file name, 12 characters each, the last one including the terminating NUL. */
+static int put_name(struct TLBTRACE_STREAM *s, void (*put)(struct TLBTRACE_STREAM *s, uint32_t mva, uint32_t l1, uint32_t l2, uint32_t gpa), uint32_t id)
 {
-	CPUState *env = arg;
-	int type;
-    uint32_t table;
-    uint32_t desc;
-    int domain;
+	const char *name = map_names[id - 1];
+	int len = strlen(name) + 1, part;
 
-    /* Pagetable walk.  */
-    /* Lookup l1 descriptor.  */
-    *l1 = table = get_level1_table_address(env, address);
-    desc = ldl_phys(table);
-    type = (desc & 3);
+	for(part = 0; part * 12 < len; part++){
+		uint32_t w[3] = {0, 0, 0};
 
-	if(type == 0 || type == 3){					/* Section translation fault.  */
-		return 1;
-    }else if(type == 2 && (desc & (1 << 18))) {	/* Supersection.  */
-        domain = 0;
-    }else{										/* Section or page.  */
-        domain = (desc >> 4) & 0x1e;
-    }
+		memcpy(w, name + part * 12, len - part * 12 < 12 ? len - part * 12 : 12);
+		put(s, (id << TLBTRACE_NAME_SHIFT) | (TLBTRACE_EVENT_NAME << TLBTRACE_EVENT_SHIFT) | (part << TLBTRACE_CPU_SHIFT), w[0], w[1], w[2]);
+	}
 
-    domain = (env->cp15.c3 >> domain) & 3;
-    if(domain == 0 || domain == 2){
-		return 1;
-    }
+	return part;
+}
 
-	if(type == 2)	return 1;
-	
-	/* Lookup l2 entry.  */
-	*l2 = table = (desc & 0xfffffc00) | ((address >> 10) & 0x3fc);
+static inline uint32_t map_mva(int cpu, uint32_t start)
+{
+	return start | (TLBTRACE_EVENT_MAP << TLBTRACE_EVENT_SHIFT) | (cpu << TLBTRACE_CPU_SHIFT);
+}
 
-	desc = ldl_phys(table);
-	if((desc & 0x3) == 0)	return 2;
+/* Write every file name and live mapping, so that the following records can be attributed without
+   the previous segments. Returns the number of records. */
+static int put_maps(struct TLBTRACE_STREAM *s, void (*put)(struct TLBTRACE_STREAM *s, uint32_t mva, uint32_t l1, uint32_t l2, uint32_t gpa))
+{
+	int i, n = 0;
 
-	*gpa = (desc & 0xFFFFF000);
+	for(i = 0; i < name_nr; i++)
+		n += put_name(s, put, i + 1);
+	for(i = 0; i < map_nr; i++, n++)
+		put(s, map_mva(0, maps[i].start), maps[i].end | (TLBTRACE_MAP_ADD << TLBTRACE_MAP_OP_SHIFT) | maps[i].asid, maps[i].offset, maps[i].name);
 
-	return 3;
+	return n;
 }
 
-
-static int pccnt = 0;
-void REGPARM qemu_trace_pc_helper(unsigned int pc)
+/* Write a record straight to the segment of a ring dump. */
+static void dump_record(struct TLBTRACE_STREAM *s, uint32_t mva, uint32_t l1, uint32_t l2, uint32_t gpa)
 {
-	if(!started)	return;
-	tlbtrace_refmem_qemu(pc, 1);
+	uint32_t r[4] = {mva, l1, l2, gpa};
+
+	write_all(s, (const char*)r, sizeof(r));
 }
 
-#endif /* USE_QEMU */
+/* Segment of the next record of a stream, or its block in flight-recorder mode. */
+static inline unsigned long long map_pos(struct TLBTRACE_STREAM *s)
+{
+	unsigned long long recs = tag_recs();
 
-void tlbtrace_start(void)
+	if(ring_recs != 0)	return s->rec_cnt / (RING_BLOCK_WORDS / 4);
+	return recs != 0 ? s->rec_cnt / recs : 0;
+}
+
+/* Repeat the live mappings at the start of each segment, and forget the ASIDs the CPUs are marked with.
+   A dump of the ring starts with the mappings instead, and the ASIDs are marked again in each block of the ring. */
+static void maps_segment(struct TLBTRACE_STREAM *s)
 {
-	fprintf(stderr, "[TLBTRACE] starting... (%s:%d)\n", __FUNCTION__, __LINE__);
-	fprintf(stderr, "[TLBTRACE] CONFIG => %d, %d-WAY\n", tlb_size, tlb_set);
+	int i;
 
-#ifdef USE_QEMU
-	tlb_flush(first_cpu, 1);
-#endif /* USE_QEMU */
+	if(!trace_maps || map_pos(s) == s->map_seg)	return;
 
-	time_t now = time(NULL);
-	struct tm tm;
-	char buf[256];
-	localtime_r(&now, &tm);
-	snprintf(buf, 256, "trace_%02d%02d_%02d%02d_%d.%d", tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tlb_size, tlb_set);
-	fout = open(buf, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-	fbc = 0;
-	fbuf = malloc(1024 * 1024 * 8 * sizeof(uint32_t));
+	if(ring_recs == 0)	put_maps(s, put_record);
+	s->map_seg = map_pos(s);		// a table larger than a segment is not repeated again
+	for(i = 0; i < TLBTRACE_MAX_CPUS; i++)
+		s->map_asid[i] = TLBTRACE_MAP_NO_ASID;
+}
 
-	fprintf(stderr, "[TLBTRACE] FILE=%s\n", buf);
+/* Write a #TLBTRACE_MAP_ASID event before the next record of \a cpu if its ASID changed.
+   Records of miss mode do not hold the ASID, which selects the mappings they are attributed to. */
+static inline void map_asid(struct TLBTRACE_STREAM *s, int cpu, unsigned int asid)
+{
+	if(!trace_maps)	return;
 
-	systs = 0;
+	if(stamp_insns != 0 && tlbtrace_insns - s->insns >= stamp_insns)	put_stamp(s);	// not between the event and the record
+	for(maps_segment(s); s->map_asid[cpu] != asid; maps_segment(s)){		// until the event is in the segment of the record
+		put_record(s, map_mva(cpu, 0), (TLBTRACE_MAP_ASID << TLBTRACE_MAP_OP_SHIFT) | asid, 0, 0);
+		s->map_asid[cpu] = asid;
+	}
+}
+
+/* Bytes of the trace, including the buffered records. */
+static unsigned long long trace_bytes(void)
+{
+	unsigned long long bytes = byte_cnt;
+	int k;
+
+	if(ring_recs == 0){
+		for(k = 0; k < nstream; k++)
+			bytes += confs[k].out.fbc * sizeof(uint32_t);
+	}
 
-	INIT_TLB(sl_tlb, tlb_size, sl_cnt);
+	return bytes;
 }
 
-void tlbtrace_stop(void)
+/* Stop the tracer if a limit is reached. The wall time is only read if \a time is set. */
+static void check_stop(int time)
 {
+	const char *reason = NULL;
+
+	if(stop_refs != 0 && systs >= stop_refs)	reason = "references";
+	else if(stop_bytes != 0 && trace_bytes() >= stop_bytes)	reason = "bytes";
+	else if(stop_insns != 0 && tlbtrace_insns >= stop_insns)	reason = "instructions";
+	else if(stop_time_ns != 0 && time && now_ns() - start_ns >= stop_time_ns)	reason = "time";
+
+	if(reason == NULL)	return;
+
+	fprintf(stderr, "[TLBTRACE] stop condition reached (%s).\n", reason);
+
 #ifdef USE_QEMU
-	tlb_flush(first_cpu, 1);
+	request_state(0);
+#else
+	tlbtrace_stop();
 #endif /* USE_QEMU */
+}
 
-	if(fbc > 0){
-		write(fout, fbuf, fbc * sizeof(uint32_t));
-	}
-	free(fbuf);
+/* Main function of PWC method. The walk is done once, and recorded in the stream of each
+   configuration in \a missed. */
+static void tlbtrace_refmem_pwc(int cpu, unsigned int addr, unsigned int asid, uint32_t priv, void *arg, unsigned int missed)
+{
+	uint32_t l1_ppa = 0, l2_ppa = 0, gpa = 0;
+	unsigned long long t0 = 0;
+	int ret, k;
 
-	close(fout);
+	if(rec_cnt % OVH_SAMPLE == 0)	t0 = now_ns();
 
-	fprintf(stderr, "[TLBTRACE] stopping... (%s:%d)\n", __FUNCTION__, __LINE__);
+	// get the PPAs of the PTEs
+	ret = my_pte_helper(arg, addr, &l1_ppa, &l2_ppa, &gpa);		// ret: traversal result, size code and #TLBTRACE_GLOBAL, see tlbtrace_init()
+	for(k = 0; k < nconf; k++){
+		if(!(missed & (1 << k)))	continue;
+		if(ret & TLBTRACE_GLOBAL)	confs[k].cpus[cpu].sl_tlb[confs[k].cpus[cpu].fill_idx].asid = ASID_GLOBAL;	// hit by any ASID from now on
+		map_asid(&confs[k].out, cpu, asid & 0xFF);
+		if(tag_pcs){
+			tag_pc(&confs[k].out, cpu, asid & 0xFF);
+			map_asid(&confs[k].out, cpu, asid & 0xFF);		// the tag may have started a segment
+		}
+		add_record(&confs[k].out, addr | (cpu << TLBTRACE_CPU_SHIFT) | priv | (ret & ~TLBTRACE_GLOBAL), l1_ppa, l2_ppa, gpa);
+	}
 
-	fprintf(stderr, "ITEM\t%20s\t%20s\thit ratio\n", "hit", "miss");
+	if(t0 != 0)	ovh_ns += (now_ns() - t0) * OVH_SAMPLE;
 
-	fprintf(stderr, "TLB\t%20llu\t%20llu\t%.5lf\n", sl_cnt.hit, sl_cnt.miss, 
-			100.0 * (double)sl_cnt.hit / (double)(sl_cnt.hit + sl_cnt.miss));
+	check_stop((rec_cnt & 0x3FF) == 0);
 }
 
-void tlbtrace_toggle(void)
+/* The packed references are written before any other record. */
+static void pages_flush(void)
 {
-	started = !started;
-	if(started)	tlbtrace_start();
-	else		tlbtrace_stop();
+	if(pack_n == 0)	return;
+
+	// the stamp due was written when the pack started, so it stays in the segment of its walks
+	put_record(&confs[0].out, (TLBTRACE_EVENT_REFS << TLBTRACE_EVENT_SHIFT) | (pack_n << TLBTRACE_REFS_SHIFT), pack[0], pack[1], pack[2]);
+	pack[0] = pack[1] = pack[2] = 0;
+	pack_n = 0;
 }
 
-int tlbtrace_enabled(void)
+/* Start with an empty walk table in each segment, so that segments can be simulated one by one. */
+static void pages_segment(struct TLBTRACE_STREAM *s)
 {
-	return started;
+	unsigned long long seg;
+
+	if(seg_limit == 0)	return;
+
+	seg = s->rec_cnt / (seg_limit / (4 * sizeof(uint32_t)));		// segment of the next record
+	if(seg != dedup_seg){
+		memset(dedup, 0, sizeof(struct PAGE_DEDUP) << TLBTRACE_DEDUP_BITS);
+		dedup_seg = seg;
+	}
 }
 
-int tlbtrace_init(int size, int set, int (*pte_helper)(void* arg, uint32_t addr, uint32_t *l1, uint32_t *l2, uint32_t *pa))
+/* Main function of page mode. A walk is written once per page and packed references are
+   written afterwards, until the walk of the page changes. */
+static void tlbtrace_refmem_page(int cpu, unsigned int addr, unsigned int asid, uint32_t priv, void *arg)
 {
-	fprintf(stderr, "[TLBTRACE] initializing... (%s:%d)\n", __FUNCTION__, __LINE__);
-	started = 0;
+	struct TLBTRACE_STREAM *s = &confs[0].out;
+	struct PAGE_DEDUP *e = &dedup[TLBTRACE_DEDUP_IDX(addr, asid)];
+	uint32_t l1_ppa = 0, l2_ppa = 0, gpa = 0;
+	unsigned long long t0 = 0;
+	int ret;
 
-	tlb_size = size;
-	tlb_set = set;
-	tlb_set_step = size / set;
-	tlb_set_mask = tlb_set_step - 1;
+	if(rec_cnt % OVH_SAMPLE == 0)	t0 = now_ns();
 
-	sl_tlb = (struct TLB_ENTRY*)malloc(sizeof(struct TLB_ENTRY) * tlb_size);
+	ret = my_pte_helper(arg, addr, &l1_ppa, &l2_ppa, &gpa);
+	gpa &= 0xFFFFF000;
+	if(tag_pcs && !pc_tagged(s, cpu, asid)){		// the packed references keep the previous tags
+		pages_flush();
+		tag_pc(s, cpu, asid);
+	}
+	if(pack_n == 0){		// a new pack is written at the current position
+		if(stamp_insns != 0 && tlbtrace_insns - s->insns >= stamp_insns)	put_stamp(s);	// not between the segment and the pack
+		maps_segment(s);
+		pages_segment(s);
+	}
 
-#ifdef USE_QEMU
-	my_pte_helper = get_ptes;
-#else
-	my_pte_helper = pte_helper;
-#endif /* USE_QEMU */
+	// the ring overwrites the oldest walks, so its references are never packed
+	if(ring_recs == 0 && e->ret == (priv | ret) && e->page == addr && e->asid == asid &&
+			e->l1 == l1_ppa && e->l2 == l2_ppa && e->gpa == gpa){
+		pack[pack_n++] = addr | (cpu << TLBTRACE_CPU_SHIFT) | asid;
+		if(pack_n == 3)	pages_flush();
+	}else{
+		pages_flush();
+		if(tag_pcs)	tag_pc(s, cpu, asid);		// the pack may have ended the segment
+		if(stamp_insns != 0 && tlbtrace_insns - s->insns >= stamp_insns)	put_stamp(s);	// not between the segment and the walk
+		maps_segment(s);
+		pages_segment(s);
+		e->page = addr;
+		e->asid = asid;
+		e->ret = priv | ret;
+		e->l1 = l1_ppa;
+		e->l2 = l2_ppa;
+		e->gpa = gpa;
+		add_record(s, addr | (cpu << TLBTRACE_CPU_SHIFT) | TLBTRACE_PAGE_FLAG | priv | (ret & ~TLBTRACE_GLOBAL), l1_ppa, l2_ppa, gpa | (ret & TLBTRACE_GLOBAL) | asid);
+	}
+
+	if(t0 != 0)	ovh_ns += (now_ns() - t0) * OVH_SAMPLE;
+
+	check_stop((rec_cnt & 0x3FF) == 0);
+}
+
+static int in_ranges(const struct FILTER_RANGE *r, int n, unsigned int addr)
+{
+	int i;
+
+	for(i = 0; i < n; i++)
+		if(addr >= r[i].start && addr < r[i].end)	return 1;
 
 	return 0;
 }
 
-void tlbtrace_destroy(void)
+static int filter_pass(unsigned int asid, unsigned int addr)
 {
-	fprintf(stderr, "[TLBTRACE] destroying... (%s:%d)\n", __FUNCTION__, __LINE__);
+	if(asid_filter && (asid >= 256 || !asid_set[asid]))	return 0;
+	if(va_nr != 0 && !in_ranges(va_ranges, va_nr, addr))	return 0;
+
+	return 1;
+}
+
+/* Trace an access. \a priv is #TLBTRACE_PRIV_FLAG for an access made in a privileged mode, 0 otherwise. */
+static void refmem(int cpu, unsigned int addr, unsigned int asid, int ins, uint32_t priv, void *arg)
+{
+	unsigned long long key;
+	unsigned int missed = 0, ts;
+	int k;
+
+	if(!tlbtrace_started)	return;
 
-	started = 0;
+	if(filter_on && !filter_pass(asid, addr)){
+		filtered_cnt++;
+		return;
+	}
+
+	addr = addr & 0xFFFFF000;
+	ts = ++systs;
+
+	// the limits are also checked while the accesses hit, which write no record
+	if((ts & 0xFFFF) == 0 || (stop_refs != 0 && systs >= stop_refs) || (stop_insns != 0 && tlbtrace_insns >= stop_insns)){
+		check_stop((ts & 0xFFFF) == 0);
+		if(!tlbtrace_started)	return;
+	}
+
+	if(page_mode){
+		asid &= 0xFF;
+		key = ((unsigned long long)addr << 8) | asid;
+		if(page_last[cpu] == key){		// same page as the last access, a hit in any main TLB
+			confs[0].cpus[cpu].sl_cnt.hit++;
+			return;
+		}
+		page_last[cpu] = key;
+		confs[0].cpus[cpu].sl_cnt.miss++;
+		tlbtrace_refmem_page(cpu, addr, asid, priv, arg);
+		return;
+	}
 
-	if(sl_tlb != NULL){
-		free(sl_tlb);
-		sl_tlb = NULL;
+	for(k = 0; k < nconf; k++){
+		if(tlbtrace_refmem_sl(&confs[k], &confs[k].cpus[cpu], addr, asid, ins, ts) == 0)	missed |= 1 << k;
 	}
+	if(missed == 0)	return;		// hit in first level TLB of every configuration
+
+	tlbtrace_refmem_pwc(cpu, addr, asid, priv, arg, missed);			// simulate PWC
+}
+
+void tlbtrace_refmem_cpu(int cpu, unsigned int addr, unsigned int asid, int ins, void *arg)
+{
+	refmem(cpu, addr, asid, ins, 0, arg);
+}
+
+void tlbtrace_refmem(unsigned int addr, unsigned int asid, int ins, void *arg)
+{
+	tlbtrace_refmem_cpu(0, addr, asid, ins, arg);
+}
+
+void tlbtrace_set_pc(int cpu, unsigned int pc)
+{
+	cur_pc[cpu] = pc;
+}
+
+void tlbtrace_marker(int cpu, const char *name)
+{
+	uint32_t w[3] = {0, 0, 0};
+	int k;
+
+	if(!tlbtrace_started)	return;
+
+	memcpy(w, name, strnlen(name, sizeof(w)));
+	if(page_mode)	pages_flush();
+	for(k = 0; k < nstream; k++)
+		add_record(&confs[k].out, (TLBTRACE_EVENT_MARKER << TLBTRACE_EVENT_SHIFT) | (cpu << TLBTRACE_CPU_SHIFT), w[0], w[1], w[2]);
+	fprintf(stderr, "[TLBTRACE] marker %.12s at record %llu\n", name, confs[0].out.rec_cnt - 1);
+}
+
+#define FLUSH_TLB(tlb, size)		do{ \
+	int _idx_; \
+	for(_idx_ = 0; _idx_ < size; _idx_++){\
+		tlb[_idx_].va = 0xFFFFFFFF; \
+		tlb[_idx_].asid = 0; \
+		tlb[_idx_].ts = 0; \
+	} \
+}while(0)
+
+#define FLUSH_TLB_ENTRY(tlb, size, _va, _asid)		do{ \
+	int _idx_; \
+	for(_idx_ = 0; _idx_ < size; _idx_++){\
+		if((tlb[_idx_].va != (_va)) || !ASID_MATCH(tlb[_idx_].asid, _asid))	continue; \
+		tlb[_idx_].va = 0xFFFFFFFF; \
+		tlb[_idx_].asid = 0; \
+		tlb[_idx_].ts = 0; \
+	} \
+}while(0)
+
+#define FLUSH_TLB_VA(tlb, size, _va)		do{ \
+	int _idx_; \
+	for(_idx_ = 0; _idx_ < size; _idx_++){\
+		if(tlb[_idx_].va != (_va))	continue; \
+		tlb[_idx_].va = 0xFFFFFFFF; \
+		tlb[_idx_].asid = 0; \
+		tlb[_idx_].ts = 0; \
+	} \
+}while(0)
+
+#define FLUSH_TLB_ASID(tlb, size, _asid)		do{ \
+	int _idx_; \
+	for(_idx_ = 0; _idx_ < size; _idx_++){\
+		if(tlb[_idx_].asid != _asid)	continue; \
+		tlb[_idx_].va = 0xFFFFFFFF; \
+		tlb[_idx_].asid = 0; \
+		tlb[_idx_].ts = 0; \
+	} \
+}while(0)
+
+#define INIT_TLB(tlb, size, cnt)		do{ \
+	FLUSH_TLB(tlb, size);	\
+	cnt.miss = cnt.hit = 0; \
+}while(0)
+
+/* CPU issuing the current TLB maintenance operation, or -1 if it is not traced. */
+static int current_cpu(void)
+{
+#ifdef USE_QEMU
+	if(cpu_single_env != NULL){
+		if(cpu_single_env->cpu_index >= TLBTRACE_MAX_CPUS)	return -1;
+		return cpu_single_env->cpu_index;
+	}
+#endif /* USE_QEMU */
+	return 0;
+}
+
+/* Write an invalidation record to every stream, so that the simulator replays it. */
+static void add_flush(int cpu, int op, uint32_t va, uint32_t asid)
+{
+	uint32_t l1 = 0, l2 = 0;
+	int k;
+
+#ifdef USE_QEMU
+	if(op == TLBTRACE_FLUSH_ENTRY || op == TLBTRACE_FLUSH_MVA)	walk_descs(va, &l1, &l2);
+#endif /* USE_QEMU */
+
+	if(page_mode)	pages_flush();
+	for(k = 0; k < nstream; k++)
+		add_record(&confs[k].out, va | (TLBTRACE_EVENT_FLUSH << TLBTRACE_EVENT_SHIFT) | (cpu << TLBTRACE_CPU_SHIFT), op | (asid << 8), l1, l2);
+}
+
+void tlbtrace_flush_all(void)
+{
+	int cpu, k;
+
+	if(!tlbtrace_started || (cpu = current_cpu()) < 0)	return;
+	page_last[cpu] = ~0ULL;		// the next access is written in page mode
+	for(k = 0; k < nconf; k++)
+		FLUSH_TLB(confs[k].cpus[cpu].sl_tlb, confs[k].size);
+#ifdef USE_QEMU
+	walk_cache_flush_all();
+#endif /* USE_QEMU */
+	add_flush(cpu, TLBTRACE_FLUSH_ALL, 0, 0);
+}
+
+void tlbtrace_flush_entry(unsigned long va)
+{
+	int cpu, k;
+
+	if(!tlbtrace_started || (cpu = current_cpu()) < 0)	return;
+	page_last[cpu] = ~0ULL;		// the next access is written in page mode
+	for(k = 0; k < nconf; k++)
+		FLUSH_TLB_ENTRY(confs[k].cpus[cpu].sl_tlb, confs[k].size, va & 0xFFFFF000, va & 0xFF);
+#ifdef USE_QEMU
+	walk_cache_flush_entry(va & 0xFFFFF000, va & 0xFF);
+#endif /* USE_QEMU */
+	add_flush(cpu, TLBTRACE_FLUSH_ENTRY, va & 0xFFFFF000, va & 0xFF);
+}
+
+void tlbtrace_flush_asid(unsigned long asid)
+{
+	int cpu, k;
+
+	if(!tlbtrace_started || (cpu = current_cpu()) < 0)	return;
+	page_last[cpu] = ~0ULL;		// the next access is written in page mode
+	for(k = 0; k < nconf; k++)
+		FLUSH_TLB_ASID(confs[k].cpus[cpu].sl_tlb, confs[k].size, asid);
+#ifdef USE_QEMU
+	walk_cache_flush_asid(asid & 0xFF);
+#endif /* USE_QEMU */
+	add_flush(cpu, TLBTRACE_FLUSH_ASID, 0, asid & 0xFF);
+}
+
+void tlbtrace_flush_mva(unsigned long va)
+{
+	int cpu, k;
+#ifdef USE_QEMU
+	int i;
+#endif /* USE_QEMU */
+
+	if(!tlbtrace_started || (cpu = current_cpu()) < 0)	return;
+	page_last[cpu] = ~0ULL;
+	va &= 0xFFFFF000;
+	for(k = 0; k < nconf; k++)
+		FLUSH_TLB_VA(confs[k].cpus[cpu].sl_tlb, confs[k].size, va);
+#ifdef USE_QEMU
+	for(i = 0; i < 256; i++)
+		walk_cache_flush_entry(va, i);
+#endif /* USE_QEMU */
+	add_flush(cpu, TLBTRACE_FLUSH_MVA, va, 0);
+}
+
+/* Index plus 1 of a file name, which is added if it is new. Returns 0 if it can't be added. */
+static uint32_t map_name(const char *path, int *added)
+{
+	char **names;
+	int i;
+
+	*added = 0;
+	for(i = 0; i < name_nr; i++){
+		if(strncmp(map_names[i], path, TLBTRACE_NAME_MAX - 1) == 0)	return i + 1;
+	}
+
+	if(name_nr == name_max){
+		if(name_nr == (1 << (32 - TLBTRACE_NAME_SHIFT)) - 1)	return 0;
+		if((names = realloc(map_names, sizeof(char*) * (name_max + 64))) == NULL)	return 0;
+		map_names = names;
+		name_max += 64;
+	}
+	if((map_names[name_nr] = calloc(1, TLBTRACE_NAME_MAX)) == NULL)	return 0;
+	strncpy(map_names[name_nr], path, TLBTRACE_NAME_MAX - 1);
+
+	*added = 1;
+	return ++name_nr;
+}
+
+/* Make room for a new mapping and the tail of a split one. */
+static int map_room(void)
+{
+	struct TRACE_MAP *m;
+
+	if(map_nr + 2 <= map_max)	return 0;
+	if((m = realloc(maps, sizeof(struct TRACE_MAP) * (map_max + 256))) == NULL)	return -1;
+	maps = m;
+	map_max += 256;
+	return 0;
+}
+
+/* Drop the pages in [start, end) from the mappings of an ASID, splitting the ones which cover the range. */
+static void unmap_range(unsigned int asid, uint32_t start, uint32_t end)
+{
+	struct TRACE_MAP *m;
+	int i;
+
+	for(i = 0; i < map_nr; i++){
+		m = &maps[i];
+		if(m->asid != asid || m->end <= start || m->start >= end)	continue;
+
+		if(m->start >= start && m->end <= end){		// the whole mapping
+			*m = maps[--map_nr];
+			i--;
+		}else if(m->start < start && m->end > end){	// the middle, the tail is added at the end
+			maps[map_nr].start = end;
+			maps[map_nr].end = m->end;
+			maps[map_nr].offset = m->offset + (end - m->start);
+			maps[map_nr].name = m->name;
+			maps[map_nr].asid = asid;
+			map_nr++;
+			m->end = start;
+		}else if(m->start < start){
+			m->end = start;
+		}else{
+			m->offset += end - m->start;
+			m->start = end;
+		}
+	}
+}
+
+/* Write a mapping change to every stream, after the name of its file if it is new. */
+static void add_map(int new_name, int op, unsigned int asid, uint32_t start, uint32_t end, uint32_t offset, uint32_t name)
+{
+	int cpu = current_cpu(), k;
+
+	if(!tlbtrace_started || !trace_maps)	return;
+
+	if(cpu < 0)	cpu = 0;
+	if(page_mode)	pages_flush();
+	for(k = 0; k < nstream; k++){
+		if(new_name)	put_name(&confs[k].out, add_record, name);
+		add_record(&confs[k].out, map_mva(cpu, start), end | (op << TLBTRACE_MAP_OP_SHIFT) | asid, offset, name);
+	}
+}
+
+void tlbtrace_map(unsigned int asid, uint32_t start, uint32_t end, uint32_t offset, const char *path)
+{
+	struct TRACE_MAP *m;
+	uint32_t name = 0;
+	int added = 0;
+
+	start &= 0xFFFFF000;
+	end = (end + 0xFFF) & 0xFFFFF000;
+	asid &= 0xFF;
+	if(end <= start)	return;
+
+	if(path != NULL && path[0] != '\0' && (name = map_name(path, &added)) == 0){
+		fprintf(stderr, "[TLBTRACE] out of memory, mapping of %s dropped.\n", path);
+		return;
+	}
+
+	if(map_room() != 0){
+		fprintf(stderr, "[TLBTRACE] out of memory, mapping dropped.\n");
+		return;
+	}
+
+	unmap_range(asid, start, end);		// a new mapping replaces the old ones
+	m = &maps[map_nr++];
+	m->start = start;
+	m->end = end;
+	m->offset = offset;
+	m->name = name;
+	m->asid = asid;
+
+	add_map(added, TLBTRACE_MAP_ADD, asid, start, end, offset, name);
+}
+
+void tlbtrace_unmap(unsigned int asid, uint32_t start, uint32_t end)
+{
+	start &= 0xFFFFF000;
+	end = (end + 0xFFF) & 0xFFFFF000;
+	asid &= 0xFF;
+	if(end <= start)	return;
+
+	if(map_room() != 0){
+		fprintf(stderr, "[TLBTRACE] out of memory, unmapping dropped.\n");
+		return;
+	}
+
+	unmap_range(asid, start, end);
+	add_map(0, TLBTRACE_MAP_REMOVE, asid, start, end, 0, 0);
+}
+
+
+#ifdef USE_QEMU
+static int pcnt = 0;
+void tlbtrace_refmem_qemu(unsigned int addr, int ins)
+{
+	CPUState *env = cpu_single_env;	// CPU being executed, provided by QEMU
+	unsigned int asid;
+	int kernel;
+
+	if(!tlbtrace_started || env == NULL)	return;
+	if(env->cpu_index >= TLBTRACE_MAX_CPUS)	return;
+
+	kernel = (env->uncached_cpsr & CPSR_M) != ARM_CPU_MODE_USR;
+	if(!(trace_priv & (kernel ? TLBTRACE_PRIV_KERNEL : TLBTRACE_PRIV_USER)))	return;		// privilege level not traced
+
+	asid = env->cp15.c13_context & 0xFF;
+
+	// every fetch is traced before the accesses of its instruction, so it gives their PC
+	if(ins)	cur_pc[env->cpu_index] = addr;
+	if(pc_nr != 0 && !in_ranges(pc_ranges, pc_nr, cur_pc[env->cpu_index])){
+		filtered_cnt++;
+		return;
+	}
+
+	//if(pcnt++ < 100)	fprintf(stderr, "[TLBTRACE] addr=0x%08X, asid=0x%08X\n", addr, asid);
+	refmem(env->cpu_index, addr, asid, ins, kernel ? TLBTRACE_PRIV_FLAG : 0, env);
+
+}
+
+static uint32_t get_level1_table_address(CPUState *env, uint32_t address)
+{
+    uint32_t table;
+
+    if (address & env->cp15.c2_mask)
+        table = env->cp15.c2_base1 & 0xffffc000;
+    else
+        table = env->cp15.c2_base0 & env->cp15.c2_base_mask;
+
+    table |= (address >> 18) & 0x3ffc;
+    return table;
+}
+
+static int walk_ptes(CPUState *env, uint32_t address, uint32_t *l1, uint32_t *l2, uint32_t *gpa)
+{
+	int type, global = (env->cp15.c1_sys & (1 << 23)) ? TLBTRACE_GLOBAL : 0;		// nG is only defined by the ARMv6 format
+    uint32_t table;
+    uint32_t desc;
+    int domain;
+
+    /* Pagetable walk.  */
+    /* Lookup l1 descriptor.  */
+    table = *l1;
+    desc = ldl_phys(table);
+    type = (desc & 3);
+
+	if(type == 0 || type == 3){					/* Section translation fault.  */
+		return 1;
+    }else if(type == 2 && (desc & (1 << 18))) {	/* Supersection.  */
+        domain = 0;
+    }else{										/* Section or page.  */
+        domain = (desc >> 4) & 0x1e;
+    }
+
+    domain = (env->cp15.c3 >> domain) & 3;
+    if(domain == 0 || domain == 2){
+		return 1;
+    }
+
+	if(type == 2){
+		if(desc & (1 << 17))	global = 0;		/* nG */
+		if(desc & (1 << 18)){					/* Supersection.  */
+			*gpa = (desc & 0xFF000000) | (address & 0x00FFF000);
+			return 1 | (TLBTRACE_SIZE_16M << TLBTRACE_SIZE_SHIFT) | global;
+		}
+		*gpa = (desc & 0xFFF00000) | (address & 0x000FF000);
+		return 1 | (TLBTRACE_SIZE_1M << TLBTRACE_SIZE_SHIFT) | global;
+	}
+	
+	/* Lookup l2 entry.  */
+	*l2 = table = (desc & 0xfffffc00) | ((address >> 10) & 0x3fc);
+
+	desc = ldl_phys(table);
+	if((desc & 0x3) == 0)	return 2;
+	if(desc & (1 << 11))	global = 0;		/* nG */
+
+	if((desc & 0x3) == 1){						/* Large page.  */
+		*gpa = (desc & 0xFFFF0000) | (address & 0x0000F000);
+		return 3 | (TLBTRACE_SIZE_64K << TLBTRACE_SIZE_SHIFT) | global;
+	}
+	*gpa = (desc & 0xFFFFF000);
+
+	return 3 | global;
+}
+
+/* Addresses of the descriptors of \a va, for an invalidation record. */
+static void walk_descs(uint32_t va, uint32_t *l1, uint32_t *l2)
+{
+	CPUState *env = cpu_single_env;
+	uint32_t gpa;
+
+	if(env == NULL)	return;
+
+	*l1 = get_level1_table_address(env, va);
+	if((walk_ptes(env, va, l1, l2, &gpa) & TLBTRACE_RET_MASK) == 1)	*l2 = 0;
+}
+
+/* Walk-result cache of get_ptes().
+ * Each entry is keyed by the first level descriptor address (which carries the TTBR),
+ * the ASID and the page. It is invalidated by the TLB maintenance hooks, and by any
+ * write to the page-table pages it was read from, which is caught by a dedicated
+ * dirty flag of QEMU. */
+#define WALK_CACHE_BITS		12
+#define WALK_CACHE_ENTRIES	(1 << WALK_CACHE_BITS)
+#define WALK_CACHE_IDX(va, asid)	((((va) >> 12) ^ ((asid) << 4)) & (WALK_CACHE_ENTRIES - 1))
+
+struct WALK_ENTRY{
+	uint32_t va;			// Virtual Address
+	uint32_t asid;			// AP-Specific ID
+	uint32_t dacr;			// Domain access control when walked
+	uint32_t gen;			// walk_gen when walked
+	uint32_t asid_gen;		// walk_asid_gen[asid] when walked
+	uint32_t l1, l2, gpa;
+	int ret;
+	ram_addr_t l1_ram;		// page holding the first level descriptor
+	ram_addr_t l2_ram;		// page holding the second level descriptor
+};
+
+static struct WALK_ENTRY walk_cache[WALK_CACHE_ENTRIES];
+static struct TLB_COUNTER walk_cnt;
+static uint32_t walk_gen;
+static uint32_t walk_asid_gen[256];
+
+static void walk_cache_flush_all(void)
+{
+	walk_gen++;
+}
+
+static void walk_cache_flush_entry(uint32_t va, uint32_t asid)
+{
+	walk_cache[WALK_CACHE_IDX(va, asid)].gen = walk_gen - 1;
+}
+
+static void walk_cache_flush_asid(uint32_t asid)
+{
+	walk_asid_gen[asid]++;
+}
+
+/* Return the RAM offset of the page holding \a addr, or -1 if it is not RAM. */
+static ram_addr_t walk_cache_ram_page(uint32_t addr)
+{
+	ram_addr_t pd = cpu_get_physical_page_desc(addr);
+
+	if((pd & ~TARGET_PAGE_MASK) != IO_MEM_RAM)	return (ram_addr_t)-1;
+	return pd & TARGET_PAGE_MASK;
+}
+
+/* Start tracking writes to a page-table page. */
+static int walk_cache_watch(ram_addr_t page)
+{
+	if(page == (ram_addr_t)-1)	return 0;
+
+	if(cpu_physical_memory_get_dirty(page, TLBTRACE_DIRTY_FLAG))
+		cpu_physical_memory_reset_dirty(page, page + TARGET_PAGE_SIZE, TLBTRACE_DIRTY_FLAG);
+	return 1;
+}
+
+static int get_ptes(void *arg, uint32_t address, uint32_t *l1, uint32_t *l2, uint32_t *gpa)
+{
+	CPUState *env = arg;
+	uint32_t asid = env->cp15.c13_context & 0xFF;
+	uint32_t table = get_level1_table_address(env, address);
+	struct WALK_ENTRY *e = &walk_cache[WALK_CACHE_IDX(address, asid)];
+	int ret;
+
+	if(e->va == address && e->asid == asid && e->l1 == table && e->dacr == env->cp15.c3 &&
+			e->gen == walk_gen && e->asid_gen == walk_asid_gen[asid] &&
+			!cpu_physical_memory_get_dirty(e->l1_ram, TLBTRACE_DIRTY_FLAG) &&
+			((e->ret & TLBTRACE_RET_MASK) == 1 || !cpu_physical_memory_get_dirty(e->l2_ram, TLBTRACE_DIRTY_FLAG))){	// hit
+		*l1 = e->l1;
+		*l2 = e->l2;
+		*gpa = e->gpa;
+		walk_cnt.hit++;
+		return e->ret;
+	}
+
+	*l1 = table;
+	ret = walk_ptes(env, address, l1, l2, gpa);
+	walk_cnt.miss++;
+
+	e->l1_ram = walk_cache_ram_page(*l1);
+	e->l2_ram = ((ret & TLBTRACE_RET_MASK) == 1) ? e->l1_ram : walk_cache_ram_page(*l2);
+	if(!walk_cache_watch(e->l1_ram) || !walk_cache_watch(e->l2_ram)){	// not cacheable
+		e->gen = walk_gen - 1;
+		return ret;
+	}
+
+	e->va = address;
+	e->asid = asid;
+	e->dacr = env->cp15.c3;
+	e->gen = walk_gen;
+	e->asid_gen = walk_asid_gen[asid];
+	e->l1 = *l1;
+	e->l2 = *l2;
+	e->gpa = *gpa;
+	e->ret = ret;
+
+	return ret;
+}
+
+
+static int pccnt = 0;
+void REGPARM qemu_trace_pc_helper(unsigned int pc)
+{
+	if(!tlbtrace_started)	return;
+	tlbtrace_refmem_qemu(pc, 1);
+}
+
+void tlbtrace_magic(CPUState *env, int op, uint32_t val)
+{
+	char name[12];
+
+	switch(op){
+		case TLBTRACE_MAGIC_START:
+			request_state(1);
+			break;
+		case TLBTRACE_MAGIC_STOP:
+			request_state(0);
+			break;
+		case TLBTRACE_MAGIC_MARKER:
+			if(cpu_memory_rw_debug(env, val, (uint8_t*)name, sizeof(name), 0) != 0)	strcpy(name, "?");
+			if(env->cpu_index < TLBTRACE_MAX_CPUS)	tlbtrace_marker(env->cpu_index, name);
+			break;
+		case TLBTRACE_MAGIC_TRIGGER:
+			tlbtrace_trigger();
+			break;
+	}
+}
+
+static uint32_t proc_ctx[256];			// context ID of the process selected by name in an ASID_BY_PROC ASID
+
+/* Stop tracing an ASID selected by name, since its process has gone. */
+static void proc_drop(unsigned int asid, const char *why)
+{
+	fprintf(stderr, "[TLBTRACE] not tracing ASID %u anymore (%s)\n", asid, why);
+	asid_set[asid] = 0;
+}
+
+/* Trace the current process from now on if it is selected by name. */
+static void proc_match(const char *name, const char *how)
+{
+	CPUState *env = cpu_single_env;
+	unsigned int asid;
+	int i, len = strlen(name);
+
+	if(env == NULL)	return;
+	asid = env->cp15.c13_context & 0xFF;
+
+	for(i = 0; i < proc_nr; i++){
+		// thread names are truncated to 15 characters by the guest kernel
+		if(strcmp(name, procs[i]) == 0 || (len == 15 && strncmp(name, procs[i], len) == 0))	break;
+	}
+	if(i == proc_nr){
+		// another program is executed in the address space; threads may be renamed freely
+		if(asid_set[asid] == ASID_BY_PROC && strcmp(how, "execve") == 0)	proc_drop(asid, name);
+		return;
+	}
+
+	if(asid_set[asid] == ASID_BY_OPTION)	return;
+	if(asid_set[asid] == 0)	fprintf(stderr, "[TLBTRACE] tracing %s (%s), ASID %u\n", name, how, asid);
+	asid_set[asid] = ASID_BY_PROC;
+	proc_ctx[asid] = env->cp15.c13_context;
+}
+
+void tlbtrace_proc_context(unsigned long ctx)
+{
+	unsigned int asid = ctx & 0xFF;
+
+	// the guest kernel reassigns an ASID with a new generation in the upper bits of the context ID
+	if(asid_set[asid] == ASID_BY_PROC && proc_ctx[asid] != (uint32_t)ctx)	proc_drop(asid, "reassigned");
+}
+
+void tlbtrace_proc_name(const char *name)
+{
+	if(proc_nr != 0)	proc_match(name, "name");
+}
+
+void tlbtrace_proc_mmap(unsigned long start, unsigned long end, unsigned long offset, const char *path)
+{
+	if(cpu_single_env != NULL)	tlbtrace_map(cpu_single_env->cp15.c13_context & 0xFF, start, end, offset, path);
+}
+
+void tlbtrace_proc_munmap(unsigned long start, unsigned long end)
+{
+	if(cpu_single_env != NULL)	tlbtrace_unmap(cpu_single_env->cp15.c13_context & 0xFF, start, end);
+}
+
+void tlbtrace_proc_execve(const char *argv, int len)
+{
+	const char *base;
+
+	if(proc_nr == 0 || len <= 0)	return;
+
+	base = strrchr(argv, '/');
+	proc_match(base != NULL ? base + 1 : argv, "execve");		// argv[0]
+}
+
+#endif /* USE_QEMU */
+
+/* Open a trace, named after the start time and \a tag, i.e. the geometry of its configuration or "pages". */
+static void open_stream(struct TLBTRACE_STREAM *s, const char *tag, const struct tm *tm)
+{
+	char buf[600];
+
+	snprintf(s->trace_base, sizeof(s->trace_base), "%s/trace_%02d%02d_%02d%02d_%s", out_dir, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour, tm->tm_min, tag);
+	if(seg_limit == 0 && ring_recs == 0){
+		s->fout = open(s->trace_base, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		strcpy(buf, s->trace_base);
+	}else{
+		s->fout = -1;			// the first segment is created on the first write, or dump
+		s->seg_no = 0;
+		segment_name(s, buf, sizeof(buf), s->seg_no);
+	}
+	s->fbc = 0;
+	s->rec_cnt = s->bytes = s->insns = 0;
+	untag(s, 0);
+	s->map_seg = ~0ULL;		// the mappings are written before the first record
+	if(ring_recs != 0){
+		s->ring_ts = calloc(fbuf_words / RING_BLOCK_WORDS, sizeof(unsigned long long));
+		s->ring_full = 0;
+	}
+	s->fbuf = malloc(fbuf_words * sizeof(uint32_t));
+
+	fprintf(stderr, "[TLBTRACE] FILE=%s\n", buf);
+}
+
+static void close_stream(struct TLBTRACE_STREAM *s)
+{
+	if(stamp_insns != 0 && tlbtrace_insns != s->insns)	put_stamp(s);		// instructions after the last record
+
+	if(ring_recs != 0){
+		ring_dump(s);
+		free(s->ring_ts);
+		s->ring_ts = NULL;
+	}else if(s->fbc > 0){
+		flush_buffer(s);
+	}
+	free(s->fbuf);
+	s->fbuf = NULL;
+
+	if(s->fout >= 0){
+		if(seg_limit == 0)	close(s->fout);
+		else		close_segment(s);
+		s->fout = -1;
+	}
+}
+
+void tlbtrace_start(void)
+{
+#ifdef USE_QEMU
+	CPUState *env;
+#endif /* USE_QEMU */
+	char tag[32];
+	int i, k;
+
+	fprintf(stderr, "[TLBTRACE] starting... (%s:%d)\n", __FUNCTION__, __LINE__);
+	if(page_mode)	fprintf(stderr, "[TLBTRACE] CONFIG => PAGES\n");
+	else for(k = 0; k < nconf; k++)
+		fprintf(stderr, "[TLBTRACE] CONFIG => %d, %d-WAY\n", confs[k].size, confs[k].set);
+
+#ifdef USE_QEMU
+	for(env = first_cpu; env != NULL; env = env->next_cpu)
+		tlb_flush(env, 1);
+#endif /* USE_QEMU */
+
+	if(ring_recs != 0)	fbuf_words = (ring_recs * 4 + RING_BLOCK_WORDS - 1) / RING_BLOCK_WORDS * RING_BLOCK_WORDS;
+	else		fbuf_words = buf_words;
+
+	time_t now = time(NULL);
+	struct tm tm;
+	localtime_r(&now, &tm);
+	nstream = page_mode ? 1 : nconf;
+	for(k = 0; k < nstream; k++){
+		if(page_mode)	strcpy(tag, "pages");
+		else		snprintf(tag, sizeof(tag), "%d.%d", confs[k].size, confs[k].set);
+		open_stream(&confs[k].out, tag, &tm);
+	}
+
+	if(page_mode){
+		dedup = calloc(1 << TLBTRACE_DEDUP_BITS, sizeof(struct PAGE_DEDUP));
+		dedup_seg = 0;
+		pack_n = 0;
+		for(i = 0; i < TLBTRACE_MAX_CPUS; i++)
+			page_last[i] = ~0ULL;
+	}
+
+	rec_cnt = byte_cnt = ovh_ns = filtered_cnt = 0;
+	start_ns = stop_ns = now_ns();
+	tlbtrace_insns = 0;
+
+	systs = 0;
+
+	for(k = 0; k < nconf; k++){
+		for(i = 0; i < TLBTRACE_MAX_CPUS; i++){
+			INIT_TLB(confs[k].cpus[i].sl_tlb, confs[k].size, confs[k].cpus[i].sl_cnt);
+			confs[k].cpus[i].last_ins_idx = 0;
+		}
+	}
+
+#ifdef USE_QEMU
+	walk_cache_flush_all();		// hooks are ignored while stopped
+	walk_cnt.miss = walk_cnt.hit = 0;
+#endif /* USE_QEMU */
+
+	tlbtrace_started = 1;
+}
+
+void tlbtrace_stop(void)
+{
+#ifdef USE_QEMU
+	CPUState *env;
+#endif /* USE_QEMU */
+	int i, k;
+
+#ifdef USE_QEMU
+	for(env = first_cpu; env != NULL; env = env->next_cpu)
+		tlb_flush(env, 1);
+#endif /* USE_QEMU */
+
+	tlbtrace_started = 0;
+
+	if(page_mode){
+		pages_flush();
+		free(dedup);
+		dedup = NULL;
+	}
+	for(k = 0; k < nstream; k++)
+		close_stream(&confs[k].out);
+	stop_ns = now_ns();
+
+	fprintf(stderr, "[TLBTRACE] stopping... (%s:%d)\n", __FUNCTION__, __LINE__);
+
+	for(k = 0; k < nstream; k++){
+		if(nstream > 1)	fprintf(stderr, "[TLBTRACE] CONFIG => %d, %d-WAY\n", confs[k].size, confs[k].set);
+		fprintf(stderr, "ITEM\t%20s\t%20s\thit ratio\n", "hit", "miss");
+
+		for(i = 0; i < TLBTRACE_MAX_CPUS; i++){
+			struct TLB_COUNTER *cnt = &confs[k].cpus[i].sl_cnt;
+
+			if(i > 0 && cnt->hit + cnt->miss == 0)	continue;	// CPU not present
+			fprintf(stderr, "TLB%d\t%20llu\t%20llu\t%.5lf\n", i, cnt->hit, cnt->miss,
+					100.0 * (double)cnt->hit / (double)(cnt->hit + cnt->miss));
+		}
+	}
+
+#ifdef USE_QEMU
+	fprintf(stderr, "WALK\t%20llu\t%20llu\t%.5lf\n", walk_cnt.hit, walk_cnt.miss,
+			100.0 * (double)walk_cnt.hit / (double)(walk_cnt.hit + walk_cnt.miss));
+#endif /* USE_QEMU */
+}
+
+void tlbtrace_set_state(int on)
+{
+#ifdef USE_QEMU
+	tlbtrace_state_bh(NULL);		// finish a pending request first
+#endif /* USE_QEMU */
+
+	if(on == tlbtrace_started)	return;
+	if(on)	tlbtrace_start();
+	else		tlbtrace_stop();
+
+#ifdef USE_QEMU
+	tb_flush(first_cpu);	// regenerate all code with or without the trace ops
+#endif /* USE_QEMU */
+}
+
+void tlbtrace_toggle(void)
+{
+	int on = !tlbtrace_started;
+
+#ifdef USE_QEMU
+	if(stop_pending)	on = 0;		// a stop requested by a limit or the guest is only completed, a new trace is not started
+#endif /* USE_QEMU */
+
+	tlbtrace_set_state(on);
+}
+
+int tlbtrace_enabled(void)
+{
+	return tlbtrace_started;
+}
+
+static void free_tlbs(void)
+{
+	int i, k;
+
+	for(k = 0; k < TLBTRACE_MAX_CONFS; k++){
+		for(i = 0; i < TLBTRACE_MAX_CPUS; i++){
+			if(confs[k].cpus[i].sl_tlb != NULL){
+				free(confs[k].cpus[i].sl_tlb);
+				confs[k].cpus[i].sl_tlb = NULL;
+			}
+		}
+	}
+	nconf = 0;
+}
+
+/* (Re)allocate the main TLBs of all CPUs for \a n configurations with the given geometries. */
+static int alloc_tlbs(int n, const unsigned long long *size, const unsigned long long *set)
+{
+	struct TLB_ENTRY *tlbs[TLBTRACE_MAX_CONFS][TLBTRACE_MAX_CPUS];
+	struct TLBTRACE_CONF *conf;
+	int i, k;
+
+	for(k = 0; k < n; k++){
+		if(size[k] == 0 || set[k] == 0 || size[k] > 1024 * 1024 || size[k] % set[k] != 0 || ((size[k] / set[k]) & (size[k] / set[k] - 1)) != 0){
+			fprintf(stderr, "[TLBTRACE] invalid main TLB geometry %llu, %llu-WAY.\n", size[k], set[k]);
+			return -1;
+		}
+	}
+
+	// the current main TLBs are kept if the new ones can't be allocated
+	memset(tlbs, 0, sizeof(tlbs));
+	for(k = 0; k < n; k++){
+		for(i = 0; i < TLBTRACE_MAX_CPUS; i++){
+			if((tlbs[k][i] = (struct TLB_ENTRY*)malloc(sizeof(struct TLB_ENTRY) * size[k])) == NULL){
+				fprintf(stderr, "[TLBTRACE] out of memory.\n");
+				for(k = 0; k < n; k++)
+					for(i = 0; i < TLBTRACE_MAX_CPUS; i++)
+						free(tlbs[k][i]);
+				return -1;
+			}
+		}
+	}
+
+	free_tlbs();
+
+	for(k = 0; k < n; k++){
+		conf = &confs[k];
+		conf->size = size[k];
+		conf->set = set[k];
+		conf->set_step = size[k] / set[k];
+		conf->set_mask = conf->set_step - 1;
+		conf->out.fout = -1;
+
+		for(i = 0; i < TLBTRACE_MAX_CPUS; i++)
+			conf->cpus[i].sl_tlb = tlbs[k][i];
+		nconf++;
+	}
+
+	return 0;
+}
+
+/* Parse a count with an optional decimal suffix K, M or G. */
+static int parse_count(const char *str, unsigned long long *val)
+{
+	unsigned long long mul = 1;
+	char *end;
+
+	errno = 0;
+	*val = strtoull(str, &end, 10);
+	switch(*end){
+		case 'k': case 'K':	mul = 1000ULL; end++; break;
+		case 'm': case 'M':	mul = 1000000ULL; end++; break;
+		case 'g': case 'G':	mul = 1000000000ULL; end++; break;
+	}
+	if(end == str || *end != '\0' || *str == '-' || errno == ERANGE || *val > ULLONG_MAX / mul)	return -1;
+	*val *= mul;
+
+	return 0;
+}
+
+/* Parse a flag, 0 or 1. */
+static int parse_flag(const char *str, int *val)
+{
+	if(strcmp(str, "0") != 0 && strcmp(str, "1") != 0)	return -1;
+	*val = str[0] == '1';
+
+	return 0;
+}
+
+/* Parse a size in bytes with an optional binary suffix K, M or G. */
+static int parse_bytes(const char *str, unsigned long long *val)
+{
+	int shift = 0;
+	char *end;
+
+	errno = 0;
+	*val = strtoull(str, &end, 10);
+	switch(*end){
+		case 'k': case 'K':	shift = 10; end++; break;
+		case 'm': case 'M':	shift = 20; end++; break;
+		case 'g': case 'G':	shift = 30; end++; break;
+	}
+	if(end == str || *end != '\0' || *str == '-' || errno == ERANGE || *val > (ULLONG_MAX >> shift))	return -1;
+	*val <<= shift;
+
+	return 0;
+}
+
+/* Parse an address range "start-end", where end is exclusive. */
+static int parse_range(const char *str, struct FILTER_RANGE *r)
+{
+	char *end;
+
+	r->start = strtoul(str, &end, 0);
+	if(end == str || *end != '-')	return -1;
+	str = end + 1;
+	r->end = strtoul(str, &end, 0);
+
+	return (end == str || *end != '\0' || r->end <= r->start) ? -1 : 0;
+}
+
+static int set_filter(const char *name, const char *value)
+{
+	unsigned long long v;
+
+	if(strcmp(name, "asid") == 0){
+		if(parse_count(value, &v) != 0 || v >= 256)	return -1;
+		asid_set[v] = ASID_BY_OPTION;
+		asid_filter = 1;
+	}else if(strcmp(name, "va") == 0){
+		if(va_nr == FILTER_MAX_RANGES || parse_range(value, &va_ranges[va_nr]) != 0)	return -1;
+		va_nr++;
+	}else if(strcmp(name, "pc") == 0){
+		if(pc_nr == FILTER_MAX_RANGES || parse_range(value, &pc_ranges[pc_nr]) != 0)	return -1;
+		pc_nr++;
+	}else if(strcmp(name, "proc") == 0){
+		if(proc_nr == FILTER_MAX_PROCS || strlen(value) >= sizeof(procs[0]))	return -1;
+		strcpy(procs[proc_nr++], value);
+		asid_filter = 1;		// nothing is traced until the process is seen
+	}else if(strcmp(name, "filter") == 0 && strcmp(value, "none") == 0){
+		memset(asid_set, 0, sizeof(asid_set));
+		asid_filter = va_nr = pc_nr = proc_nr = 0;
+	}else{
+		return -1;
+	}
+
+	filter_on = asid_filter || va_nr != 0;
+	return 0;
+}
+
+/* Parse a list of main TLB geometries "size.ways[+size.ways...]". */
+static int parse_tlbs(const char *str, unsigned long long *size, unsigned long long *set, int *n)
+{
+	char *end;
+
+	for(*n = 0; *n < TLBTRACE_MAX_CONFS; (*n)++){
+		size[*n] = strtoull(str, &end, 10);
+		if(end == str || *end != '.')	return -1;
+		str = end + 1;
+		set[*n] = strtoull(str, &end, 10);
+		if(end == str)	return -1;
+
+		if(*end == '\0'){
+			(*n)++;
+			return 0;
+		}
+		if(*end != '+')	return -1;
+		str = end + 1;
+	}
+
+	return -1;		// too many configurations
+}
+
+static int set_option(const char *name, const char *value, unsigned long long *size, unsigned long long *set, int *n)
+{
+	unsigned long long v;
+
+	if(strcmp(name, "size") == 0){
+		*n = 1;
+		return parse_count(value, &size[0]);
+	}else if(strcmp(name, "ways") == 0){
+		*n = 1;
+		return parse_count(value, &set[0]);
+	}else if(strcmp(name, "tlbs") == 0){
+		return parse_tlbs(value, size, set, n);
+	}else if(strcmp(name, "mode") == 0){
+		if(strcmp(value, "miss") == 0)	page_mode = 0;
+		else if(strcmp(value, "pages") == 0)	page_mode = 1;
+		else		return -1;
+		return 0;
+	}else if(strcmp(name, "dir") == 0){
+		if(strlen(value) >= sizeof(out_dir))	return -1;
+		strcpy(out_dir, value);
+		return 0;
+	}else if(strcmp(name, "buffer") == 0){
+		if(parse_bytes(value, &v) != 0 || v < 4 * sizeof(uint32_t) || v > BUF_MAX_BYTES)	return -1;
+		buf_words = v / (4 * sizeof(uint32_t)) * 4;		// whole records
+		return 0;
+	}else if(strcmp(name, "stop") == 0){
+		return parse_count(value, &stop_refs);
+	}else if(strcmp(name, "stop_bytes") == 0){
+		return parse_bytes(value, &stop_bytes);
+	}else if(strcmp(name, "stop_time") == 0){
+		if(parse_count(value, &v) != 0 || v > ULLONG_MAX / 1000000000ULL)	return -1;
+		stop_time_ns = v * 1000000000ULL;
+		return 0;
+	}else if(strcmp(name, "stop_insns") == 0){
+		return parse_count(value, &stop_insns);
+	}else if(strcmp(name, "insns") == 0){
+		return parse_count(value, &stamp_insns);
+	}else if(strcmp(name, "tag_pc") == 0){
+		return parse_flag(value, &tag_pcs);
+	}else if(strcmp(name, "maps") == 0){
+		return parse_flag(value, &trace_maps);
+	}else if(strcmp(name, "priv") == 0){
+		if(strcmp(value, "user") == 0)	trace_priv = TLBTRACE_PRIV_USER;
+		else if(strcmp(value, "kernel") == 0)	trace_priv = TLBTRACE_PRIV_KERNEL;
+		else if(strcmp(value, "all") == 0)	trace_priv = TLBTRACE_PRIV_USER | TLBTRACE_PRIV_KERNEL;
+		else		return -1;
+		return 0;
+	}else if(strcmp(name, "ring") == 0){
+		if(parse_count(value, &v) != 0 || v > BUF_MAX_BYTES / (4 * sizeof(uint32_t)))	return -1;
+		ring_recs = v;
+		return 0;
+	}else if(strcmp(name, "ring_time") == 0){
+		if(parse_count(value, &v) != 0 || v > ULLONG_MAX / 1000000000ULL)	return -1;
+		ring_time_ns = v * 1000000000ULL;
+		return 0;
+	}else if(strcmp(name, "segment") == 0){
+		if(parse_bytes(value, &v) != 0 || (v != 0 && v < 4 * sizeof(uint32_t)))	return -1;
+		seg_limit = v / (4 * sizeof(uint32_t)) * (4 * sizeof(uint32_t));		// whole records
+		return 0;
+	}
+
+	return set_filter(name, value);
+}
+
+/* Run-time configuration of tlbtrace_set_options(), which is restored if an option string is rejected. */
+struct TLBTRACE_OPTIONS{
+	char out_dir[sizeof(out_dir)];
+	int buf_words;
+	unsigned long long stop_refs, stop_bytes, stop_time_ns, stop_insns;
+	unsigned long long seg_limit, ring_recs, ring_time_ns, stamp_insns;
+	int trace_priv, tag_pcs, trace_maps, page_mode;
+	int filter_on, asid_filter, va_nr, pc_nr, proc_nr;
+	unsigned char asid_set[sizeof(asid_set)];
+	struct FILTER_RANGE va_ranges[FILTER_MAX_RANGES], pc_ranges[FILTER_MAX_RANGES];
+	char procs[FILTER_MAX_PROCS][sizeof(procs[0])];
+};
+
+#define OPTIONS_COPY(copy_value, copy_array)		do{ \
+	copy_array(out_dir); copy_value(buf_words); \
+	copy_value(stop_refs); copy_value(stop_bytes); copy_value(stop_time_ns); copy_value(stop_insns); \
+	copy_value(seg_limit); copy_value(ring_recs); copy_value(ring_time_ns); copy_value(stamp_insns); \
+	copy_value(trace_priv); copy_value(tag_pcs); copy_value(trace_maps); copy_value(page_mode); \
+	copy_value(filter_on); copy_value(asid_filter); copy_value(va_nr); copy_value(pc_nr); copy_value(proc_nr); \
+	copy_array(asid_set); copy_array(va_ranges); copy_array(pc_ranges); copy_array(procs); \
+}while(0)
+
+static void save_options(struct TLBTRACE_OPTIONS *o)
+{
+#define SAVE_VALUE(x)	(o->x = x)
+#define SAVE_ARRAY(x)	memcpy(o->x, x, sizeof(o->x))
+	OPTIONS_COPY(SAVE_VALUE, SAVE_ARRAY);
+#undef SAVE_VALUE
+#undef SAVE_ARRAY
+}
+
+static void restore_options(const struct TLBTRACE_OPTIONS *o)
+{
+#define RESTORE_VALUE(x)	(x = o->x)
+#define RESTORE_ARRAY(x)	memcpy(x, o->x, sizeof(o->x))
+	OPTIONS_COPY(RESTORE_VALUE, RESTORE_ARRAY);
+#undef RESTORE_VALUE
+#undef RESTORE_ARRAY
+}
+
+/* Apply all the options, or none of them. The main TLBs are reallocated last, since they can't be rolled back cheaply. */
+static int apply_options(char *buf)
+{
+	char *opt, *value, *save;
+	unsigned long long size[TLBTRACE_MAX_CONFS], set[TLBTRACE_MAX_CONFS];
+	int n = nconf, k;
+
+	for(k = 0; k < nconf; k++){
+		size[k] = confs[k].size;
+		set[k] = confs[k].set;
+	}
+
+	for(opt = strtok_r(buf, ",", &save); opt != NULL; opt = strtok_r(NULL, ",", &save)){
+		if((value = strchr(opt, '=')) == NULL){
+			fprintf(stderr, "[TLBTRACE] bad option '%s'.\n", opt);
+			return -1;
+		}
+		*value++ = '\0';
+
+		if(set_option(opt, value, size, set, &n) != 0){
+			fprintf(stderr, "[TLBTRACE] bad option '%s=%s'.\n", opt, value);
+			return -1;
+		}
+	}
+
+	// the main TLBs are only reallocated if a geometry is changed
+	if(n != nconf)	return alloc_tlbs(n, size, set);
+	for(k = 0; k < n; k++){
+		if(size[k] != (unsigned long long)confs[k].size || set[k] != (unsigned long long)confs[k].set)
+			return alloc_tlbs(n, size, set);
+	}
+
+	return 0;
+}
+
+int tlbtrace_set_options(const char *options)
+{
+	struct TLBTRACE_OPTIONS saved;
+	char buf[1024];
+
+	if(tlbtrace_started){
+		fprintf(stderr, "[TLBTRACE] cannot be configured while running.\n");
+		return -1;
+	}
+
+	if(strlen(options) >= sizeof(buf))	return -1;
+	strcpy(buf, options);
+
+	save_options(&saved);
+	if(apply_options(buf) != 0){
+		restore_options(&saved);
+		return -1;
+	}
+
+	return 0;
+}
+
+void tlbtrace_get_stats(struct TLBTRACE_STATS *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->running = tlbtrace_started;
+
+	for(i = 0; i < TLBTRACE_MAX_CPUS; i++){
+		stats->hit += confs[0].cpus[i].sl_cnt.hit;
+		stats->miss += confs[0].cpus[i].sl_cnt.miss;
+	}
+
+	stats->insns = tlbtrace_insns;
+	stats->filtered = filtered_cnt;
+	stats->records = rec_cnt;
+	stats->bytes = byte_cnt;
+	stats->overhead_ns = ovh_ns;
+	stats->elapsed_ns = (tlbtrace_started ? now_ns() : stop_ns) - start_ns;
+}
+
+int tlbtrace_init(int size, int set, int (*pte_helper)(void* arg, uint32_t addr, uint32_t *l1, uint32_t *l2, uint32_t *pa))
+{
+	unsigned long long s = (unsigned)size, w = (unsigned)set;
+
+	fprintf(stderr, "[TLBTRACE] initializing... (%s:%d)\n", __FUNCTION__, __LINE__);
+	tlbtrace_started = 0;
+
+	if(alloc_tlbs(1, &s, &w) != 0){
+		tlbtrace_destroy();
+		return -1;
+	}
+
+#ifdef USE_QEMU
+	my_pte_helper = get_ptes;
+#else
+	my_pte_helper = pte_helper;
+#endif /* USE_QEMU */
+
+	return 0;
+}
+
+#ifdef USE_QEMU
+#define TLBTRACE_SAVE_VERSION	3
+
+/* The state of the main TLBs is saved along with the VM, so that captures can
+   start from a warm snapshot. The trace files themselves are not part of the state.
+   The mappings are saved as well, since the guest does not report them again.
+   Version 1 had a single configuration, whose geometry came before the timestamps,
+   and version 2 had no mappings. */
+static void tlbtrace_save(QEMUFile *f, void *opaque)
+{
+	struct TLBTRACE_CPU *c;
+	int i, j, k;
+
+	qemu_put_be32(f, tlbtrace_started);
+	qemu_put_be32(f, nconf);
+	qemu_put_be64(f, systs);
+	qemu_put_be64(f, tlbtrace_insns);
+
+	for(k = 0; k < nconf; k++){
+		qemu_put_be32(f, confs[k].size);
+		qemu_put_be32(f, confs[k].set);
+
+		for(i = 0; i < TLBTRACE_MAX_CPUS; i++){
+			c = &confs[k].cpus[i];
+			qemu_put_be64(f, c->sl_cnt.hit);
+			qemu_put_be64(f, c->sl_cnt.miss);
+			qemu_put_be32(f, c->last_ins_idx);
+			for(j = 0; j < confs[k].size; j++){
+				qemu_put_be32(f, c->sl_tlb[j].va);
+				qemu_put_be32(f, c->sl_tlb[j].pa);
+				qemu_put_be32(f, c->sl_tlb[j].asid);
+				qemu_put_be32(f, c->sl_tlb[j].ts);
+			}
+		}
+	}
+
+	qemu_put_be32(f, name_nr);
+	for(i = 0; i < name_nr; i++)
+		qemu_put_buffer(f, (const uint8_t*)map_names[i], TLBTRACE_NAME_MAX);
+	qemu_put_be32(f, map_nr);
+	for(i = 0; i < map_nr; i++){
+		qemu_put_be32(f, maps[i].start);
+		qemu_put_be32(f, maps[i].end);
+		qemu_put_be32(f, maps[i].offset);
+		qemu_put_be32(f, maps[i].name);
+		qemu_put_be32(f, maps[i].asid);
+	}
+}
+
+/* Replace the mappings with the ones of a snapshot, or drop them if it has none. */
+static int load_maps(QEMUFile *f, int version_id)
+{
+	char name[TLBTRACE_NAME_MAX];
+	int n, i, added;
+
+	while(name_nr > 0)
+		free(map_names[--name_nr]);
+	map_nr = 0;
+	if(version_id < 3)	return 0;
+
+	n = qemu_get_be32(f);
+	for(i = 0; i < n; i++){
+		qemu_get_buffer(f, (uint8_t*)name, TLBTRACE_NAME_MAX);
+		name[TLBTRACE_NAME_MAX - 1] = '\0';
+		if(map_name(name, &added) != (uint32_t)i + 1)	return -1;
+	}
+
+	n = qemu_get_be32(f);
+	for(i = 0; i < n; i++){
+		if(map_room() != 0)	return -1;
+		maps[map_nr].start = qemu_get_be32(f);
+		maps[map_nr].end = qemu_get_be32(f);
+		maps[map_nr].offset = qemu_get_be32(f);
+		maps[map_nr].name = qemu_get_be32(f);
+		maps[map_nr].asid = qemu_get_be32(f) & 0xFF;
+		if(maps[map_nr].name > (uint32_t)name_nr)	return -1;
+		map_nr++;
+	}
+
+	return 0;
+}
+
+/* Load the main TLBs of a saved configuration into \a conf, or skip them if \a c is NULL. */
+static void load_conf(QEMUFile *f, struct TLBTRACE_CONF *conf, int size)
+{
+	struct TLB_ENTRY e;
+	struct TLBTRACE_CPU *c;
+	unsigned long long hit, miss;
+	int idx, i, j;
+
+	for(i = 0; i < TLBTRACE_MAX_CPUS; i++){
+		c = conf != NULL ? &conf->cpus[i] : NULL;
+		hit = qemu_get_be64(f);
+		miss = qemu_get_be64(f);
+		idx = qemu_get_be32(f);
+		if(c != NULL){
+			c->sl_cnt.hit = hit;
+			c->sl_cnt.miss = miss;
+			c->last_ins_idx = idx;
+		}
+		for(j = 0; j < size; j++){
+			e.va = qemu_get_be32(f);
+			e.pa = qemu_get_be32(f);
+			e.asid = qemu_get_be32(f);
+			e.ts = qemu_get_be32(f);
+			if(c != NULL)	c->sl_tlb[j] = e;
+		}
+	}
+}
+
+static int tlbtrace_load(QEMUFile *f, void *opaque, int version_id)
+{
+	struct TLBTRACE_CONF *conf;
+	unsigned long long ts, insns;
+	unsigned int loaded = 0;
+	int started, n, size = 0, set = 0, k, j;
+
+	if(version_id < 1 || version_id > TLBTRACE_SAVE_VERSION)	return -1;
+
+	started = qemu_get_be32(f);
+	if(version_id == 1){
+		n = 1;
+		size = qemu_get_be32(f);
+		set = qemu_get_be32(f);
+	}else{
+		n = qemu_get_be32(f);
+	}
+	ts = qemu_get_be64(f);
+	insns = qemu_get_be64(f);
+	if(n < 0 || n > TLBTRACE_MAX_CONFS)	return -1;
+
+	// the tracer follows the snapshot: a new trace is started if it was running
+	tlbtrace_state_bh(NULL);
+	if(tlbtrace_started)	tlbtrace_stop();
+	if(started)	tlbtrace_start();
+
+	// a configuration is warm only if the snapshot has one with the same geometry, otherwise it starts cold
+	for(k = 0; k < n; k++){
+		if(version_id > 1){
+			size = qemu_get_be32(f);
+			set = qemu_get_be32(f);
+		}
+		if(size < 0 || size > 1024 * 1024)	return -1;
+
+		conf = NULL;
+		for(j = 0; started && j < nconf; j++){
+			if(!(loaded & (1 << j)) && confs[j].size == size && confs[j].set == set){
+				conf = &confs[j];
+				loaded |= 1 << j;
+				break;
+			}
+		}
+		load_conf(f, conf, size);
+	}
+
+	for(j = 0; started && j < nconf; j++){
+		if(!(loaded & (1 << j)))
+			fprintf(stderr, "[TLBTRACE] snapshot has no %d, %d-WAY main TLB, starting cold.\n", confs[j].size, confs[j].set);
+	}
+
+	if(loaded != 0){
+		systs = ts;
+		tlbtrace_insns = insns;
+		for(k = 0; k < nstream; k++)
+			confs[k].out.insns = insns;		// stamps count from the snapshot
+	}
+
+	tb_flush(first_cpu);	// regenerate all code with or without the trace ops
+	return load_maps(f, version_id);
+}
+
+int tlbtrace_init_qemu(const char *options)
+{
+	if(tlbtrace_init(64, 2, NULL) != 0)	return -1;
+	state_bh = qemu_bh_new(tlbtrace_state_bh, NULL);
+	register_savevm("tlbtrace", 0, TLBTRACE_SAVE_VERSION, tlbtrace_save, tlbtrace_load, NULL);
+	if(options != NULL && tlbtrace_set_options(options) != 0)	return -1;
+
+	return 0;
+}
+#endif /* USE_QEMU */
+
+void tlbtrace_destroy(void)
+{
+	fprintf(stderr, "[TLBTRACE] destroying... (%s:%d)\n", __FUNCTION__, __LINE__);
+
+	tlbtrace_started = 0;
+
+	free_tlbs();
+
+	while(name_nr > 0)
+		free(map_names[--name_nr]);
+	free(map_names);
+	map_names = NULL;
+	name_max = 0;
+	free(maps);
+	maps = NULL;
+	map_nr = map_max = 0;
 }
 
 #ifdef _MY_DEBUG_
@@ -30,15 +30,140 @@
  * @subsection trace_file_format Trace File Format
  * The trace file contains sequences of memory accesses specified in 4-tuples.
  * Each 4-tuple consists of four integers of uint32_t (mva, l1_pa, l2_pa, pa).
- * - \e mva is the modified input address, which is the prefix of the page number bitwise-OR with the traversal result.
- *   The least significant bit will be 1 when the traversal results in a page fault.
+ * - \e mva is the modified input address, which is the prefix of the page number bitwise-OR with the traversal result and the CPU ID.
+ *   Bits [3:0] hold the traversal result (see #TLBTRACE_RET_MASK). The least significant bit will be 1 when the traversal results in a page fault.
+ *   Bits [11:8] hold the ID of the CPU which made the access (see #TLBTRACE_CPU_MASK).
+ *   Bit 5 (#TLBTRACE_PRIV_FLAG) is set when the access was made in a privileged mode, see the \e priv option of tlbtrace_set_options().
+ *   Bits [7:6] hold the size of the guest mapping (see #TLBTRACE_SIZE_MASK): a 4 KB small page, a 64 KB large page,
+ *   a 1 MB section or a 16 MB supersection. A section record has the traversal result 1 and the output address in \e pa.
+ *   Records of all CPUs are interleaved in the order the accesses were made.
  * - \e l1_pa is the address of the first level descriptor of the page table for the input address.
  * - \e l2_pa is the address of the second level descriptor of the page table for the input address.
  * - \e pa is the output address.
+ *
+ * @subsection trace_events Event Records
+ * A record whose traversal result is 0 is an event rather than a memory access.
+ * Bits [7:4] of \e mva hold the type of the event (see #TLBTRACE_EVENT_MASK), and bits [11:8] the CPU ID.
+ * - #TLBTRACE_EVENT_MARKER: a named marker, see tlbtrace_marker().
+ *   The other three words hold the first 12 characters of the name, NUL-padded.
+ * - #TLBTRACE_EVENT_REFS: packed page references of a page-mode trace, see @ref trace_pages.
+ * - #TLBTRACE_EVENT_INSNS: an instruction stamp, written before a record once the number of guest instructions
+ *   (see #tlbtrace_insns) since the last stamp reaches the \e insns option of tlbtrace_set_options(), and when the tracer stops.
+ *   The other three words hold the number of instructions since the last stamp, LEB128-encoded:
+ *   7 bits per byte starting from the least significant ones, in the order of the bytes in the file,
+ *   with the most significant bit set in each byte but the last.
+ * - #TLBTRACE_EVENT_FLUSH: a TLB invalidation made by the CPU, see tlbtrace_flush_all().
+ *   Bits [31:12] of \e mva hold the page of an invalidation by MVA.
+ *   Bits [3:0] of the second word hold the operation (#TLBTRACE_FLUSH_ALL, ...), and bits [15:8] the ASID.
+ *   The last two words hold the addresses of the first and second level descriptors of the page, or 0 if they are unknown.
+ * - #TLBTRACE_EVENT_PC: a PC tag, see @ref trace_pcs.
+ * - #TLBTRACE_EVENT_MAP and #TLBTRACE_EVENT_NAME: a change of the memory mappings, and a part of a file name, see @ref trace_maps.
+ *
+ * @subsection trace_segments Trace Segments
+ * The trace file is named trace_MMDD_hhmm_<size>.<ways>, after the start time and the main TLB geometry.
+ * If the \e segment option of tlbtrace_set_options() is set, the trace is split into segments
+ * named trace_MMDD_hhmm_<size>.<ways>.NNNN instead, each holding at most the given number of bytes.
+ * A segment is written as <name>.part and renamed when it is complete,
+ * so finished segments can be simulated while the capture continues.
+ * Each complete segment is also appended to the index file trace_MMDD_hhmm_<size>.<ways>.idx,
+ * one line per segment: the file name, the number of the first record, the number of records and the number of bytes.
+ *
+ * In flight-recorder mode (the \e ring option), nothing is written until tlbtrace_trigger() is called or the tracer is stopped.
+ * Each dump of the ring is written as one segment, whose first record tells where it lies in the whole trace.
+ *
+ * @subsection trace_configs Multiple Configurations
+ * Several main TLB geometries can be captured in a single run with the \e tlbs option of tlbtrace_set_options().
+ * Each access is looked up in the main TLBs of every configuration, and the page table is walked once if any of them misses.
+ * Each configuration writes the accesses it misses to its own trace, named after its geometry as above,
+ * with its own segments, index and ring. Markers are added to every trace.
+ *
+ * @subsection trace_pages Page Mode
+ * With the \e mode=pages option of tlbtrace_set_options(), the main TLB is not simulated by the tracer.
+ * Instead, each access to another page than the last access of the same CPU is written to a single trace named
+ * trace_MMDD_hhmm_pages, and the simulator filters it through a main TLB of any geometry and policy, see tlbsim_set_main_tlb().
+ * Repeated accesses to the same page are hits in any main TLB and are only counted.
+ * - A walk record has #TLBTRACE_PAGE_FLAG set in \e mva, and the 8-bit ASID of the access in bits [7:0] of \e pa.
+ *   #TLBTRACE_GLOBAL is set in \e pa when the mapping is global, so that the simulated main TLB shares it among the ASIDs.
+ *   It is written the first time a page is seen, and whenever the walk or the privilege level of the accesses to the page changes.
+ *   The walks are kept in a direct-mapped table of 2^#TLBTRACE_DEDUP_BITS entries indexed by #TLBTRACE_DEDUP_IDX,
+ *   which the simulator rebuilds from the walk records.
+ * - Other accesses, whose walk and #TLBTRACE_PRIV_FLAG are the ones held by the table, are packed three by three into #TLBTRACE_EVENT_REFS events.
+ *   Bits [13:12] of \e mva hold the number of references, and each of the other three words the page,
+ *   the CPU ID in bits [11:8] and the ASID in bits [7:0] of a reference.
+ *
+ * The table is emptied at the start of each segment, and references are not packed in flight-recorder mode,
+ * so that every segment can be simulated on its own.
+ *
+ * @subsection trace_pcs PC Tags
+ * With the \e tag_pc option of tlbtrace_set_options(), the following records of a CPU are attributed to the PC
+ * of the instruction which made the access, see tlbtrace_set_pc().
+ * A #TLBTRACE_EVENT_PC event is written before a record whenever the PC or the ASID of its CPU changed since the last tag.
+ * The second word holds the PC, and bits [7:0] of the third word the ASID. The last word is 0.
+ * In page mode, the packed references of a CPU are attributed to its last tag as well.
+ * Each segment starts untagged. In flight-recorder mode, the records of a CPU before its first tag in a dump are attributed to PC 0.
+ *
+ * @subsection trace_maps Memory Mappings
+ * The tracer keeps the file mappings of each ASID reported by tlbtrace_map() and tlbtrace_unmap(), even while it is stopped.
+ * With the \e maps option of tlbtrace_set_options(), their changes are written to every trace,
+ * so that the simulator attributes the cost of the walks to the mapped files, see tlbsim_set_regions().
+ * - A #TLBTRACE_EVENT_NAME event holds a part of the file name whose index is in bits [31:12] of \e mva.
+ *   Bits [11:8] hold the number of the part, and the other three words its 12 characters.
+ *   A name is complete at the part holding its terminating NUL. Each file is named once, before its first mapping.
+ * - A #TLBTRACE_EVENT_MAP event holds the first page of a mapping in bits [31:12] of \e mva.
+ *   The second word holds the end of the mapping in bits [31:12], the operation in bits [11:8] (see #TLBTRACE_MAP_ADD),
+ *   and the ASID in bits [7:0]. The third word holds the offset in the file, and the last one the index of its name, 0 if anonymous.
+ *   A new mapping replaces the pages it overlaps in the same ASID.
+ * - Records of miss mode do not hold the ASID, so a #TLBTRACE_MAP_ASID event is written before a record
+ *   whenever the ASID of its CPU changed since the last one.
+ *
+ * All names and live mappings are repeated at the start of each segment, and the CPUs are marked again with their ASIDs.
+ * In flight-recorder mode, they are written at the start of each dump instead, and the ASIDs are marked again in each block of the ring.
  */
 #ifndef _TLB_TRACE_H_
 #define _TLB_TRACE_H_
 
+#include <stdint.h>
+
+#define TLBTRACE_RET_MASK	0x0000000F	/**< Mask of the traversal result in \e mva. */
+#define TLBTRACE_CPU_MASK	0x00000F00	/**< Mask of the CPU ID in \e mva. */
+#define TLBTRACE_CPU_SHIFT	8			/**< Shift of the CPU ID in \e mva. */
+#define TLBTRACE_EVENT_MASK	0x000000F0	/**< Mask of the event type in \e mva, see @ref trace_events. */
+#define TLBTRACE_EVENT_SHIFT	4			/**< Shift of the event type in \e mva. */
+#define TLBTRACE_EVENT_MARKER	1			/**< Event type of a named marker. */
+#define TLBTRACE_EVENT_REFS	2			/**< Event type of packed page references, see @ref trace_pages. */
+#define TLBTRACE_EVENT_FLUSH	3			/**< Event type of a TLB invalidation. */
+#define TLBTRACE_EVENT_INSNS	4			/**< Event type of an instruction stamp. */
+#define TLBTRACE_EVENT_PC		5			/**< Event type of a PC tag, see @ref trace_pcs. */
+#define TLBTRACE_EVENT_MAP		6			/**< Event type of a change of the memory mappings, see @ref trace_maps. */
+#define TLBTRACE_EVENT_NAME		7			/**< Event type of a part of a mapped file name, see @ref trace_maps. */
+#define TLBTRACE_FLUSH_ALL		0			/**< Invalidation of the whole TLB. */
+#define TLBTRACE_FLUSH_ENTRY	1			/**< Invalidation of a page of an ASID. */
+#define TLBTRACE_FLUSH_ASID		2			/**< Invalidation of an ASID. */
+#define TLBTRACE_FLUSH_MVA		3			/**< Invalidation of a page of all ASIDs. */
+#define TLBTRACE_MAP_ADD		1			/**< A file or anonymous memory is mapped. */
+#define TLBTRACE_MAP_REMOVE		2			/**< Pages are unmapped. */
+#define TLBTRACE_MAP_ASID		3			/**< The following records of the CPU are made in the ASID of the event. */
+#define TLBTRACE_MAP_OP_SHIFT	8			/**< Shift of the operation in the second word of a #TLBTRACE_EVENT_MAP event. */
+#define TLBTRACE_MAP_NO_ASID	0x100		/**< ASID of a CPU which is not known yet. */
+#define TLBTRACE_NAME_SHIFT		12			/**< Shift of the name index in \e mva of a #TLBTRACE_EVENT_NAME event. */
+#define TLBTRACE_NAME_MAX		192			/**< Maximum length of a file name, including the terminating NUL. */
+#define TLBTRACE_REFS_SHIFT	12			/**< Shift of the number of references in \e mva of a #TLBTRACE_EVENT_REFS event. */
+#define TLBTRACE_PAGE_FLAG	0x00000010	/**< Set in \e mva of the walk records of a page-mode trace. */
+#define TLBTRACE_PRIV_FLAG	0x00000020	/**< Set in \e mva of the accesses made in a privileged mode. */
+#define TLBTRACE_GLOBAL		0x00000100	/**< Set in \e pa of the walk records of a page-mode trace for a global mapping, i.e. without nG. */
+#define TLBTRACE_SIZE_MASK	0x000000C0	/**< Mask of the size of the guest mapping in \e mva. */
+#define TLBTRACE_SIZE_SHIFT	6			/**< Shift of the size of the guest mapping in \e mva. */
+#define TLBTRACE_SIZE_4K	0			/**< Size code of a small page. */
+#define TLBTRACE_SIZE_64K	1			/**< Size code of a large page. */
+#define TLBTRACE_SIZE_1M	2			/**< Size code of a section. */
+#define TLBTRACE_SIZE_16M	3			/**< Size code of a supersection. */
+#define TLBTRACE_PRIV_USER	1			/**< User accesses are traced, see the \e priv option of tlbtrace_set_options(). */
+#define TLBTRACE_PRIV_KERNEL	2			/**< Kernel accesses are traced. */
+#define TLBTRACE_DEDUP_BITS	16			/**< Size in bits of the walk table of page mode. */
+#define TLBTRACE_DEDUP_IDX(page, asid)	((((page) >> 12) ^ ((asid) << 8)) & ((1 << TLBTRACE_DEDUP_BITS) - 1))	/**< Index of a page in the walk table. */
+#define TLBTRACE_MAX_CPUS	16			/**< Maximum number of traced CPUs. */
+#define TLBTRACE_MAX_CONFS	8			/**< Maximum number of main TLB configurations, see @ref trace_configs. */
+
 /**
  * @brief Initialization function for the tracer.
  *
@@ -50,6 +175,9 @@
  * - \a l1 is a pointer to the output address of the first level descriptor of the page table.
  * - \a l2 is a pointer to the output address of the second level descriptor of the page table.
  * - \a pa is a pointer to the output address.
+ * - It returns 1 for a section or a fault of the first level, 2 for a fault of the second level and 3 for a page,
+ *   bitwise-OR with the size code of the mapping shifted by #TLBTRACE_SIZE_SHIFT. \a pa must be set for sections.
+ *   #TLBTRACE_GLOBAL may be added for a global mapping, which then hits in the main TLB with any ASID.
  * @return
  * - 0 on success.
  * - Negative integer on failure.
@@ -72,6 +200,10 @@ void tlbtrace_destroy(void);
  * - \e $mm is the minute of the current time.
  * - \e $size is the size of the main TLB passed to tlbtrace_init().
  * - \e $set is the set associativity of the main TLB passed to tlbtrace_init().
+ *
+ * One trace file is created per main TLB configuration, see @ref trace_configs.
+ *
+ * If segments are enabled, the trace is split as described in @ref trace_segments.
  */
 void tlbtrace_start(void);
 
@@ -79,14 +211,50 @@ void tlbtrace_start(void);
  * @brief Stop the tracer.
  *
  * Flush buffered data and close the trace file.
+ * In flight-recorder mode, the ring is dumped as by tlbtrace_trigger().
  */
 void tlbtrace_stop(void);
 
+/**
+ * @brief Start or stop the tracer.
+ *
+ * When integrated with QEMU, a deferred start or stop is completed first, and the translation cache is flushed as well,
+ * so that translated code only contains the trace operations while the tracer is running.
+ *
+ * @param on 1 to start the tracer, 0 to stop it. Nothing is done if it is already in that state.
+ */
+void tlbtrace_set_state(int on);
+
 /**
  * @brief Toggle the start/stop state of the tracer.
+ *
+ * Same as tlbtrace_set_state() with the other state. A stop that has been requested, e.g. by a stop condition,
+ * but not completed yet counts as a running tracer: the toggle completes it and does not start a new trace.
  */
 void tlbtrace_toggle(void);
 
+/**
+ * @brief Dump the flight recorder.
+ *
+ * Writes the records kept in the ring to a new trace segment and empties the ring.
+ * The tracer keeps running.
+ *
+ * @return
+ * - 0 on success
+ * - -1 if the tracer is not running or not in flight-recorder mode.
+ */
+int tlbtrace_trigger(void);
+
+/**
+ * @brief Add a named marker to the trace file.
+ *
+ * It is ignored while the tracer is not running.
+ *
+ * @param cpu ID of the CPU, which must be less than #TLBTRACE_MAX_CPUS.
+ * @param name Name of the marker. Only the first 12 characters are kept.
+ */
+void tlbtrace_marker(int cpu, const char *name);
+
 /**
  * @brief Get the state of the tracer.
  *
@@ -96,10 +264,94 @@ void tlbtrace_toggle(void);
  */
 int tlbtrace_enabled(void);
 
+/**
+ * @brief Configure the tracer at run time.
+ *
+ * \e options is a comma-separated list of \e name=value pairs:
+ * - \e size: number of entries of the main TLB (default 64).
+ * - \e ways: associativity of the main TLB (default 2).
+ * - \e tlbs: list of up to #TLBTRACE_MAX_CONFS main TLB geometries captured together, in the format
+ *   \e size.ways[+size.ways...], e.g. tlbs=64.2+128.4, see @ref trace_configs.
+ *   \e size and \e ways set a single configuration.
+ * - \e mode: \e miss to write the main TLB misses (default), or \e pages to write every page transition, see @ref trace_pages.
+ * - \e dir: directory where the trace file is created (default the current directory).
+ * - \e buffer: size in bytes of the write buffer, with an optional K, M or G suffix (default 32M, at most 1G).
+ * - \e segment: maximum size in bytes of a trace segment, see @ref trace_segments (default 0, a single file).
+ * - \e ring: number of records kept in memory in flight-recorder mode (default 0, records are streamed to the file, at most 64M).
+ *   \e buffer and \e segment are ignored in this mode.
+ * - \e ring_time: in flight-recorder mode, only records of the last given seconds are dumped (default 0, the whole ring).
+ * - \e priv: privilege levels traced by QEMU, \e user (default), \e kernel or \e all.
+ *   Accesses made in a privileged mode are marked with #TLBTRACE_PRIV_FLAG.
+ * - \e insns: number of guest instructions between instruction stamps, see @ref trace_events (default 100K, 0 to disable).
+ *   With 1, each record is preceded by a stamp if any instruction was executed since the previous one.
+ * - \e tag_pc: 1 to tag the records with the PC of the access, see @ref trace_pcs (default 0).
+ * - \e maps: 1 to write the changes of the memory mappings, see @ref trace_maps (default 0).
+ *
+ * The tracer stops by itself when any of the following limits is reached (default 0, no limit):
+ * - \e stop: number of main TLB references.
+ * - \e stop_bytes: number of bytes written to the trace.
+ * - \e stop_time: wall time in seconds.
+ * - \e stop_insns: number of guest instructions, see #tlbtrace_insns.
+ *
+ * Accesses can be restricted with the following filters, which may be repeated (default none).
+ * Filtered accesses are dropped before the main TLB lookup.
+ * - \e asid: trace the given address space ID.
+ * - \e va: trace virtual addresses in the range \e start-end, where \e end is exclusive, e.g. va=0x8000-0x10000.
+ * - \e pc: trace accesses made by instructions in the range \e start-end (QEMU only).
+ *   The PC of a data access is the one of the last traced instruction fetch, i.e. of the instruction which made it.
+ * - \e proc: trace the process with the given name (QEMU only), see tlbtrace_proc_name().
+ * - \e filter=none: remove all filters.
+ *
+ * Counts accept an optional K, M or G (10^3, 10^6, 10^9) suffix, and sizes in bytes a K, M or G (2^10, 2^20, 2^30) suffix.
+ * The limits are checked at each access, except the wall time, which is read every 1K records and every 64K accesses.
+ * \e stop_bytes counts the bytes of all traces.
+ *
+ * The main TLBs are reallocated if their geometry is changed, so the tracer must not be running.
+ *
+ * @param options Option string, e.g. "size=128,ways=4,dir=/tmp".
+ * @return
+ * - 0 on success
+ * - -1 on a malformed or invalid option, or if the tracer is running.
+ */
+int tlbtrace_set_options(const char *options);
+
+/**
+ * @brief Live counters of the tracer.
+ */
+struct TLBTRACE_STATS{
+	int running;						/**< Whether the tracer is running. */
+	unsigned long long hit;				/**< Main TLB hits of all CPUs, in the first configuration. In page mode, repeated accesses to the same page. */
+	unsigned long long miss;			/**< Main TLB misses of all CPUs, in the first configuration. In page mode, page transitions. */
+	unsigned long long insns;			/**< Guest instructions, see #tlbtrace_insns. */
+	unsigned long long filtered;		/**< Accesses dropped by the filters. */
+	unsigned long long records;			/**< Records added to the trace files. */
+	unsigned long long bytes;			/**< Bytes written to the trace files. */
+	unsigned long long elapsed_ns;		/**< Wall time since the tracer was started. */
+	unsigned long long overhead_ns;		/**< Estimated time spent on page table traversal and file writes. */
+};
+
+/**
+ * @brief Get the counters of the current (or the last) tracing session.
+ *
+ * The counters are reset by tlbtrace_start().
+ *
+ * @param stats Where the counters are stored.
+ */
+void tlbtrace_get_stats(struct TLBTRACE_STATS *stats);
+
+/**
+ * @brief Number of guest instructions executed since the tracer was started.
+ *
+ * It is incremented by the integrating emulator, and is used by the \e stop_insns condition.
+ * When integrated with QEMU, translated code adds the length of each TB when the TB is entered.
+ */
+extern unsigned long long tlbtrace_insns;
+
 /**
  * @brief Add a memory access to the trace file.
  *
  * It first looks up the main TLB. If the TLB is hit, it returns directly. Otherwise, it initiates a page translation.
+ * The access is accounted to CPU 0. It is ignored while the tracer is not running.
  *
  * @param addr Address to be traced.
  * @param asid Address space ID of the referenced address.
@@ -110,7 +362,189 @@ int tlbtrace_enabled(void);
  */
 void tlbtrace_refmem(unsigned int addr, unsigned int asid, int ins, void *arg);
 
+/**
+ * @brief Add a memory access made by a specific CPU to the trace file.
+ *
+ * Same as tlbtrace_refmem(), except that each CPU looks up its own main TLB,
+ * and the record is tagged with the ID of the CPU.
+ *
+ * @param cpu ID of the CPU, which must be less than #TLBTRACE_MAX_CPUS.
+ * @param addr Address to be traced.
+ * @param asid Address space ID of the referenced address.
+ * @param ins Whether it is an instruction fetch or a data load/store operation.
+ * @param arg A user-defined object which will be passed to the callback function for page table traversal.
+ */
+void tlbtrace_refmem_cpu(int cpu, unsigned int addr, unsigned int asid, int ins, void *arg);
+
+/**
+ * @brief Set the PC of the following accesses of a CPU.
+ *
+ * The PC is written to the trace with the \e tag_pc option, see @ref trace_pcs.
+ * When integrated with QEMU, it is set by each instruction fetch, which is traced before the data accesses
+ * of its instruction, so the PC of a data access is the one of its instruction, as for the \e pc filter.
+ *
+ * @param cpu ID of the CPU, which must be less than #TLBTRACE_MAX_CPUS.
+ * @param pc Program counter.
+ */
+void tlbtrace_set_pc(int cpu, unsigned int pc);
+
+/**
+ * @brief Invalidate the whole main TLB of the current CPU.
+ *
+ * The invalidation is also written to the trace, see @ref trace_events.
+ * Without QEMU, the current CPU is CPU 0.
+ */
+void tlbtrace_flush_all(void);
+
+/**
+ * @brief Invalidate a page of an ASID in the main TLB of the current CPU.
+ *
+ * @param va Virtual address of the page, with the ASID in bits [7:0].
+ */
+void tlbtrace_flush_entry(unsigned long va);
+
+/**
+ * @brief Invalidate an ASID in the main TLB of the current CPU.
+ *
+ * @param asid ASID to invalidate.
+ */
+void tlbtrace_flush_asid(unsigned long asid);
+
+/**
+ * @brief Invalidate a page of all ASIDs in the main TLB of the current CPU.
+ *
+ * @param va Virtual address of the page.
+ */
+void tlbtrace_flush_mva(unsigned long va);
+
+/**
+ * @brief Add a memory mapping of an address space.
+ *
+ * The pages of [\a start, \a end) replace the ones they overlap in the same ASID, as with mmap().
+ * The change is written to the traces with the \e maps option, see @ref trace_maps.
+ * Names are truncated to #TLBTRACE_NAME_MAX - 1 characters.
+ *
+ * @param asid Address space ID.
+ * @param start Start address, rounded down to a page.
+ * @param end End address, exclusive, rounded up to a page.
+ * @param offset Offset of \a start in the file.
+ * @param path Path of the mapped file, or NULL for anonymous memory.
+ */
+void tlbtrace_map(unsigned int asid, uint32_t start, uint32_t end, uint32_t offset, const char *path);
+
+/**
+ * @brief Remove the memory mappings of a range of an address space.
+ *
+ * Mappings which cover a part of the range are cut, as with munmap().
+ *
+ * @param asid Address space ID.
+ * @param start Start address, rounded down to a page.
+ * @param end End address, exclusive, rounded up to a page.
+ */
+void tlbtrace_unmap(unsigned int asid, uint32_t start, uint32_t end);
+
 #ifdef USE_QEMU
+/**
+ * @brief Initialize the tracer with the default geometry and apply \e options.
+ *
+ * The tracer is also registered with savevm/loadvm. A snapshot holds the main TLBs and their counters, the memory mappings,
+ * and whether the tracer was running. Loading a snapshot of a running tracer starts a new trace file,
+ * each configuration from warm main TLBs if the snapshot has one with the same geometry, or from cold ones otherwise.
+ *
+ * @param options Option string of tlbtrace_set_options(), or NULL.
+ * @return 0 on success, -1 otherwise.
+ */
+int tlbtrace_init_qemu(const char *options);
+
+/**
+ * @brief Notify the tracer that the current process has been named.
+ *
+ * If \e name is selected by the \e proc option, the current address space ID is added to the traced ones.
+ * Called with the thread names reported by the goldfish trace device, like trace_name().
+ *
+ * @param name Name of the current thread, truncated to 15 characters by the guest kernel.
+ */
+void tlbtrace_proc_name(const char *name);
+
+/**
+ * @name Guest Requests
+ * A guest program controls the tracer with the reserved coprocessor write
+ * <tt>mcr p15, 7, Rt, c15, c15, op</tt>, which is allowed in user mode.
+ * Its \e op is one of the following. It is not available on real hardware.
+ * @{
+ */
+#define TLBTRACE_MAGIC_MASK		0x0FFF0F1F	/**< Mask of the fixed bits of the guest request. */
+#define TLBTRACE_MAGIC_INSN		0x0EEF0F1F	/**< Fixed bits of the guest request. */
+#define TLBTRACE_MAGIC_START	0			/**< Start the tracer. */
+#define TLBTRACE_MAGIC_STOP		1			/**< Stop the tracer. */
+#define TLBTRACE_MAGIC_MARKER	2			/**< Add a marker named by the string at the virtual address in Rt. */
+#define TLBTRACE_MAGIC_TRIGGER	3			/**< Dump the flight recorder, see tlbtrace_trigger(). */
+/** @} */
+
+/**
+ * @brief Handle a guest request.
+ *
+ * Starting and stopping are deferred to the main loop, since they flush the translated code.
+ *
+ * @param env CPU which made the request.
+ * @param op Request, one of the TLBTRACE_MAGIC_* values.
+ * @param val Value of Rt.
+ */
+void tlbtrace_magic(CPUState *env, int op, uint32_t val);
+
+/**
+ * @brief Notify the tracer that the current process has executed a new program.
+ *
+ * Same as tlbtrace_proc_name(), with the base name of argv[0]. Called like trace_execve().
+ *
+ * @param argv Arguments of the program, separated by '\\0'.
+ * @param len Length of \e argv.
+ */
+void tlbtrace_proc_execve(const char *argv, int len);
+
+/**
+ * @brief Notify the tracer that the current process has mapped a file.
+ *
+ * Same as tlbtrace_map() in the current address space ID. Called like trace_mmap().
+ * The guest kernel only reports the executable mappings of files.
+ *
+ * @param start Start address.
+ * @param end End address, exclusive.
+ * @param offset Offset of \a start in the file.
+ * @param path Path of the file.
+ */
+void tlbtrace_proc_mmap(unsigned long start, unsigned long end, unsigned long offset, const char *path);
+
+/**
+ * @brief Notify the tracer that the current process has unmapped a range.
+ *
+ * Same as tlbtrace_unmap() in the current address space ID. Called like trace_munmap().
+ *
+ * @param start Start address.
+ * @param end End address, exclusive.
+ */
+void tlbtrace_proc_munmap(unsigned long start, unsigned long end);
+
+/**
+ * @brief Notify the tracer that the CPU has switched to another context ID.
+ *
+ * An address space ID selected by the \e proc option is no longer traced once the guest kernel
+ * reassigns it to another process, i.e. the upper bits of the context ID change.
+ * It is also dropped when its process executes a program with another name.
+ * Called when the context ID register is written.
+ *
+ * @param ctx New value of the context ID register.
+ */
+void tlbtrace_proc_context(unsigned long ctx);
+
+/**
+ * @brief Running state of the tracer.
+ *
+ * It is exported so that the memory access hooks of QEMU can test it inline
+ * instead of calling into the tracer on every access.
+ */
+extern int tlbtrace_started;
+
 /**
  * @brief Helper function for tracing instruction fetches in QEMU.
  *